@@ -0,0 +1,109 @@
+#include "client_benchmarks.h"
+#include "../scenario/scenario.h"
+#include "../../client/messages/messages.h"
+#include "../../server/messages/compact.h"
+
+#define READ_ITERATIONS 50 // Every iteration starts with a copy of client's state.
+
+// Game recorded on server, in encoding client reads it.
+struct ClientStream {
+    List<uint8_t> hello;
+    List<uint8_t> start; // GameStarted and Turn 0.
+    List<uint8_t> turns;
+    bool compact;
+};
+
+// Returns [game] in plain or [compact] encoding.
+static ClientStream client_stream(const RecordedGame &game, uint16_t size_x, bool compact) {
+    ClientStream stream{game.hello, game.game_started, game.turns, compact};
+    stream.start.insert(stream.start.end(), game.turn_0.begin(), game.turn_0.end());
+    if (compact) {
+        Map<PlayerId, Position> positions;
+        stream.start = encode_compact(stream.start, size_x, positions);
+        stream.turns = encode_compact(stream.turns, size_x, positions);
+    }
+    return stream;
+}
+
+// Puts [bytes] into data received from server and reads them.
+static void read_from_server(ClientData &data, const List<uint8_t> &bytes) {
+    data.server_in.insert(data.server_in.end(), bytes.begin(), bytes.end());
+    read_messages_from_server(data);
+}
+
+// Returns state of client that got Hello from [stream].
+static ClientData client_after_hello(const ClientStream &stream) {
+    ClientData data;
+    data.init();
+    read_from_server(data, stream.hello);
+    data.compact_encoding = stream.compact;
+    return data;
+}
+
+// Reads Turn 0 and Turns of [stream], starting from client's state at the
+// beginning of the game.
+static void bench_read(Harness &harness, const Scenario &scenario, const ClientStream &stream) {
+    const char *turn_0_name = stream.compact ? "read_turn_0_compact" : "read_turn_0";
+    const char *turns_name = stream.compact ? "read_turn_compact" : "read_turn";
+    ClientData initial = client_after_hello(stream);
+    ClientData data;
+
+    harness.run(turn_0_name, "", scenario.arguments(), 1,
+                [&]() { data = initial; },
+                [&]() {
+                    read_from_server(data, stream.start);
+                    return stream.start.size();
+                }, READ_ITERATIONS);
+
+    read_from_server(initial, stream.start);
+    harness.run(turns_name, "", scenario.arguments(), SCENARIO_TURNS,
+                [&]() { data = initial; },
+                [&]() {
+                    read_from_server(data, stream.turns);
+                    return stream.turns.size();
+                }, READ_ITERATIONS);
+}
+
+// Serializes state of client at the end of [stream] for GUI. Skipped if Game
+// message would not fit in a datagram.
+static void bench_gui_frame(Harness &harness, const Scenario &scenario, const ClientStream &stream) {
+    static GuiFrame frame;
+    if (!harness.selected("build_game_frame")) {
+        return;
+    }
+
+    ClientData data = client_after_hello(stream);
+    read_from_server(data, stream.start);
+    read_from_server(data, stream.turns);
+    size_t positions = data.blocks.size() + data.explosions.size() + data.bombs.size() + data.player_positions.size();
+    if (4 * positions >= DATAGRAM_LIMIT / 2) {
+        return;
+    }
+
+    harness.run("build_game_frame", "", scenario.arguments(), 1, []() {},
+                [&]() {
+                    build_message_to_gui(data, frame);
+                    return frame.length;
+                });
+}
+
+void run_client_benchmarks(Harness &harness, const BenchParameters &parameters) {
+    for (const Scenario &scenario : default_scenarios()) {
+        bool read_selected = harness.selected("read_turn_0") || harness.selected("read_turn")
+                             || harness.selected("read_turn_0_compact") || harness.selected("read_turn_compact");
+        if (!read_selected && !harness.selected("build_game_frame")) {
+            continue;
+        }
+
+        RecordedGame game = record_game<ChunkedBoard>(scenario, parameters.seed, SCENARIO_TURNS);
+        for (bool compact : {false, true}) {
+            ClientStream stream = client_stream(game, scenario.size_x, compact);
+            if (read_selected) {
+                bench_read(harness, scenario, stream);
+            }
+            if (!compact) {
+                bench_gui_frame(harness, scenario, stream);
+            }
+        }
+    }
+}
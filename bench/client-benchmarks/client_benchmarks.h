@@ -0,0 +1,10 @@
+#ifndef CLIENT_BENCHMARKS_H
+#define CLIENT_BENCHMARKS_H
+
+#include "../harness/harness.h"
+
+// Runs benchmarks of reading Turns from server, in both encodings, and
+// serializing game state for GUI.
+void run_client_benchmarks(Harness &harness, const BenchParameters &parameters);
+
+#endif // CLIENT_BENCHMARKS_H
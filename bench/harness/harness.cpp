@@ -0,0 +1,99 @@
+#include "harness.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// Number of allocations made by the thread. Benchmarks count allocations of
+// the main thread only, so helper threads do not race on the counter.
+static thread_local uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    free(pointer);
+}
+
+bool Harness::selected(const std::string &name) const {
+    return name.find(parameters.filter) != std::string::npos;
+}
+
+void Harness::run(const std::string &name, const std::string &board, const BenchArguments &arguments,
+                  uint64_t items, const std::function<void()> &prepare, const std::function<size_t()> &iterate,
+                  uint64_t max_iterations) {
+    if (!selected(name)) {
+        return;
+    }
+
+    BenchResult result;
+    result.name = name;
+    result.board = board;
+    result.arguments = arguments;
+    result.items = items;
+
+    List<double> samples;
+    double total_ns = 0;
+    uint64_t total_allocations = 0;
+    while (samples.size() < max_iterations
+           && (samples.size() < MIN_ITERATIONS || total_ns < (double) parameters.min_time * 1e6)) {
+        prepare();
+        uint64_t allocations_before = allocations;
+        auto start = std::chrono::steady_clock::now();
+        result.bytes = iterate();
+        auto end = std::chrono::steady_clock::now();
+        total_allocations += allocations - allocations_before;
+
+        auto sample = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        samples.push_back(sample);
+        total_ns += sample;
+    }
+
+    result.iterations = samples.size();
+    result.mean_ns = total_ns / (double) samples.size();
+    result.allocations = (double) total_allocations / (double) samples.size();
+    std::sort(samples.begin(), samples.end());
+    result.median_ns = samples[samples.size() / 2];
+    result.min_ns = samples.front();
+    result.max_ns = samples.back();
+    results.push_back(result);
+
+    fprintf(stderr, "%-22s %-13s", name.c_str(), board.c_str());
+    for (const auto &argument : arguments) {
+        fprintf(stderr, " %s=%lu", argument.first.c_str(), argument.second);
+    }
+    fprintf(stderr, ": %.0f ns, %.1f allocations\n", result.median_ns, result.allocations);
+}
+
+void Harness::write_json(FILE *file) const {
+    fprintf(file, "{\n  \"seed\": %u,\n  \"min_time_ms\": %lu,\n  \"benchmarks\": [", parameters.seed,
+            parameters.min_time);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &result = results[i];
+        fprintf(file, "%s\n    {\"name\": \"%s\"", i == 0 ? "" : ",", result.name.c_str());
+        if (!result.board.empty()) {
+            fprintf(file, ", \"board\": \"%s\"", result.board.c_str());
+        }
+        for (const auto &argument : result.arguments) {
+            fprintf(file, ", \"%s\": %lu", argument.first.c_str(), argument.second);
+        }
+        fprintf(file, ", \"iterations\": %lu, \"items\": %lu, \"bytes\": %lu", result.iterations, result.items,
+                result.bytes);
+        fprintf(file, ", \"mean_ns\": %.0f, \"median_ns\": %.0f, \"min_ns\": %.0f, \"max_ns\": %.0f",
+                result.mean_ns, result.median_ns, result.min_ns, result.max_ns);
+        fprintf(file, ", \"allocations\": %.1f}", result.allocations);
+    }
+    fprintf(file, "\n  ]\n}\n");
+}
@@ -0,0 +1,71 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <functional>
+#include <string>
+
+#include "../../common/types.h"
+
+#define DEFAULT_MIN_TIME 200     // Milliseconds every benchmark runs at least.
+#define MIN_ITERATIONS 3         // Iterations every benchmark runs at least.
+#define MAX_ITERATIONS 1000000   // Iterations after which benchmark stops.
+#define DEFAULT_THREADS 4        // Threads of parallel benchmarks besides the main one.
+#define MAX_THREADS 16
+
+// Struct containing information from command line parameters.
+struct BenchParameters {
+    std::string filter;   // Only benchmarks with names containing it are run.
+    uint64_t min_time = DEFAULT_MIN_TIME;
+    std::string output;   // JSON is written there, to stdout if empty.
+    uint32_t seed = 0;
+    uint8_t threads = DEFAULT_THREADS;
+};
+
+// Named numbers describing benchmark's case, e.g. board size or players.
+using BenchArguments = List<std::pair<std::string, uint64_t>>;
+
+// Measurements of one benchmark.
+struct BenchResult {
+    std::string name;
+    std::string board;     // Board type, empty if benchmark does not use one.
+    BenchArguments arguments;
+    uint64_t iterations = 0;
+    uint64_t items = 0;    // Turns, messages etc. processed by one iteration.
+    uint64_t bytes = 0;    // Bytes produced or consumed by one iteration.
+    double mean_ns = 0;
+    double median_ns = 0;
+    double min_ns = 0;
+    double max_ns = 0;
+    double allocations = 0; // Average number of allocations in one iteration.
+};
+
+// Runs benchmarks and collects their results. Every benchmark is run
+// repeatedly, until it took [min_time] milliseconds in total and at least
+// MIN_ITERATIONS iterations were run. Only the iteration itself is timed,
+// preparing it is not.
+class Harness {
+public:
+    explicit Harness(const BenchParameters &parameters) : parameters(parameters) {}
+
+    // Returns true if benchmark [name] should be run. Used to skip preparing
+    // benchmarks that are filtered out.
+    bool selected(const std::string &name) const;
+
+    // Runs benchmark [name] on [board] with [arguments], unless it is not
+    // selected. [prepare] is called before every iteration, [iterate] is
+    // the timed iteration and returns number of bytes it produced or
+    // consumed. One iteration processes [items] items. At most
+    // [max_iterations] iterations are run.
+    void run(const std::string &name, const std::string &board, const BenchArguments &arguments, uint64_t items,
+             const std::function<void()> &prepare, const std::function<size_t()> &iterate,
+             uint64_t max_iterations = MAX_ITERATIONS);
+
+    // Writes results of all benchmarks run so far as JSON to [file].
+    void write_json(FILE *file) const;
+
+private:
+    const BenchParameters &parameters;
+    List<BenchResult> results;
+};
+
+#endif // HARNESS_H
@@ -0,0 +1,83 @@
+// Microbenchmarks of server and client hot paths. Results are written as JSON,
+// so they can be compared between versions.
+
+#include "harness/harness.h"
+#include "server-benchmarks/server_benchmarks.h"
+#include "client-benchmarks/client_benchmarks.h"
+#include "../common/err.h"
+
+#include <cstring>
+#include <iostream>
+
+static void print_help() {
+    std::cout << "USAGE:\n"
+              << "    ./robots-bench [-f <filter>] [-t <min_time>] [-o <output_file>] [-s <seed>] [-j <threads>]"
+              << "\n\nOPTIONS\n"
+              << "    -f <filter> (optional, only benchmarks with names containing it are run)\n"
+              << "    -h <help>\n"
+              << "    -j <threads> (optional, threads of parallel benchmarks besides the main one, default "
+              << DEFAULT_THREADS << ")\n"
+              << "    -o <output_file> (optional, JSON is written to stdout by default)\n"
+              << "    -s <seed> (optional, default 0)\n"
+              << "    -t <min_time> (optional, milliseconds every benchmark runs at least, default "
+              << DEFAULT_MIN_TIME << ")\n";
+}
+
+// Returns value of number [str] not greater than [max_value]. Calls fatal()
+// if it is incorrect.
+static uint64_t read_number(const char *option, const char *str, uint64_t max_value) {
+    errno = 0;
+    char *end_ptr;
+    auto value = (uint64_t) strtoull(str, &end_ptr, 10);
+    if (*end_ptr != '\0' || errno != 0 || value > max_value) {
+        fatal("Incorrect value %s of parameter %s.", str, option);
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    BenchParameters parameters;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            print_help();
+            return 0;
+        }
+    }
+    if (argc % 2 == 0) {
+        fatal("Every parameter must have value.");
+    }
+    for (int i = 1; i < argc; i += 2) {
+        if (strcmp(argv[i], "-f") == 0) {
+            parameters.filter = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-t") == 0) {
+            parameters.min_time = read_number(argv[i], argv[i + 1], UINT32_MAX);
+        }
+        else if (strcmp(argv[i], "-o") == 0) {
+            parameters.output = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-j") == 0) {
+            parameters.threads = (uint8_t) read_number(argv[i], argv[i + 1], MAX_THREADS);
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            parameters.seed = (uint32_t) read_number(argv[i], argv[i + 1], UINT32_MAX);
+        }
+        else {
+            fatal("Incorrect parameter %s.", argv[i]);
+        }
+    }
+
+    Harness harness(parameters);
+    run_server_benchmarks(harness, parameters);
+    run_client_benchmarks(harness, parameters);
+
+    FILE *output = parameters.output.empty() ? stdout : fopen(parameters.output.c_str(), "w");
+    if (output == nullptr) {
+        fatal("Could not create output file %s.", parameters.output.c_str());
+    }
+    harness.write_json(output);
+    if (output != stdout && fclose(output) != 0) {
+        fatal("Could not write output file %s.", parameters.output.c_str());
+    }
+}
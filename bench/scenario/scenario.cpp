@@ -0,0 +1,93 @@
+#include "scenario.h"
+
+#define SCENARIO_BLOCK_SHARE 0.05 // Part of players placing blocks in every turn.
+
+BenchArguments Scenario::arguments() const {
+    return {{"size_x", size_x}, {"size_y", size_y}, {"players", players}, {"bombs", bombs}, {"blocks", blocks}};
+}
+
+List<Scenario> default_scenarios() {
+    return {
+        {15, 15, 4, 8, 40},
+        {100, 100, 8, 32, 2000},
+        {1000, 1000, 25, 100, 60000},
+        {2000, 2000, 25, 100, 1000000},
+        {UINT16_MAX, UINT16_MAX, 25, 100, 1000000},
+    };
+}
+
+ServerParameters scenario_parameters(const Scenario &scenario, uint32_t seed) {
+    ServerParameters parameters;
+    parameters.bomb_timer = SCENARIO_BOMB_TIMER;
+    parameters.players_count = scenario.players;
+    parameters.explosion_radius = SCENARIO_EXPLOSION_RADIUS;
+    parameters.initial_blocks = scenario.blocks;
+    parameters.exact_blocks = true;
+    parameters.game_length = UINT16_MAX;
+    parameters.server_name = "bench";
+    parameters.seed = seed;
+    parameters.size_x = scenario.size_x;
+    parameters.size_y = scenario.size_y;
+    return parameters;
+}
+
+std::unique_ptr<ServerData> scenario_data(const ServerParameters &parameters) {
+    auto data = std::make_unique<ServerData>(parameters.seed, parameters.players_count,
+                                             parameters.size_x, parameters.size_y);
+    for (PlayerId id = 0; id < parameters.players_count; id++) {
+        data->players[id] = Player("bot" + std::to_string(id), "[::1]:" + std::to_string(20000 + id));
+        data->poll_ids[id] = id + 1;
+    }
+    data->clear_clients_last_messages();
+    return data;
+}
+
+List<uint8_t> random_actions(const Scenario &scenario, std::minstd_rand &random) {
+    double bomb_share = std::min(1.0, scenario.bombs / (double) (SCENARIO_BOMB_TIMER * scenario.players));
+    std::uniform_real_distribution<double> share(0, 1);
+    List<uint8_t> actions(scenario.players);
+    for (PlayerId id = 0; id < scenario.players; id++) {
+        double action = share(random);
+        if (action < bomb_share) {
+            actions[id] = PLACE_BOMB;
+        }
+        else if (action < bomb_share + SCENARIO_BLOCK_SHARE) {
+            actions[id] = PLACE_BLOCK;
+        }
+        else {
+            actions[id] = (uint8_t) (MOVE + random() % 4);
+        }
+    }
+    return actions;
+}
+
+void choose_actions(const Scenario &scenario, ServerData &data) {
+    List<uint8_t> actions = random_actions(scenario, data.random);
+    for (PlayerId id = 0; id < scenario.players; id++) {
+        data.clients_last_messages[data.poll_ids[id]] = actions[id];
+    }
+}
+
+template<class Board>
+RecordedGame record_game(const Scenario &scenario, uint32_t seed, uint16_t turns) {
+    ServerParameters parameters = scenario_parameters(scenario, seed);
+    std::unique_ptr<ServerData> data = scenario_data(parameters);
+
+    RecordedGame game;
+    game.hello = build_hello(parameters);
+    game.game_started = build_game_started(*data);
+    game.turn_0 = build_turn_0<Board>(parameters, *data);
+    data->set_up_new_game();
+
+    for (uint16_t turn = 1; turn <= turns; turn++) {
+        choose_actions(scenario, *data);
+        data->next_turn();
+        List<uint8_t> message = build_turn<Board>(parameters, *data);
+        game.turns.insert(game.turns.end(), message.begin(), message.end());
+    }
+    return game;
+}
+
+template RecordedGame record_game<GenericBoard>(const Scenario &, uint32_t, uint16_t);
+template RecordedGame record_game<SmallBoard>(const Scenario &, uint32_t, uint16_t);
+template RecordedGame record_game<ChunkedBoard>(const Scenario &, uint32_t, uint16_t);
@@ -0,0 +1,58 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <memory>
+
+#include "../harness/harness.h"
+#include "../../server/messages/messages.h"
+
+#define SCENARIO_BOMB_TIMER 8
+#define SCENARIO_EXPLOSION_RADIUS 4
+#define SCENARIO_TURNS 100 // Turns of games recorded for client benchmarks.
+
+// Game benchmarks are run on.
+struct Scenario {
+    uint16_t size_x;
+    uint16_t size_y;
+    uint8_t players;
+    uint32_t bombs;  // Average number of bombs on board during the game.
+    uint32_t blocks; // Blocks placed in Turn 0.
+
+    // Returns scenario's numbers for benchmark results.
+    BenchArguments arguments() const;
+};
+
+// Scenarios from a few players on a small board up to a huge sparse map.
+List<Scenario> default_scenarios();
+
+// Returns server parameters of game in [scenario].
+ServerParameters scenario_parameters(const Scenario &scenario, uint32_t seed);
+
+// Returns server's data with players of [scenario] accepted, ready to build
+// Turn 0.
+std::unique_ptr<ServerData> scenario_data(const ServerParameters &parameters);
+
+// Returns actions of all players for the next turn, by player id: mostly
+// moves, and bombs often enough to keep [scenario.bombs] bombs on board on
+// average.
+List<uint8_t> random_actions(const Scenario &scenario, std::minstd_rand &random);
+
+// Sets actions of all players for the next turn in [data], chosen with
+// [data.random].
+void choose_actions(const Scenario &scenario, ServerData &data);
+
+// Messages client gets from server during game.
+struct RecordedGame {
+    List<uint8_t> hello;
+    List<uint8_t> game_started;
+    List<uint8_t> turn_0;
+    List<uint8_t> turns; // Turns after Turn 0.
+};
+
+// Plays game of [scenario] for [turns] turns on board of type [Board] and
+// returns messages client gets. Instantiated for GenericBoard, SmallBoard and
+// ChunkedBoard.
+template<class Board>
+RecordedGame record_game(const Scenario &scenario, uint32_t seed, uint16_t turns);
+
+#endif // SCENARIO_H
@@ -0,0 +1,541 @@
+#include "server_benchmarks.h"
+#include "../scenario/scenario.h"
+#include "../../client/messages/messages.h"
+#include "../../server/game-state/game_state.h"
+#include "../../server/messages/compact.h"
+#include "../../server/net/net.h"
+#include "../../server/send-pool/send_pool.h"
+#include "../../common/err.h"
+#include "../../common/zobrist.h"
+
+#include <arpa/inet.h>
+#include <filesystem>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CLIENT_MESSAGES 1024    // Messages parsed in one iteration.
+#define MAP_LOAD_ITERATIONS 50  // Every load maps the file until the process ends.
+#define MASS_EXPLOSIONS 10000   // Bombs exploding at once in mass_explosions.
+#define VIEW_RADIUS 3           // View radius of players in build_turn_for_client.
+#define STALLED_BYTES (4 << 20) // Bytes sent to client that does not read in send_past_stalled_reader.
+#define PLAYER_TURN_BYTES 64    // Bytes of Turn the player gets there.
+#define RECEIVE_TIMEOUT 1000    // Milliseconds client waits for the next part of its message.
+
+// Builds Turn 0 of [scenario] on board of type [Board], as done for every
+// game. [data.map] is used if it is loaded.
+template<class Board>
+static void bench_turn_0(Harness &harness, const std::string &name, const char *board_name,
+                         const Scenario &scenario, const ServerParameters &parameters, ServerData &data) {
+    harness.run(name, board_name, scenario.arguments(), 1,
+                [&]() {
+                    data.board<Board>().clear();
+                    data.player_positions.clear();
+                    data.state_hash = 0;
+                },
+                [&]() { return build_turn_0<Board>(parameters, data).size(); });
+}
+
+// Builds Turns of [scenario] on board of type [Board], players taking random
+// actions.
+template<class Board>
+static void bench_turn(Harness &harness, const char *board_name, const Scenario &scenario,
+                       const ServerParameters &parameters, ServerData &data) {
+    harness.run("build_turn", board_name, scenario.arguments(), 1,
+                [&]() {
+                    choose_actions(scenario, data);
+                    data.next_turn();
+                },
+                [&]() { return build_turn<Board>(parameters, data).size(); });
+}
+
+// Prepares the next turn on board of type [Board], in which [bombs] bombs
+// explode at once and nobody acts. Blocks destroyed in the previous turn are
+// placed again, so board does not get empty.
+template<class Board>
+static void prepare_explosions(const ServerParameters &parameters, ServerData &data, uint32_t bombs) {
+    Board &board = data.board<Board>();
+    for (const Position &position : data.all_blocks_destroyed) {
+        if (!board.contains_block(position)) {
+            board.place_block(position);
+            data.state_hash ^= zobrist_block_key(position);
+        }
+    }
+    data.next_turn();
+    data.clear_clients_last_messages();
+    for (uint32_t i = 0; i < bombs; i++) {
+        Position position((uint16_t) (data.random() % parameters.size_x),
+                          (uint16_t) (data.random() % parameters.size_y));
+        data.bombs[data.next_bomb_id] = Bomb(position, 1);
+        data.state_hash ^= zobrist_bomb_key(data.next_bomb_id, position);
+        data.next_bomb_id++;
+    }
+}
+
+// Builds Turns of [scenario] on board of type [Board], in which [scenario.bombs]
+// bombs explode at once and nobody acts.
+template<class Board>
+static void bench_explosions(Harness &harness, const char *board_name, const Scenario &scenario,
+                             const ServerParameters &parameters, ServerData &data) {
+    harness.run("explosions", board_name, scenario.arguments(), scenario.bombs,
+                [&]() { prepare_explosions<Board>(parameters, data, scenario.bombs); },
+                [&]() { return build_turn<Board>(parameters, data).size(); });
+}
+
+// Runs benchmarks of game logic of [scenario] on board of type [Board].
+template<class Board>
+static void bench_board(Harness &harness, const BenchParameters &bench_parameters, const char *board_name,
+                        const Scenario &scenario) {
+    if (!harness.selected("build_turn_0") && !harness.selected("build_turn") && !harness.selected("explosions")) {
+        return;
+    }
+
+    ServerParameters parameters = scenario_parameters(scenario, bench_parameters.seed);
+    std::unique_ptr<ServerData> data = scenario_data(parameters);
+    bench_turn_0<Board>(harness, "build_turn_0", board_name, scenario, parameters, *data);
+
+    data->board<Board>().clear();
+    data->player_positions.clear();
+    data->state_hash = 0;
+    build_turn_0<Board>(parameters, *data);
+    data->set_up_new_game();
+    bench_turn<Board>(harness, board_name, scenario, parameters, *data);
+    bench_explosions<Board>(harness, board_name, scenario, parameters, *data);
+}
+
+// Builds Turns in which MASS_EXPLOSIONS bombs explode at once on a big board,
+// resolved by the main thread alone and with [bench_parameters.threads] more
+// threads. Calls fatal() if the first Turns differ.
+static void bench_mass_explosions(Harness &harness, const BenchParameters &bench_parameters) {
+    if (!harness.selected("mass_explosions")) {
+        return;
+    }
+
+    Scenario scenario{2000, 2000, 25, MASS_EXPLOSIONS, 1000000};
+    ServerParameters parameters = scenario_parameters(scenario, bench_parameters.seed);
+    List<uint8_t> first_turns[2];
+    for (size_t threads : {(size_t) 0, (size_t) bench_parameters.threads}) {
+        std::unique_ptr<ServerData> data = scenario_data(parameters);
+        data->explosion_pool.start(threads);
+        build_turn_0<ChunkedBoard>(parameters, *data);
+        data->set_up_new_game();
+        prepare_explosions<ChunkedBoard>(parameters, *data, MASS_EXPLOSIONS);
+        first_turns[threads > 0] = build_turn<ChunkedBoard>(parameters, *data);
+
+        BenchArguments arguments = scenario.arguments();
+        arguments.emplace_back("threads", threads);
+        harness.run("mass_explosions", "ChunkedBoard", arguments, MASS_EXPLOSIONS,
+                    [&]() { prepare_explosions<ChunkedBoard>(parameters, *data, MASS_EXPLOSIONS); },
+                    [&]() { return build_turn<ChunkedBoard>(parameters, *data).size(); });
+    }
+
+    if (first_turns[0] != first_turns[1]) {
+        fatal("Explosions resolved in parallel differ from sequential ones.");
+    }
+}
+
+// Returns true if [state] is the state of game in [data].
+template<class Board>
+static bool same_state(const GameState<Board> &state, const ServerData &data) {
+    if (state.turn() != data.turn || state.hash() != data.state_hash || state.bombs().size() != data.bombs.size()) {
+        return false;
+    }
+    for (PlayerId id = 0; id < state.players_count(); id++) {
+        if (!(state.position(id) == data.player_positions.at(id)) || state.score(id) != data.scores.at(id)) {
+            return false;
+        }
+    }
+    auto bomb = data.bombs.begin();
+    for (const auto &[id, state_bomb] : state.bombs()) {
+        if (id != bomb->first || !(state_bomb.position == bomb->second.position)
+            || state_bomb.timer != bomb->second.timer) {
+            return false;
+        }
+        bomb++;
+    }
+    return true;
+}
+
+// Returns number of events in Turn [message].
+static uint32_t turn_events(const List<uint8_t> &message) {
+    return (uint32_t) message[3] << 24 | (uint32_t) message[4] << 16 | (uint32_t) message[5] << 8 | message[6];
+}
+
+// Plays SCENARIO_TURNS turns of [scenario] on board of type [Board] both with
+// build_turn() and GameState::step() and calls fatal() if they differ, or if
+// the state is not restored to Turn 0 afterwards. Then, in the middle of the
+// game, clones the state and plays one turn on the clone, and plays one turn
+// on the state and undoes it.
+template<class Board>
+static void bench_game_state(Harness &harness, const BenchParameters &bench_parameters, const char *board_name,
+                             const Scenario &scenario) {
+    if (!harness.selected("clone_step") && !harness.selected("step_restore")) {
+        return;
+    }
+
+    ServerParameters parameters = scenario_parameters(scenario, bench_parameters.seed);
+    std::unique_ptr<ServerData> data = scenario_data(parameters);
+    build_turn_0<Board>(parameters, *data);
+    data->set_up_new_game();
+
+    GameState<Board> state(parameters, *data);
+    uint64_t start_hash = state.hash();
+    typename GameState<Board>::Snapshot start = state.snapshot();
+    std::minstd_rand random(bench_parameters.seed);
+    for (uint16_t turn = 1; turn <= SCENARIO_TURNS; turn++) {
+        List<uint8_t> actions = random_actions(scenario, random);
+        for (PlayerId id = 0; id < scenario.players; id++) {
+            data->clients_last_messages[data->poll_ids[id]] = actions[id];
+        }
+        data->next_turn();
+        List<uint8_t> message = build_turn<Board>(parameters, *data);
+        if (state.step(actions) != turn_events(message) || !same_state(state, *data)) {
+            fatal("Game state differs from server's state in turn %d.", (int) turn);
+        }
+    }
+    state.restore(start);
+    if (state.turn() != 0 || state.hash() != start_hash || !state.bombs().empty()) {
+        fatal("Game state was not restored to Turn 0.");
+    }
+
+    GameState<Board> middle(parameters, *data);
+    List<uint8_t> actions;
+    harness.run("clone_step", board_name, scenario.arguments(), 1,
+                [&]() { actions = random_actions(scenario, random); },
+                [&]() {
+                    GameState<Board> clone = middle;
+                    clone.step(actions);
+                    return clone.memory_usage();
+                });
+    harness.run("step_restore", board_name, scenario.arguments(), 1,
+                [&]() { actions = random_actions(scenario, random); },
+                [&]() {
+                    typename GameState<Board>::Snapshot snapshot = middle.snapshot();
+                    middle.step(actions);
+                    middle.restore(snapshot);
+                    return (size_t) 0;
+                });
+}
+
+// Returns true if state of client [client] in view of player [player_id] is
+// the state of game in [data]: blocks and robots in view and all scores.
+template<class Board>
+static bool same_view(const ServerParameters &parameters, const ServerData &data, PlayerId player_id,
+                      const ClientData &client) {
+    const Position &center = data.player_positions.at(player_id);
+    uint16_t min_x = (uint16_t) std::max(center.x - VIEW_RADIUS, 0);
+    uint16_t min_y = (uint16_t) std::max(center.y - VIEW_RADIUS, 0);
+    uint16_t max_x = (uint16_t) std::min(center.x + VIEW_RADIUS, parameters.size_x - 1);
+    uint16_t max_y = (uint16_t) std::min(center.y + VIEW_RADIUS, parameters.size_y - 1);
+    auto in_view = [&](const Position &position) {
+        return min_x <= position.x && position.x <= max_x && min_y <= position.y && position.y <= max_y;
+    };
+
+    for (uint16_t x = min_x; x <= max_x; x++) {
+        for (uint16_t y = min_y; y <= max_y; y++) {
+            Position position(x, y);
+            if (data.board<Board>().contains_block(position) != client.blocks.contains(Position(htons(x), htons(y)))) {
+                return false;
+            }
+        }
+    }
+    for (const auto &[id, position] : data.player_positions) {
+        auto client_position = client.player_positions.find(id);
+        bool known = client_position != client.player_positions.end();
+        Position seen = known ? Position(ntohs(client_position->second.x), ntohs(client_position->second.y))
+                              : Position(0, 0);
+        if ((in_view(position) || (known && in_view(seen))) && !(known && seen == position)) {
+            return false;
+        }
+    }
+    return client.scores == data.scores;
+}
+
+// Plays SCENARIO_TURNS turns of [scenario] with view radius set and reads
+// Turns built for every player by its client, which negotiated view sync (every
+// other one also compact encoding). Clients of players 0 and 1 start over in
+// the middle, as after resuming. Calls fatal() if client's state in view
+// differs from server's one. Then builds Turns for all players.
+static void bench_view(Harness &harness, const BenchParameters &bench_parameters, const Scenario &scenario) {
+    if (!harness.selected("build_turn_for_client")) {
+        return;
+    }
+
+    ServerParameters parameters = scenario_parameters(scenario, bench_parameters.seed);
+    parameters.view_radius = VIEW_RADIUS;
+    std::unique_ptr<ServerData> data = scenario_data(parameters);
+    data->record_events = true;
+    List<ClientData> clients(scenario.players);
+    List<Map<PlayerId, Position>> compact_positions(scenario.players);
+    List<uint8_t> game_started = build_game_started(*data);
+    auto read_as_client = [&](PlayerId id, const List<uint8_t> &messages) {
+        clients[id].server_in = clients[id].compact_encoding
+                                ? encode_compact(messages, parameters.size_x, compact_positions[id])
+                                : messages;
+        read_messages_from_server(clients[id]);
+    };
+    for (PlayerId id = 0; id < scenario.players; id++) {
+        clients[id].init();
+        List<uint8_t> welcome = build_hello(parameters);
+        List<uint8_t> capabilities = build_capabilities(CAPABILITY_VIEW_SYNC | (id % 2 ? CAPABILITY_COMPACT : 0));
+        welcome.insert(welcome.end(), capabilities.begin(), capabilities.end());
+        read_as_client(id, welcome);
+        read_as_client(id, game_started);
+    }
+
+    auto send_turn = [&](const List<uint8_t> &message, bool initial, bool check) {
+        index_turn_events(*data);
+        for (PlayerId id = 0; id < scenario.players; id++) {
+            List<uint8_t> client_message = build_turn_for_client<ChunkedBoard>(parameters, *data, data->poll_ids[id],
+                                                                               message, initial);
+            if (!check) {
+                continue;
+            }
+            read_as_client(id, client_message);
+            if (!same_view<ChunkedBoard>(parameters, *data, id, clients[id])) {
+                fatal("Client of player %d differs from server in view in turn %d.", (int) id, (int) data->turn);
+            }
+        }
+    };
+
+    auto start_over = [&](PlayerId id) {
+        size_t poll_id = data->poll_ids[id];
+        data->has_view[poll_id] = false;
+        data->known_bombs[poll_id].clear();
+        data->known_positions[poll_id].clear();
+        data->stale_blocks[poll_id].clear();
+        compact_positions[id].clear();
+        read_as_client(id, game_started);
+    };
+
+    send_turn(build_turn_0<ChunkedBoard>(parameters, *data), true, true);
+    data->set_up_new_game();
+    for (uint16_t turn = 1; turn <= SCENARIO_TURNS; turn++) {
+        if (turn == SCENARIO_TURNS / 2) {
+            start_over(0);
+            start_over(1);
+        }
+        choose_actions(scenario, *data);
+        data->next_turn();
+        send_turn(build_turn<ChunkedBoard>(parameters, *data), false, true);
+    }
+
+    List<uint8_t> message;
+    harness.run("build_turn_for_client", "ChunkedBoard", scenario.arguments(), scenario.players,
+                [&]() {
+                    choose_actions(scenario, *data);
+                    data->next_turn();
+                    message = build_turn<ChunkedBoard>(parameters, *data);
+                },
+                [&]() {
+                    send_turn(message, false, false);
+                    return message.size();
+                });
+}
+
+// Loads map file with blocks of [scenario] and builds Turn 0 from it.
+static void bench_map_file(Harness &harness, const BenchParameters &bench_parameters, const Scenario &scenario) {
+    if (!harness.selected("load_map_file") && !harness.selected("build_turn_0_map")) {
+        return;
+    }
+
+    ServerParameters parameters = scenario_parameters(scenario, bench_parameters.seed);
+    ChunkedBoard board;
+    board.resize(scenario.size_x, scenario.size_y);
+    std::minstd_rand random(bench_parameters.seed);
+    List<Position> blocks;
+    blocks.reserve(scenario.blocks);
+    sample_positions(scenario.blocks, scenario.size_x, scenario.size_y, random,
+                     [&](const Position &position) { return board.contains_block(position); },
+                     [&](const Position &position) {
+                         board.place_block(position);
+                         blocks.push_back(position);
+                     });
+    std::string path = std::filesystem::temp_directory_path() / ("robots-bench-" + std::to_string(getpid()) + ".map");
+    save_map_file(path, scenario.size_x, scenario.size_y, blocks);
+
+    harness.run("load_map_file", "", scenario.arguments(), 1, []() {},
+                [&]() { return (size_t) load_map_file(path).blocks_count * 4; }, MAP_LOAD_ITERATIONS);
+
+    std::unique_ptr<ServerData> data = scenario_data(parameters);
+    data->map = load_map_file(path);
+    bench_turn_0<ChunkedBoard>(harness, "build_turn_0_map", "ChunkedBoard", scenario, parameters, *data);
+    std::filesystem::remove(path);
+}
+
+// Converts Turns of a game of [scenario] to compact encoding.
+static void bench_compact(Harness &harness, const BenchParameters &bench_parameters, const Scenario &scenario) {
+    if (!harness.selected("encode_compact")) {
+        return;
+    }
+
+    RecordedGame game = record_game<ChunkedBoard>(scenario, bench_parameters.seed, SCENARIO_TURNS);
+    List<uint8_t> start = game.game_started;
+    start.insert(start.end(), game.turn_0.begin(), game.turn_0.end());
+    Map<PlayerId, Position> start_positions;
+    encode_compact(start, scenario.size_x, start_positions);
+
+    Map<PlayerId, Position> positions;
+    harness.run("encode_compact", "", scenario.arguments(), SCENARIO_TURNS,
+                [&]() { positions = start_positions; },
+                [&]() { return encode_compact(game.turns, scenario.size_x, positions).size(); });
+}
+
+// Returns [count] messages client may send during game, the way clients send
+// them, in random order.
+static List<uint8_t> client_messages(size_t count, std::minstd_rand &random) {
+    List<uint8_t> messages;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t kind = random() % 20;
+        if (kind < 12) {
+            messages.insert(messages.end(), {MOVE, (uint8_t) (random() % 4)});
+        }
+        else if (kind < 15) {
+            messages.push_back(PLACE_BOMB);
+        }
+        else if (kind < 17) {
+            messages.push_back(PLACE_BLOCK);
+        }
+        else {
+            messages.insert(messages.end(), {TAGGED_ACTION, 0, (uint8_t) (i % 256), MOVE, (uint8_t) (random() % 4)});
+        }
+    }
+    return messages;
+}
+
+// Parses messages from clients, both the way server reads them one by one and
+// the way it drops them from flooding clients.
+static void bench_client_messages(Harness &harness, const BenchParameters &bench_parameters) {
+    std::minstd_rand random(bench_parameters.seed);
+    List<uint8_t> messages = client_messages(CLIENT_MESSAGES, random);
+    InputBuffer buffer;
+    BenchArguments arguments = {{"messages", CLIENT_MESSAGES}};
+
+    harness.run("parse_client_messages", "", arguments, CLIENT_MESSAGES,
+                [&]() { buffer.assign(messages.begin(), messages.end()); },
+                [&]() {
+                    uint16_t target_turn;
+                    while (!buffer.empty() && !client_sent_incorrect_message(buffer)) {
+                        if (client_sent_tagged_action(buffer)) {
+                            read_tagged_action(buffer, target_turn);
+                        }
+                        else if (client_sent_place_bomb(buffer)) {
+                            read_place_bomb(buffer);
+                        }
+                        else if (client_sent_place_block(buffer)) {
+                            read_place_block(buffer);
+                        }
+                        else if (client_sent_move(buffer)) {
+                            read_move(buffer);
+                        }
+                        else {
+                            break;
+                        }
+                    }
+                    return messages.size();
+                });
+
+    harness.run("skip_client_messages", "", arguments, CLIENT_MESSAGES,
+                [&]() { buffer.assign(messages.begin(), messages.end()); },
+                [&]() {
+                    uint8_t last_action = NO_MSG;
+                    size_t skipped;
+                    skip_complete_messages(buffer, true, last_action, skipped);
+                    return messages.size();
+                });
+}
+
+// Connects pair of sockets, [server_fd] is non-blocking as server's sockets.
+static void connect_sockets(int &server_fd, int &client_fd) {
+    int fds[2];
+    CHECK_ERRNO(socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    make_non_blocking(fds[0]);
+    server_fd = fds[0];
+    client_fd = fds[1];
+}
+
+// Reads [length] bytes from socket [fd]. Returns false if they did not come
+// in time.
+static bool receive_bytes(int fd, size_t length) {
+    static uint8_t buffer[65536];
+
+    while (length > 0) {
+        pollfd descriptor{fd, POLLIN, 0};
+        if (poll(&descriptor, 1, RECEIVE_TIMEOUT) != 1) {
+            return false;
+        }
+        ssize_t read_length = read(fd, buffer, std::min(length, sizeof(buffer)));
+        if (read_length <= 0) {
+            return false;
+        }
+        length -= (size_t) read_length;
+    }
+    return true;
+}
+
+// Sends Turns to a player through a send thread shared with a client that
+// does not read. Calls fatal() if the player does not get them, if messages
+// to the stalled client are not kept for it, or if client that takes its poll
+// id inherits its unsent bytes.
+static void bench_stalled_reader(Harness &harness) {
+    if (!harness.selected("send_past_stalled_reader")) {
+        return;
+    }
+
+    SendPool pool;
+    pool.start(1, 2, 0);
+    int stalled_fd, stalled_peer, player_fd, player_peer;
+    connect_sockets(stalled_fd, stalled_peer);
+    connect_sockets(player_fd, player_peer);
+    auto stalled_message = std::make_shared<const List<uint8_t>>(STALLED_BYTES, 0);
+    auto turn = std::make_shared<const List<uint8_t>>(PLAYER_TURN_BYTES, 0);
+    pool.send(1, stalled_fd, stalled_message, false);
+    pool.send(2, player_fd, turn, false);
+    if (!receive_bytes(player_peer, turn->size())) {
+        fatal("Client that does not read held up the player.");
+    }
+    if (pool.failed(1) || pool.queued_bytes(1) == 0) {
+        fatal("Messages to client that does not read were dropped instead of waiting.");
+    }
+
+    harness.run("send_past_stalled_reader", "", {{"stalled_bytes", STALLED_BYTES}}, 1, []() {},
+                [&]() {
+                    pool.send(2, player_fd, turn, false);
+                    receive_bytes(player_peer, turn->size());
+                    return turn->size();
+                });
+
+    pool.close_client(1, stalled_fd);
+    close(stalled_peer);
+    int next_fd, next_peer;
+    connect_sockets(next_fd, next_peer);
+    pool.send(1, next_fd, turn, false);
+    if (pool.queued_bytes(1) > turn->size() || !receive_bytes(next_peer, turn->size())) {
+        fatal("Client that took poll id of the stalled one inherited its messages.");
+    }
+    pool.close_client(1, next_fd);
+    pool.close_client(2, player_fd);
+    close(next_peer);
+    close(player_peer);
+}
+
+void run_server_benchmarks(Harness &harness, const BenchParameters &parameters) {
+    for (const Scenario &scenario : default_scenarios()) {
+        bench_board<GenericBoard>(harness, parameters, "GenericBoard", scenario);
+        if (SmallBoard::fits(scenario.size_x, scenario.size_y)) {
+            bench_board<SmallBoard>(harness, parameters, "SmallBoard", scenario);
+        }
+        bench_board<ChunkedBoard>(harness, parameters, "ChunkedBoard", scenario);
+        bench_game_state<GenericBoard>(harness, parameters, "GenericBoard", scenario);
+        if (SmallBoard::fits(scenario.size_x, scenario.size_y)) {
+            bench_game_state<SmallBoard>(harness, parameters, "SmallBoard", scenario);
+        }
+        bench_game_state<ChunkedBoard>(harness, parameters, "ChunkedBoard", scenario);
+        bench_view(harness, parameters, scenario);
+        bench_map_file(harness, parameters, scenario);
+        bench_compact(harness, parameters, scenario);
+    }
+    bench_mass_explosions(harness, parameters);
+    bench_client_messages(harness, parameters);
+    bench_stalled_reader(harness);
+}
@@ -0,0 +1,11 @@
+#ifndef SERVER_BENCHMARKS_H
+#define SERVER_BENCHMARKS_H
+
+#include "../harness/harness.h"
+
+// Runs benchmarks of building Turns (on every board type that fits the
+// scenario), explosions, map files, compact encoding and parsing messages
+// from clients.
+void run_server_benchmarks(Harness &harness, const BenchParameters &parameters);
+
+#endif // SERVER_BENCHMARKS_H
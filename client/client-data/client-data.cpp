@@ -1,21 +1,57 @@
 #include "client_data.h"
-#include "../../common/err.h"
+#include "../messages/messages.h"
 
 void ClientData::init() {
-    ENSURE(pthread_mutex_init(&lock, nullptr) == 0);
     is_in_lobby = true;
+    state_hash = 0;
+    received_hello = false;
+    in_turn = false;
+    turn_events_left = 0;
+    compact_encoding = false;
+    view_sync = false;
+    session_token = 0;
+    resuming = false;
+    has_turn_0 = false;
+    skipping_turn = false;
+    datagram_fd = -1;
+    datagram_token = 0;
+    datagram_port = 0;
+    next_action_sequence = 1;
+    datagram_outdated = false;
+    server_blocked = false;
+    immediate_input = false;
+    sent_action = GUI_NO_MSG;
+    pending_action = GUI_NO_MSG;
+    turn_time = LatencyClock::time_point();
+    turn_interval = LatencyClock::duration(0);
+    gui_outdated = false;
+    gui_blocked = false;
+    next_gui_send_time = std::chrono::steady_clock::now();
+    has_own_player = false;
+    own_player_id = 0;
+    latency_report_interval = std::chrono::seconds(0);
+    next_latency_report = LatencyClock::now();
 }
 
 void ClientData::clear() {
-    ENSURE(pthread_mutex_lock(&lock) == 0);
     is_in_lobby = true;
-    ENSURE(pthread_mutex_unlock(&lock) == 0);
+    sent_action = GUI_NO_MSG;
+    pending_action = GUI_NO_MSG;
+    has_own_player = false;
+    latency.clear();
 
     players.clear();
+    clear_game();
+}
+
+void ClientData::clear_game() {
+    has_turn_0 = false;
     player_positions.clear();
     blocks.clear();
     bombs.clear();
     explosions.clear();
     scores.clear();
     died_this_round.clear();
+    blocks_destroyed_this_round.clear();
+    state_hash = 0;
 }
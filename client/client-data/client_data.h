@@ -1,9 +1,10 @@
 #ifndef CLIENT_DATA_H
 #define CLIENT_DATA_H
 
-#include <pthread.h>
+#include <chrono>
 
 #include "../../common/types.h"
+#include "../latency/latency.h"
 
 // Structure containing the data required by client.
 struct ClientData {
@@ -26,20 +27,61 @@ struct ClientData {
     Map<PlayerId, Score> scores;
     Set<PlayerId> died_this_round;
     Set<Position> blocks_destroyed_this_round;
+    uint64_t state_hash;  // Zobrist hash of positions, blocks, bombs and scores.
 
     // Socket descriptors.
     int server_fd;
     int gui_rec_fd;
     int gui_send_fd;
 
-    // Mutex protecting is_in_lobby.
-    pthread_mutex_t lock;
+    // Communication with server.
+    List<uint8_t> server_in;     // Received bytes that are not processed yet.
+    List<uint8_t> server_out;    // Bytes waiting to be sent.
+    bool server_blocked;         // True if server socket is watched for writing.
+    bool immediate_input;        // Send first action in each turn immediately.
+    uint8_t sent_action;         // The last action sent since the last Turn, GUI_NO_MSG if none.
+    uint8_t pending_action;      // Action to send halfway through the turn, GUI_NO_MSG if none.
+    LatencyClock::time_point pending_action_time; // When player took pending action.
+    LatencyClock::time_point turn_time;           // When the last Turn arrived.
+    LatencyClock::duration turn_interval;         // Estimated time between Turns, 0 if not known yet.
+    bool received_hello;
+    bool in_turn;                // True if Turn message is received partially.
+    uint32_t turn_events_left;   // Events of partially received Turn message.
+    bool compact_encoding;       // True if server accepted compact encoding.
+    bool view_sync;              // True if server accepted view sync, Turns may contain Destroyed.
+    uint64_t session_token;      // Token of player's session, 0 if there is none.
+    bool resuming;               // True if Resume was sent and server did not answer yet.
+    bool has_turn_0;             // True if Turn 0 of the current game was received.
+    bool skipping_turn;          // True if partially received Turn was received before.
+
+    // Datagram transport, see common/compact.h.
+    int datagram_fd;             // UDP socket, -1 if it is not open.
+    uint64_t datagram_token;     // 0 if server did not accept datagrams.
+    uint16_t datagram_port;      // Server's UDP port.
+    uint16_t next_action_sequence;
+    Deque<std::pair<uint16_t, uint8_t>> datagram_actions; // Latest actions with their sequence numbers.
+    bool datagram_outdated;      // True if server has not been sent the latest actions and turn.
+
+    // Communication with GUI.
+    bool gui_outdated;           // True if GUI has not been sent the current state.
+    bool gui_blocked;            // True if GUI socket is watched for writing.
+    std::chrono::steady_clock::time_point next_gui_send_time;
+
+    // Latency of player's actions, see client/latency/latency.h.
+    LatencyTracker latency;
+    PlayerId own_player_id;
+    bool has_own_player;         // False if robot of the player is not known.
+    std::chrono::seconds latency_report_interval; // 0 if latency is not reported.
+    LatencyClock::time_point next_latency_report;
 
     // Initiates new ClientData instance.
     void init();
 
     // Clears ClientData instance after finished game.
     void clear();
+
+    // Clears state of the game: board, robots, bombs and scores.
+    void clear_game();
 };
 
 #endif // CLIENT_DATA_H
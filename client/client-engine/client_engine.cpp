@@ -0,0 +1,306 @@
+#include "client_engine.h"
+#include "../messages/messages.h"
+#include "../net/net.h"
+#include "../../common/err.h"
+#include "../../common/compact.h"
+#include "../../common/trace.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 4
+#define SERVER_READ_LIMIT 65536 // Max number of bytes read from server at once.
+#define RECONNECT_ATTEMPTS 20   // Attempts to reconnect when session can be resumed.
+#define RECONNECT_INTERVAL 100  // Milliseconds between attempts to reconnect.
+
+// Tries to connect to server given in [parameters]. Returns socket's
+// descriptor or -1 if connection failed.
+static int try_connecting_to_server(const ClientParameters &parameters) {
+    if (!parameters.server_socket.empty()) {
+        return connect_local(parameters.server_socket);
+    }
+
+    return connect(parameters.server_address, parameters.server_port, true);
+}
+
+int connect_to_server(const ClientParameters &parameters) {
+    int server_fd = try_connecting_to_server(parameters);
+    if (server_fd == -1 && !parameters.server_socket.empty()) {
+        fatal("Could not connect to server. Socket %s may be incorrect.", parameters.server_socket.c_str());
+    }
+    if (server_fd == -1) {
+        fatal("Could not connect to server. Address %s:%d may be incorrect.",
+              parameters.server_address.c_str(), parameters.server_port);
+    }
+    return server_fd;
+}
+
+void introduce_to_server(ClientData &data, const ClientParameters &parameters) {
+    uint8_t flags = (parameters.compact_encoding ? CAPABILITY_COMPACT : 0)
+                    | (parameters.session_resume ? CAPABILITY_RESUME : 0)
+                    | (parameters.datagrams && parameters.server_socket.empty() ? CAPABILITY_DATAGRAMS : 0)
+                    | (parameters.view_sync ? CAPABILITY_VIEW_SYNC : 0);
+    if (flags != 0) {
+        send_capabilities(data, flags);
+    }
+    if (parameters.session_resume) {
+        send_resume(data);
+    }
+}
+
+// Sets events watched on socket [socket_fd] by [epoll_fd] to [events].
+static void watch(int epoll_fd, int socket_fd, uint32_t events, bool add) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = socket_fd;
+    CHECK_ERRNO(epoll_ctl(epoll_fd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, socket_fd, &event));
+}
+
+// Creates epoll instance watching sockets in [data] and makes them non-blocking.
+static int set_up_epoll(const ClientData &data) {
+    int epoll_fd = epoll_create1(0);
+    ENSURE(epoll_fd != -1);
+
+    set_non_blocking(data.server_fd);
+    set_non_blocking(data.gui_rec_fd);
+    set_non_blocking(data.gui_send_fd);
+    watch(epoll_fd, data.server_fd, EPOLLIN, true);
+    watch(epoll_fd, data.gui_rec_fd, EPOLLIN, true);
+    watch(epoll_fd, data.gui_send_fd, 0, true);
+
+    return epoll_fd;
+}
+
+// Opens UDP socket to server and watches it with [epoll_fd], if server
+// accepted datagrams and socket is not open yet.
+static void open_datagram_socket(int epoll_fd, ClientData &data) {
+    if (data.datagram_token == 0 || data.datagram_fd != -1) {
+        return;
+    }
+
+    data.datagram_fd = connect_datagram_socket(data.server_fd, data.datagram_port);
+    if (data.datagram_fd == -1) {
+        fatal("Could not open UDP socket to server.");
+    }
+    watch(epoll_fd, data.datagram_fd, EPOLLIN, true);
+}
+
+// Closes UDP socket to server and forgets datagram session, as the new
+// connection gets a new one.
+static void close_datagram_socket(ClientData &data) {
+    if (data.datagram_fd != -1) {
+        close(data.datagram_fd);
+    }
+    data.datagram_fd = -1;
+    data.datagram_token = 0;
+    data.datagram_actions.clear();
+    data.next_action_sequence = 1;
+    data.datagram_outdated = false;
+}
+
+// Connects to server again after connection dropped and asks it to resume
+// player's session. If the last Turn was received partially, state is cleared
+// and the whole game is received again. Calls fatal() if server is unreachable.
+static void reconnect_to_server(int epoll_fd, ClientData &data, const ClientParameters &parameters) {
+    close(data.server_fd);
+    data.server_fd = -1;
+    for (int i = 0; i < RECONNECT_ATTEMPTS && data.server_fd == -1; i++) {
+        usleep(RECONNECT_INTERVAL * 1000);
+        data.server_fd = try_connecting_to_server(parameters);
+    }
+    if (data.server_fd == -1) {
+        fatal("Connection with server failed.");
+    }
+    set_non_blocking(data.server_fd);
+    watch(epoll_fd, data.server_fd, EPOLLIN, true);
+
+    data.server_in.clear();
+    data.server_out.clear();
+    data.server_blocked = false;
+    data.received_hello = false;
+    data.compact_encoding = false;
+    data.view_sync = false;
+    if (data.in_turn && !data.skipping_turn) {
+        data.clear();
+    }
+    data.in_turn = false;
+    data.turn_events_left = 0;
+    data.skipping_turn = false;
+    close_datagram_socket(data);
+    data.resuming = true;
+    introduce_to_server(data, parameters);
+}
+
+// Reads all bytes available from server and processes complete messages.
+// Reconnects if connection dropped and session can be resumed.
+static void read_from_server(int epoll_fd, ClientData &data, const ClientParameters &parameters) {
+    static uint8_t buffer[SERVER_READ_LIMIT];
+
+    while (true) {
+        ssize_t read_length = receive_available(data.server_fd, buffer, SERVER_READ_LIMIT);
+        if (read_length < 0) {
+            break;
+        }
+        if (read_length == 0) {
+            if (!parameters.session_resume || data.session_token == 0) {
+                fatal("Connection with server failed.");
+            }
+            data.gui_outdated |= read_messages_from_server(data);
+            reconnect_to_server(epoll_fd, data, parameters);
+            return;
+        }
+        data.server_in.insert(data.server_in.end(), buffer, buffer + read_length);
+    }
+
+    data.gui_outdated |= read_messages_from_server(data);
+}
+
+// Reads all datagrams available from server and processes Turns in them.
+static void read_datagrams(ClientData &data) {
+    static List<uint8_t> datagram(MAX_DATAGRAM);
+
+    datagram.resize(MAX_DATAGRAM);
+    ssize_t length;
+    while ((length = receive_datagram(data.datagram_fd, datagram.data(), MAX_DATAGRAM)) >= 0) {
+        datagram.resize((size_t) length);
+        data.gui_outdated |= read_datagram_from_server(data, datagram);
+        datagram.resize(MAX_DATAGRAM);
+    }
+}
+
+// Sends datagram with the latest actions and turn to server if they changed
+// since the last one.
+static void write_datagram(ClientData &data) {
+    static List<uint8_t> datagram;
+
+    if (!data.datagram_outdated || data.datagram_fd == -1) {
+        return;
+    }
+    build_datagram_to_server(data, datagram);
+    send_datagram(data.datagram_fd, datagram.data(), datagram.size());
+    data.datagram_outdated = false;
+}
+
+// Reads all messages available from GUI and puts corresponding messages for
+// server into [data.server_out].
+static void read_from_gui(ClientData &data) {
+    uint8_t message_type;
+    while ((message_type = read_message_from_gui(data)) != GUI_NO_MSG) {
+        send_message_to_server(data, message_type);
+    }
+}
+
+// Sends as much of [data.server_out] as possible. Server socket is watched for
+// writing only if some bytes are still waiting.
+static void write_to_server(int epoll_fd, ClientData &data) {
+    if (data.server_out.empty() && !data.server_blocked) {
+        return;
+    }
+
+    ssize_t sent_length = send_available(data.server_fd, data.server_out.data(), data.server_out.size());
+    if (sent_length > 0) {
+        data.server_out.erase(data.server_out.begin(), data.server_out.begin() + sent_length);
+    }
+
+    bool blocked = !data.server_out.empty();
+    if (blocked != data.server_blocked) {
+        watch(epoll_fd, data.server_fd, blocked ? EPOLLIN | EPOLLOUT : EPOLLIN, false);
+        data.server_blocked = blocked;
+    }
+}
+
+// Sends current state to GUI if it is outdated and GUI rate allows it. If GUI
+// socket is not ready, it is watched for writing. Nothing is sent while Turn
+// is applied partially, the frame waits until the whole Turn is applied.
+static void write_to_gui(int epoll_fd, ClientData &data, std::chrono::nanoseconds min_interval) {
+    static GuiFrame frame;
+
+    auto now = std::chrono::steady_clock::now();
+    if (!data.gui_outdated || data.gui_blocked || data.in_turn || now < data.next_gui_send_time) {
+        return;
+    }
+
+    build_message_to_gui(data, frame);
+    if (send_frame_to_gui(data.gui_send_fd, frame)) {
+        data.latency.frame_sent();
+        data.gui_outdated = false;
+        data.next_gui_send_time = now + min_interval;
+    }
+    else {
+        watch(epoll_fd, data.gui_send_fd, EPOLLOUT, false);
+        data.gui_blocked = true;
+    }
+}
+
+// Prints latency of player's actions if it is time for the next report.
+static void report_latency(ClientData &data) {
+    auto now = LatencyClock::now();
+    if (data.latency_report_interval.count() == 0 || now < data.next_latency_report) {
+        return;
+    }
+
+    data.latency.report(stderr);
+    data.next_latency_report = now + data.latency_report_interval;
+}
+
+// Returns time in milliseconds that event loop can wait for events. Returns -1
+// if it can wait without limit.
+static int wait_timeout(const ClientData &data) {
+    auto deadline = LatencyClock::time_point::max();
+    if (data.gui_outdated && !data.gui_blocked && !data.in_turn) {
+        deadline = data.next_gui_send_time;
+    }
+    if (data.pending_action != GUI_NO_MSG) {
+        deadline = std::min(deadline, pending_action_deadline(data));
+    }
+    if (deadline == LatencyClock::time_point::max()) {
+        return -1;
+    }
+
+    auto now = LatencyClock::now();
+    if (now >= deadline) {
+        return 0;
+    }
+    auto millis = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+    return (int) millis.count();
+}
+
+[[noreturn]] void run(ClientData &data, const ClientParameters &parameters) {
+    auto min_interval = parameters.gui_rate == 0
+                        ? std::chrono::nanoseconds(0)
+                        : std::chrono::nanoseconds(std::chrono::seconds(1)) / parameters.gui_rate;
+    int epoll_fd = set_up_epoll(data);
+    epoll_event events[MAX_EVENTS];
+
+    write_to_server(epoll_fd, data);
+    while (true) {
+        int events_count = epoll_wait(epoll_fd, events, MAX_EVENTS, wait_timeout(data));
+        if (events_count == -1) {
+            continue; // Interrupted, we try again.
+        }
+
+        for (int i = 0; i < events_count; i++) {
+            if (events[i].data.fd == data.server_fd && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                read_from_server(epoll_fd, data, parameters);
+            }
+            else if (events[i].data.fd == data.datagram_fd && data.datagram_fd != -1) {
+                read_datagrams(data);
+            }
+            else if (events[i].data.fd == data.gui_rec_fd) {
+                read_from_gui(data);
+            }
+            else if (events[i].data.fd == data.gui_send_fd) {
+                watch(epoll_fd, data.gui_send_fd, 0, false);
+                data.gui_blocked = false;
+            }
+        }
+
+        open_datagram_socket(epoll_fd, data);
+        send_pending_action(data);
+        write_to_server(epoll_fd, data);
+        write_datagram(data);
+        write_to_gui(epoll_fd, data, min_interval);
+        report_latency(data);
+        TRACE_POLL();
+    }
+}
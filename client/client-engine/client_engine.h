@@ -0,0 +1,21 @@
+#ifndef CLIENT_ENGINE_H
+#define CLIENT_ENGINE_H
+
+#include "../client-data/client_data.h"
+#include "../client-parameters/client_parameters.h"
+
+// Connects to server given in [parameters] and returns socket's descriptor.
+// Calls fatal() if connection failed.
+int connect_to_server(const ClientParameters &parameters);
+
+// Puts messages client sends right after connecting to server (Capabilities
+// and Resume, if any extensions are requested) into [data.server_out].
+void introduce_to_server(ClientData &data, const ClientParameters &parameters);
+
+// Runs client's event loop in the calling thread. Sockets in [data] must be
+// connected. Reads from GUI and server as soon as data arrives and sends
+// state to GUI at most [parameters.gui_rate] times per second (without limit
+// if it is 0).
+[[noreturn]] void run(ClientData &data, const ClientParameters &parameters);
+
+#endif // CLIENT_ENGINE_H
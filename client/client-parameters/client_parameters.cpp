@@ -5,7 +5,7 @@
 #include <iostream>
 #include <arpa/inet.h>
 
-#define MAX_PORT 65535
+#define MAX_UINT16 65535
 #define MAX_STRING_LEN 256
 
 // Returns true if "-h" parameter appeared.
@@ -23,23 +23,38 @@ static void print_help() {
     std::cout << "USAGE:\n"
               << "    ./robots-client"
               << " -d <gui_address:gui_port> -n <player_name>"
-              << " -p <port> -s <server_address:server_port>"
+              << " -p <port> (-s <server_address:server_port> | -u <server_socket>)"
+              << " [-a <datagrams>] [-i <immediate_input>] [-l <latency_report>] [-r <gui_rate>] [-t <session_resume>] [-v <view_sync>] [-w <compact_encoding>]"
               << "\n\nOPTIONS\n"
+              << "    -a <datagrams> (optional, 0 or 1, get turns and send actions in UDP datagrams,"
+              << " server has to support it, ignored with -u)\n"
               << "    -d <gui_address:gui_port>\n"
               << "    -h <help>\n"
+              << "    -i <immediate_input> (optional, 0 or 1, send first action in each turn immediately)\n"
+              << "    -l <latency_report> (optional, print latency of player's actions every given number"
+              << " of seconds)\n"
               << "    -n <player_name>\n"
               << "    -p <port>\n"
-              << "    -s <server_address:server_port>\n";
+              << "    -r <gui_rate> (optional, max messages per second sent to GUI)\n"
+              << "    -s <server_address:server_port>\n"
+              << "    -t <session_resume> (optional, 0 or 1, reconnect and resume the game if connection"
+              << " with server drops, server has to support it)\n"
+              << "    -u <server_socket> (path of server's local socket, if server and client"
+              << " run on the same machine)\n"
+              << "    -v <view_sync> (optional, 0 or 1, get only events around player's robot if server"
+              << " has view radius set, server has to support it)\n"
+              << "    -w <compact_encoding> (optional, 0 or 1, ask server for compact encoding,"
+              << " server has to support it)\n";
 }
 
-// Checks if port represented by [port_str] is correct.
-static bool check_port(const char *port_str) {
+// Checks if 16-bit number (e.g. port) represented by [str] is correct.
+static bool check_uint16(const char *str) {
     errno = 0;
 
     char *end_ptr;
-    auto value = (uint32_t) strtoul(port_str, &end_ptr, 10);
+    auto value = (uint32_t) strtoul(str, &end_ptr, 10);
 
-    return *end_ptr == '\0' && errno == 0 && value <= MAX_PORT;
+    return *end_ptr == '\0' && errno == 0 && value <= MAX_UINT16;
 }
 
 // Reads ip address in (address):(port) format. Returns false if address
@@ -57,7 +72,7 @@ static bool read_address(const std::string &address_and_port, std::string &addre
     }
 
     std::string port_str = address_and_port.substr(divider + 1);
-    if (!check_port(port_str.c_str())) {
+    if (!check_uint16(port_str.c_str())) {
         return false;
     }
     port = (uint16_t) strtol(port_str.c_str(), nullptr, 10);
@@ -68,11 +83,41 @@ static bool read_address(const std::string &address_and_port, std::string &addre
 // Processes a single parameter [option] with value [value]. Changes
 // [parameters] reference.
 static void read_parameter(ClientParameters &parameters, const char *option, const char *value) {
-    if (strcmp(option, "-d") == 0) {
+    if (strcmp(option, "-a") == 0) {
+        if (parameters.read_datagrams) {
+            return;
+        }
+        if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+            fatal("Incorrect datagrams %s, available values: 0, 1.", value);
+        }
+        parameters.datagrams = strcmp(value, "1") == 0;
+        parameters.read_datagrams = true;
+    }
+    else if (strcmp(option, "-d") == 0) {
         if (parameters.gui_address.empty() && !read_address(value, parameters.gui_address, parameters.gui_port)) {
             fatal("Incorrect gui address %s.", value);
         }
     }
+    else if (strcmp(option, "-i") == 0) {
+        if (parameters.read_immediate_input) {
+            return;
+        }
+        if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+            fatal("Incorrect immediate input %s, available values: 0, 1.", value);
+        }
+        parameters.immediate_input = strcmp(value, "1") == 0;
+        parameters.read_immediate_input = true;
+    }
+    else if (strcmp(option, "-l") == 0) {
+        if (parameters.read_latency_report) {
+            return;
+        }
+        if (!check_uint16(value)) {
+            fatal("Incorrect latency report %s, available values: 0-65535.", value);
+        }
+        parameters.latency_report = (uint16_t) strtol(value, nullptr, 10);
+        parameters.read_latency_report = true;
+    }
     else if (strcmp(option, "-n") == 0) {
         if (!parameters.player_name.empty()) {
             return;
@@ -83,18 +128,66 @@ static void read_parameter(ClientParameters &parameters, const char *option, con
         }
     }
     else if (strcmp(option, "-p") == 0) {
-        if (!parameters.read_port && !check_port(value)) {
+        if (!parameters.read_port && !check_uint16(value)) {
             fatal("Incorrect port %s, available values: 0-65535.", value);
         }
         parameters.port = (uint16_t) strtol(value, nullptr, 10);
         parameters.read_port = true;
     }
+    else if (strcmp(option, "-r") == 0) {
+        if (parameters.read_gui_rate) {
+            return;
+        }
+        if (!check_uint16(value)) {
+            fatal("Incorrect gui rate %s, available values: 0-65535.", value);
+        }
+        parameters.gui_rate = (uint16_t) strtol(value, nullptr, 10);
+        parameters.read_gui_rate = true;
+    }
     else if (strcmp(option, "-s") == 0) {
         if (parameters.server_address.empty() && !read_address(std::string(value),
                 parameters.server_address, parameters.server_port)) {
             fatal("Incorrect server address %s.", value);
         }
     }
+    else if (strcmp(option, "-t") == 0) {
+        if (parameters.read_session_resume) {
+            return;
+        }
+        if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+            fatal("Incorrect session resume %s, available values: 0, 1.", value);
+        }
+        parameters.session_resume = strcmp(value, "1") == 0;
+        parameters.read_session_resume = true;
+    }
+    else if (strcmp(option, "-u") == 0) {
+        if (parameters.server_socket.empty()) {
+            parameters.server_socket = std::string(value);
+            if (parameters.server_socket.empty()) {
+                fatal("Server socket path cannot be empty.");
+            }
+        }
+    }
+    else if (strcmp(option, "-v") == 0) {
+        if (parameters.read_view_sync) {
+            return;
+        }
+        if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+            fatal("Incorrect view sync %s, available values: 0, 1.", value);
+        }
+        parameters.view_sync = strcmp(value, "1") == 0;
+        parameters.read_view_sync = true;
+    }
+    else if (strcmp(option, "-w") == 0) {
+        if (parameters.read_compact_encoding) {
+            return;
+        }
+        if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) {
+            fatal("Incorrect compact encoding %s, available values: 0, 1.", value);
+        }
+        parameters.compact_encoding = strcmp(value, "1") == 0;
+        parameters.read_compact_encoding = true;
+    }
     else {
         fatal("Incorrect parameter %s.", option);
     }
@@ -111,8 +204,8 @@ static void ensure_every_parameter_read(const ClientParameters &parameters) {
     if (!parameters.read_port) {
         fatal("-p parameter is necessary.");
     }
-    if (parameters.server_address.empty()) {
-        fatal("-s parameter is necessary.");
+    if (parameters.server_address.empty() && parameters.server_socket.empty()) {
+        fatal("-s or -u parameter is necessary.");
     }
 }
 
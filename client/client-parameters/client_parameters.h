@@ -16,6 +16,21 @@ struct ClientParameters {
     bool read_port = false;
     std::string server_address;
     uint16_t server_port;
+    std::string server_socket; // Path of server's local socket, used instead of server_address.
+    uint16_t gui_rate = 0; // Max number of messages sent to GUI per second, 0 means no limit.
+    bool read_gui_rate = false;
+    uint16_t latency_report = 0; // Seconds between reports of actions' latency, 0 means no reports.
+    bool read_latency_report = false;
+    bool immediate_input = false; // Send first action in each turn immediately.
+    bool read_immediate_input = false;
+    bool compact_encoding = false; // Ask server for compact encoding.
+    bool read_compact_encoding = false;
+    bool datagrams = false; // Ask server for datagram transport.
+    bool read_datagrams = false;
+    bool session_resume = false; // Ask server for session token and reconnect if connection drops.
+    bool read_session_resume = false;
+    bool view_sync = false; // Ask server for only events around player's robot.
+    bool read_view_sync = false;
 };
 
 // Processes command line parameters and returns ClientParameters instance.
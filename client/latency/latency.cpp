@@ -0,0 +1,151 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <bit>
+
+// Returns index of bucket containing [micros].
+static size_t bucket_index(uint64_t micros) {
+    if (micros < LATENCY_SUB_BUCKETS) {
+        return micros;
+    }
+    auto exponent = (size_t) std::bit_width(micros) - 1; // At least 4.
+    size_t sub_bucket = (micros >> (exponent - 4)) & (LATENCY_SUB_BUCKETS - 1);
+    return (exponent - 3) * LATENCY_SUB_BUCKETS + sub_bucket;
+}
+
+// Returns the smallest value in bucket [index].
+static uint64_t bucket_start(size_t index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return index;
+    }
+    size_t exponent = index / LATENCY_SUB_BUCKETS + 3;
+    uint64_t sub_bucket = index % LATENCY_SUB_BUCKETS;
+    return (LATENCY_SUB_BUCKETS + sub_bucket) << (exponent - 4);
+}
+
+void LatencyHistogram::add(uint64_t micros) {
+    buckets[bucket_index(micros)]++;
+    samples++;
+    max_micros = std::max(max_micros, micros);
+}
+
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    auto needed = (uint64_t) (fraction * (double) samples);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > needed) {
+            return bucket_start(i);
+        }
+    }
+    return max_micros;
+}
+
+void LatencyHistogram::clear() {
+    std::fill(buckets, buckets + LATENCY_BUCKETS, 0);
+    samples = 0;
+    max_micros = 0;
+}
+
+// Returns OWN_* flag of event caused by action of type [message_type].
+static uint8_t own_event_of(uint8_t message_type) {
+    switch (message_type) {
+        case 0:
+            return OWN_BOMB_PLACED;
+        case 1:
+            return OWN_BLOCK_PLACED;
+        default:
+            return OWN_PLAYER_MOVED;
+    }
+}
+
+// Returns microseconds from [start] to [end].
+static uint64_t micros_between(LatencyClock::time_point start, LatencyClock::time_point end) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+void LatencyTracker::action_sent(uint8_t message_type, uint16_t turn, LatencyClock::time_point input_time) {
+    sent.push_back({message_type, turn, input_time, LatencyClock::now(), {}});
+}
+
+void LatencyTracker::turn_finished(uint16_t turn) {
+    uint8_t events = turn_events;
+    turn_events = 0;
+    auto now = LatencyClock::now();
+
+    // Server takes actions in order and only the last one in a turn, so event
+    // was caused by the latest action of its kind sent before the Turn.
+    size_t matched_before = 0; // Actions before it can not take effect anymore.
+    for (size_t i = sent.size(); i > 0; i--) {
+        TrackedAction &action = sent[i - 1];
+        uint8_t event = own_event_of(action.message_type);
+        if (action.sent_turn < turn && (events & event)) {
+            events &= (uint8_t) ~event;
+            action.received_time = now;
+            matched_before = std::max(matched_before, i - 1);
+        }
+    }
+
+    Deque<TrackedAction> waiting;
+    for (size_t i = 0; i < sent.size(); i++) {
+        const TrackedAction &action = sent[i];
+        if (action.received_time != LatencyClock::time_point()) {
+            received.push_back(action);
+        }
+        else if (action.sent_turn < turn && (i < matched_before || action.sent_turn + LATENCY_MAX_TURNS <= turn)) {
+            without_result++; // Rejected or replaced by server.
+        }
+        else {
+            waiting.push_back(action);
+        }
+    }
+    sent.swap(waiting);
+}
+
+void LatencyTracker::frame_sent() {
+    if (received.empty()) {
+        return;
+    }
+
+    auto now = LatencyClock::now();
+    for (const TrackedAction &action : received) {
+        queued.add(micros_between(action.input_time, action.sent_time));
+        server.add(micros_between(action.sent_time, action.received_time));
+        display.add(micros_between(action.received_time, now));
+        total.add(micros_between(action.input_time, now));
+    }
+    received.clear();
+}
+
+void LatencyTracker::clear() {
+    sent.clear();
+    received.clear();
+    turn_events = 0;
+}
+
+// Writes percentiles of [histogram] to [file] in one line.
+static void report_histogram(FILE *file, const char *name, const LatencyHistogram &histogram) {
+    fprintf(file, "  %-8s p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", name,
+            (double) histogram.percentile(0.5) / 1e3, (double) histogram.percentile(0.9) / 1e3,
+            (double) histogram.percentile(0.99) / 1e3, (double) histogram.max() / 1e3);
+}
+
+void LatencyTracker::report(FILE *file) {
+    if (total.count() == 0 && without_result == 0) {
+        return;
+    }
+
+    fprintf(file, "Input latency of %lu actions (%lu more without visible result):\n", total.count(),
+            without_result);
+    if (total.count() > 0) {
+        report_histogram(file, "queued", queued);
+        report_histogram(file, "server", server);
+        report_histogram(file, "display", display);
+        report_histogram(file, "total", total);
+    }
+    queued.clear();
+    server.clear();
+    display.clear();
+    total.clear();
+    without_result = 0;
+}
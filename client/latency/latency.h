@@ -0,0 +1,95 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <chrono>
+#include <cstdio>
+
+#include "../../common/types.h"
+
+#define LATENCY_SUB_BUCKETS 16 // Buckets per power of two, values are exact below it.
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+#define LATENCY_MAX_TURNS 3    // Turns after which action without visible result is forgotten.
+
+#define OWN_BOMB_PLACED 1      // Flags of events caused by player's own actions.
+#define OWN_BLOCK_PLACED 2
+#define OWN_PLAYER_MOVED 4
+
+using LatencyClock = std::chrono::steady_clock;
+
+// Distribution of latencies in microseconds. Buckets grow with values, so
+// percentiles are off by at most 1 / LATENCY_SUB_BUCKETS.
+class LatencyHistogram {
+public:
+    void add(uint64_t micros);
+
+    uint64_t count() const {
+        return samples;
+    }
+
+    // Returns the smallest value not exceeded by [fraction] of samples,
+    // rounded down to its bucket.
+    uint64_t percentile(double fraction) const;
+
+    uint64_t max() const {
+        return max_micros;
+    }
+
+    void clear();
+
+private:
+    uint64_t buckets[LATENCY_BUCKETS] = {};
+    uint64_t samples = 0;
+    uint64_t max_micros = 0;
+};
+
+// Action sent to server, followed until GUI shows its result.
+struct TrackedAction {
+    uint8_t message_type;       // As returned by read_message_from_gui.
+    uint16_t sent_turn;         // The last turn received when action was sent.
+    LatencyClock::time_point input_time;
+    LatencyClock::time_point sent_time;
+    LatencyClock::time_point received_time; // Zero until Turn with its result is received.
+};
+
+// Measures time from player's input to GUI showing its result: until action
+// is sent to server (it may wait for the next turn), until Turn with event
+// caused by it is received and until GUI is sent the new state. Action is
+// matched with a later Turn containing event of player's own robot of its
+// kind: PlayerMoved for Move, BombPlaced or BlockPlaced on robot's position
+// for PlaceBomb and PlaceBlock.
+class LatencyTracker {
+public:
+    // Follows action of type [message_type], taken at [input_time] and sent
+    // now, after turn [turn].
+    void action_sent(uint8_t message_type, uint16_t turn, LatencyClock::time_point input_time);
+
+    // Notes event of kind [own_event] (OWN_*) in the Turn being read.
+    void own_event(uint8_t own_event) {
+        turn_events |= own_event;
+    }
+
+    // Matches actions with events of Turn [turn], which was read completely.
+    void turn_finished(uint16_t turn);
+
+    // Completes measurement of actions whose results were sent to GUI.
+    void frame_sent();
+
+    // Forgets actions of game that ended.
+    void clear();
+
+    // Writes distributions gathered since the last report to [file] and
+    // starts new ones. Nothing is written if no action was measured.
+    void report(FILE *file);
+
+private:
+    Deque<TrackedAction> sent;     // Waiting for Turn with their results.
+    List<TrackedAction> received;  // Waiting to be shown by GUI.
+    uint8_t turn_events = 0;
+    uint64_t without_result = 0;
+    LatencyHistogram queued;       // Input to sending.
+    LatencyHistogram server;       // Sending to receiving Turn.
+    LatencyHistogram display;      // Receiving Turn to sending frame to GUI.
+    LatencyHistogram total;
+};
+
+#endif // LATENCY_H
@@ -1,169 +1,303 @@
 #include "messages.h"
 #include "../net/net.h"
 #include "../../common/err.h"
+#include "../../common/zobrist.h"
+#include "../../common/compact.h"
+#include "../../common/trace.h"
 
-#include <iostream>
+#include <arpa/inet.h>
+#include <cstring>
+#include <endian.h>
 
-#define DATAGRAM_LIMIT 65507
-#define GUI_WRONG_MSG 10
 #define NO_FLAGS 0
+#define TURN_INTERVAL_WEIGHT 8 // New interval between Turns counts 1/8 in the estimate.
 
-// Reads number of type T from socket [socket_fd] and returns it.
-template<class T>
-static T read_uint(int socket_fd) {
-    T value;
-    size_t read_length = receive_message(socket_fd, &value, sizeof(T), MSG_WAITALL);
-    ENSURE(read_length == sizeof(T));
-    return value;
-}
+// Starts new turn window: sends action still pending to server and updates
+// estimated interval between Turns if this Turn follows [consecutive] the
+// previous one.
+static void start_turn_window(ClientData &data, bool consecutive);
 
-// Sends number of type T and value [value] using socket [socket_fd].
-template<class T>
-static void send_uint(int socket_fd, T value) {
-    send_message(socket_fd, &value, sizeof(T), NO_FLAGS);
-}
+/******************************* FROM SERVER **********************************/
 
-// Reads string from socket [socket_fd] and returns it.
-static std::string read_string(int socket_fd) {
-    auto string_length = read_uint<uint8_t>(socket_fd);
-    char buffer[string_length + 1];
-    size_t read_length = receive_message(socket_fd, &buffer, string_length, MSG_WAITALL);
-    ENSURE(read_length == string_length);
-    buffer[string_length] = '\0';
-    return std::string(buffer);
-}
+// Reads data received from server starting at given index. If there are not
+// enough bytes, reader becomes incomplete and returns zeroes.
+class ServerReader {
+public:
+    ServerReader(const List<uint8_t> &bytes, size_t start, bool compact)
+            : bytes(bytes), next(start), compact(compact) {}
 
-// Sends Join message to server.
-static void send_join(const ClientData &data) {
-    uint8_t buffer[data.player_name.size() + 2];
-    buffer[0] = 0;
-    buffer[1] = (uint8_t) data.player_name.size();
-    memcpy(buffer + 2, data.player_name.c_str(), data.player_name.size());
-    send_message(data.server_fd, buffer, sizeof(buffer), NO_FLAGS);
-}
-
-void read_hello(ClientData &data) {
-    ENSURE(read_uint<uint8_t>(data.server_fd) == 0);
-
-    data.server_name = read_string(data.server_fd);
-    data.players_count = read_uint<uint8_t>(data.server_fd);
-    data.size_x = read_uint<uint16_t>(data.server_fd);
-    data.size_y = read_uint<uint16_t>(data.server_fd);
-    data.game_length = read_uint<uint16_t>(data.server_fd);
-    data.explosion_radius = read_uint<uint16_t>(data.server_fd);
-    data.bomb_timer = read_uint<uint16_t>(data.server_fd);
-}
+    // Returns true if all read values were received.
+    bool complete() const {
+        return !incomplete;
+    }
 
-uint8_t read_message_from_gui(const ClientData &data) {
-    uint8_t buffer[2];
-    size_t read_length = receive_message(data.gui_rec_fd, buffer, 2, NO_FLAGS);
-    if (!(read_length == 1 && buffer[0] < 2) && !(read_length == 2 && buffer[1] < 4)) {
-        return GUI_WRONG_MSG;
+    // Returns true if data is in compact encoding.
+    bool is_compact() const {
+        return compact;
     }
 
-    switch (buffer[0]) {
-        case 0:
-            return 0;
-        case 1:
-            return 1;
-        case 2:
-            return 2 + buffer[1];
-        default:
-            return 0;
+    // Returns index of the first byte that was not read.
+    size_t position() const {
+        return next;
     }
-}
 
-void send_message_to_server(ClientData &data, uint8_t message_type) {
-    if (message_type == GUI_WRONG_MSG) {
-        return;
+    // Reads number of type T. Number is not converted to host order.
+    template<class T>
+    T read_uint() {
+        T value{};
+        if (!has(sizeof(T))) {
+            return value;
+        }
+        memcpy(&value, bytes.data() + next, sizeof(T));
+        next += sizeof(T);
+        return value;
     }
 
-    ENSURE(pthread_mutex_lock(&data.lock) == 0);
-    bool in_lobby = data.is_in_lobby;
-    ENSURE(pthread_mutex_unlock(&data.lock) == 0);
+    // Reads varint, see common/compact.h.
+    uint64_t read_varint() {
+        uint64_t value = 0;
+        for (size_t i = 0; i < MAX_VARINT_LENGTH; i++) {
+            if (!has(1)) {
+                return 0;
+            }
+            uint8_t byte = bytes[next++];
+            value |= (uint64_t) (byte & 0x7f) << (7 * i);
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        fatal("Invalid varint from server.");
+        return 0;
+    }
 
-    if (in_lobby) { // Join
-        send_join(data);
+    // Reads [length] bytes into [destination].
+    void read_bytes(uint8_t *destination, size_t length) {
+        if (!has(length)) {
+            return;
+        }
+        memcpy(destination, bytes.data() + next, length);
+        next += length;
     }
-    else if (message_type < 2) { // PlaceBomb or PlaceBlock
-        send_uint<uint8_t>(data.server_fd, message_type + 1);
+
+    // Reads string.
+    std::string read_string() {
+        auto string_length = read_uint<uint8_t>();
+        if (!has(string_length)) {
+            return "";
+        }
+        std::string result((const char *) bytes.data() + next, string_length);
+        next += string_length;
+        return result;
     }
-    else { // Move
-        uint8_t buffer[2];
-        buffer[0] = 3;
-        buffer[1] = message_type - 2;
-        send_message(data.server_fd, buffer, 2, NO_FLAGS);
+
+private:
+    const List<uint8_t> &bytes;
+    size_t next;
+    bool compact;
+    bool incomplete = false;
+
+    // Returns true if [length] more bytes are available, otherwise marks
+    // reader as incomplete.
+    bool has(size_t length) {
+        if (incomplete || next + length > bytes.size()) {
+            incomplete = true;
+            return false;
+        }
+        return true;
     }
+};
+
+// Converts [position] from net order to host order and vice versa.
+static Position convertPosition(const Position &position) {
+    return Position(htons(position.x), htons(position.y));
 }
 
-// Reads PlayerId from socket [socket_fd] and returns it.
-static PlayerId read_player_id(int socket_fd) {
-    return read_uint<PlayerId>(socket_fd);
+// Reads PlayerId and returns it.
+static PlayerId read_player_id(ServerReader &reader) {
+    return reader.read_uint<PlayerId>();
 }
 
-// Reads Socket from socket [socket_fd] and returns it.
-static Score read_score(int socket_fd) {
-    return ntohl(read_uint<Score>(socket_fd));
+// Reads Score and returns it.
+static Score read_score(ServerReader &reader) {
+    if (reader.is_compact()) {
+        return (Score) reader.read_varint();
+    }
+    return ntohl(reader.read_uint<Score>());
 }
 
-// Reads BombId from socket [socket_fd] and returns it.
-static BombId read_bomb_id(int socket_fd) {
-    return read_uint<BombId>(socket_fd);
+// Reads BombId and returns it.
+static BombId read_bomb_id(ServerReader &reader) {
+    if (reader.is_compact()) {
+        return htonl((BombId) reader.read_varint());
+    }
+    return reader.read_uint<BombId>();
 }
 
-// Reads Position from socket [socket_fd] and returns it.
-static Position read_position(int socket_fd) {
+// Reads Position and returns it.
+static Position read_position(ServerReader &reader) {
     Position position{};
-    position.x = read_uint<uint16_t>(socket_fd);
-    position.y = read_uint<uint16_t>(socket_fd);
+    if (reader.is_compact()) {
+        position.x = htons((uint16_t) reader.read_varint());
+        position.y = htons((uint16_t) reader.read_varint());
+        return position;
+    }
+    position.x = reader.read_uint<uint16_t>();
+    position.y = reader.read_uint<uint16_t>();
     return position;
 }
 
-// Reads Player from socket [socket_fd] and returns it.
-static Player read_player(int socket_fd) {
+// Reads turn number and returns it.
+static uint16_t read_turn(ServerReader &reader) {
+    if (reader.is_compact()) {
+        return htons((uint16_t) reader.read_varint());
+    }
+    return reader.read_uint<uint16_t>();
+}
+
+// Reads player's address and returns it.
+static std::string read_address(ServerReader &reader) {
+    if (!reader.is_compact()) {
+        return reader.read_string();
+    }
+
+    auto tag = reader.read_uint<uint8_t>();
+    if (tag == COMPACT_ADDRESS_STRING) {
+        return reader.read_string();
+    }
+    in6_addr ip{};
+    if (tag == COMPACT_ADDRESS_IPV4) {
+        ip.s6_addr[10] = 0xff;
+        ip.s6_addr[11] = 0xff;
+        reader.read_bytes(ip.s6_addr + 12, 4);
+    }
+    else {
+        reader.read_bytes(ip.s6_addr, 16);
+    }
+    uint16_t port = ntohs(reader.read_uint<uint16_t>());
+    if (!reader.complete()) {
+        return "";
+    }
+
+    char ip_str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &ip, ip_str, INET6_ADDRSTRLEN);
+    std::string result = "[";
+    result += ip_str;
+    result += "]:";
+    result += std::to_string(port);
+    return result;
+}
+
+// Reads Player and returns it.
+static Player read_player(ServerReader &reader) {
     Player player;
-    player.name = read_string(socket_fd);
-    player.address = read_string(socket_fd);
+    player.name = reader.read_string();
+    player.address = read_address(reader);
     return player;
 }
 
+// Reads list length and returns it.
+static uint32_t read_list_length(ServerReader &reader) {
+    if (reader.is_compact()) {
+        return (uint32_t) reader.read_varint();
+    }
+    return ntohl(reader.read_uint<uint32_t>());
+}
+
+// Returns true if robot of the player stands on [position].
+static bool is_own_position(const ClientData &data, const Position &position) {
+    if (!data.has_own_player) {
+        return false;
+    }
+    auto own_position = data.player_positions.find(data.own_player_id);
+    return own_position != data.player_positions.end() && own_position->second == position;
+}
+
+// Each read_* function below reads the rest of a message (or event) whose type
+// was already read. [data] is updated only if the message was received
+// completely, in which case true is returned.
+
+// Reads Hello message from server.
+static bool read_hello(ClientData &data, ServerReader &reader) {
+    std::string server_name = reader.read_string();
+    auto players_count = reader.read_uint<uint8_t>();
+    auto size_x = reader.read_uint<uint16_t>();
+    auto size_y = reader.read_uint<uint16_t>();
+    auto game_length = reader.read_uint<uint16_t>();
+    auto explosion_radius = reader.read_uint<uint16_t>();
+    auto bomb_timer = reader.read_uint<uint16_t>();
+    if (!reader.complete()) {
+        return false;
+    }
+
+    data.server_name = server_name;
+    data.players_count = players_count;
+    data.size_x = size_x;
+    data.size_y = size_y;
+    data.game_length = game_length;
+    data.explosion_radius = explosion_radius;
+    data.bomb_timer = bomb_timer;
+    data.received_hello = true;
+    return true;
+}
+
 // Reads AcceptedPlayer message from server.
-static void read_accepted_player(ClientData &data) {
-    PlayerId player_id = read_player_id(data.server_fd);
-    Player player = read_player(data.server_fd);
+static bool read_accepted_player(ClientData &data, ServerReader &reader) {
+    PlayerId player_id = read_player_id(reader);
+    Player player = read_player(reader);
+    if (!reader.complete()) {
+        return false;
+    }
+
     data.players[player_id] = player;
+    return true;
 }
 
 // Reads GameStarted message from server.
-static void read_game_started(ClientData &data) {
-    data.players.clear();
-
-    u_int32_t map_length = ntohl(read_uint<uint32_t>(data.server_fd));
-    for (uint32_t i = 0; i < map_length; i++) {
-        PlayerId player_id = read_player_id(data.server_fd);
-        Player player = read_player(data.server_fd);
-        data.players[player_id] = player;
+static bool read_game_started(ClientData &data, ServerReader &reader) {
+    Map<PlayerId, Player> players;
+    uint32_t map_length = read_list_length(reader);
+    for (uint32_t i = 0; i < map_length && reader.complete(); i++) {
+        PlayerId player_id = read_player_id(reader);
+        players[player_id] = read_player(reader);
+    }
+    if (!reader.complete()) {
+        return false;
     }
 
-    data.scores.clear();
+    // Game is received from scratch, also by player that resumed with view
+    // sync and gets his view again.
+    data.clear_game();
+    data.players = players;
+    size_t players_named_as_own = 0;
     for (const auto &player : data.players) {
         data.scores[player.first] = 0;
+        if (!data.has_own_player && player.second.name == data.player_name) {
+            data.own_player_id = player.first;
+            players_named_as_own++;
+        }
+    }
+    if (players_named_as_own == 1) { // Without Session robot is known only by unique name.
+        data.has_own_player = true;
     }
 
     data.is_in_lobby = false;
+    return true;
 }
 
-// Reads BombPlaced message from server.
-static void read_bomb_placed(ClientData &data) {
-    BombId bomb_id = read_bomb_id(data.server_fd);
-    Position position = read_position(data.server_fd);
-    Bomb bomb(position, ntohs(data.bomb_timer));
-    data.bombs[bomb_id] = bomb;
-}
+// Reads BombPlaced event from server.
+static bool read_bomb_placed(ClientData &data, ServerReader &reader) {
+    BombId bomb_id = read_bomb_id(reader);
+    Position position = read_position(reader);
+    if (!reader.complete()) {
+        return false;
+    }
 
-// Converts [position] from net order to host order and vice versa.
-static Position convertPosition(const Position &position) {
-    return Position(htons(position.x), htons(position.y));
+    if (is_own_position(data, position)) {
+        data.latency.own_event(OWN_BOMB_PLACED);
+    }
+    data.bombs[bomb_id] = Bomb(position, ntohs(data.bomb_timer));
+    data.state_hash ^= zobrist_bomb_key(ntohl(bomb_id), convertPosition(position));
+    return true;
 }
 
 // Finds explosions caused by explosion in position [bomb_position] and
@@ -212,66 +346,253 @@ static void findExplosions(ClientData &data, const Position &bomb_position) {
     }
 }
 
-// Reads BombExploded message from server.
-static void read_bomb_exploded(ClientData &data) {
-    BombId bomb_id = read_bomb_id(data.server_fd);
+// Reads lists of destroyed robots and blocks of BombExploded or Destroyed
+// event from server into [robots] and [blocks].
+static void read_destroyed_lists(ServerReader &reader, List<PlayerId> &robots, List<Position> &blocks) {
+    uint32_t list_length = read_list_length(reader);
+    for (uint32_t i = 0; i < list_length && reader.complete(); i++) {
+        robots.push_back(read_player_id(reader));
+    }
+
+    list_length = read_list_length(reader);
+    Position previous(0, 0); // in host order, used in compact encoding
+    for (uint32_t i = 0; i < list_length && reader.complete(); i++) {
+        if (reader.is_compact()) {
+            previous.x = (uint16_t) (previous.x + zigzag_decode(reader.read_varint()));
+            previous.y = (uint16_t) (previous.y + zigzag_decode(reader.read_varint()));
+            blocks.push_back(convertPosition(previous));
+        }
+        else {
+            blocks.push_back(read_position(reader));
+        }
+    }
+}
+
+// Adds one to score of robot [player_id].
+static void count_destruction(ClientData &data, PlayerId player_id) {
+    data.state_hash ^= zobrist_score_key(player_id, data.scores[player_id]);
+    data.scores[player_id]++;
+    data.state_hash ^= zobrist_score_key(player_id, data.scores[player_id]);
+}
+
+// Reads BombExploded event from server.
+static bool read_bomb_exploded(ClientData &data, ServerReader &reader) {
+    BombId bomb_id = read_bomb_id(reader);
+    List<PlayerId> robots_destroyed;
+    List<Position> blocks_destroyed;
+    read_destroyed_lists(reader, robots_destroyed, blocks_destroyed);
+    if (!reader.complete()) {
+        return false;
+    }
 
     findExplosions(data, data.bombs[bomb_id].position);
+    data.state_hash ^= zobrist_bomb_key(ntohl(bomb_id), convertPosition(data.bombs[bomb_id].position));
     data.bombs.erase(bomb_id);
+    data.died_this_round.insert(robots_destroyed.begin(), robots_destroyed.end());
+    data.blocks_destroyed_this_round.insert(blocks_destroyed.begin(), blocks_destroyed.end());
+    return true;
+}
 
-    u_int32_t list_length = ntohl(read_uint<uint32_t>(data.server_fd));
-    for (uint32_t i = 0; i < list_length; i++) {
-        PlayerId player_id = read_player_id(data.server_fd);
-        data.died_this_round.insert(player_id);
+// Reads Destroyed event (only with view sync) from server. Robots on its list
+// are counted at once, one point for every entry, as the server lists only
+// robots not destroyed in explosions client saw. Blocks are removed with
+// blocks destroyed in this turn.
+static bool read_destroyed(ClientData &data, ServerReader &reader) {
+    List<PlayerId> robots_destroyed;
+    List<Position> blocks_destroyed;
+    read_destroyed_lists(reader, robots_destroyed, blocks_destroyed);
+    if (!reader.complete()) {
+        return false;
     }
 
-    list_length = ntohl(read_uint<uint32_t>(data.server_fd));
-    for (uint32_t i = 0; i < list_length; i++) {
-        Position position = read_position(data.server_fd);
-        data.blocks_destroyed_this_round.insert(position);
+    for (PlayerId player_id : robots_destroyed) {
+        count_destruction(data, player_id);
     }
+    data.blocks_destroyed_this_round.insert(blocks_destroyed.begin(), blocks_destroyed.end());
+    return true;
 }
 
-// Reads PlayerMoved message from server.
-static void read_player_moved(ClientData &data) {
-    PlayerId player_id = read_player_id(data.server_fd);
-    Position position = read_position(data.server_fd);
+// Reads PlayerMoved event from server.
+static bool read_player_moved(ClientData &data, ServerReader &reader) {
+    PlayerId player_id = read_player_id(reader);
+    auto old_position = data.player_positions.find(player_id);
+    Position position{};
+    if (reader.is_compact()) {
+        uint64_t first = reader.read_varint();
+        uint64_t second = reader.read_varint();
+        if (first & 1) { // Moved relative to the last position.
+            Position base = old_position != data.player_positions.end()
+                            ? convertPosition(old_position->second) : Position(0, 0);
+            position.x = (uint16_t) (base.x + zigzag_decode(first >> 1));
+            position.y = (uint16_t) (base.y + zigzag_decode(second));
+        }
+        else {
+            position.x = (uint16_t) (first >> 1);
+            position.y = (uint16_t) second;
+        }
+        position = convertPosition(position);
+    }
+    else {
+        position = read_position(reader);
+    }
+    if (!reader.complete()) {
+        return false;
+    }
+
+    if (old_position != data.player_positions.end()) {
+        data.state_hash ^= zobrist_player_key(player_id, convertPosition(old_position->second));
+    }
     data.player_positions[player_id] = position;
+    data.state_hash ^= zobrist_player_key(player_id, convertPosition(position));
+    if (data.has_own_player && player_id == data.own_player_id) {
+        data.latency.own_event(OWN_PLAYER_MOVED);
+    }
+    return true;
+}
+
+// Reads BlockPlaced event from server.
+static bool read_block_placed(ClientData &data, ServerReader &reader) {
+    Position position = read_position(reader);
+    if (!reader.complete()) {
+        return false;
+    }
+
+    if (is_own_position(data, position)) {
+        data.latency.own_event(OWN_BLOCK_PLACED);
+    }
+    if (data.blocks.emplace(position).second) {
+        data.state_hash ^= zobrist_block_key(convertPosition(position));
+    }
+    return true;
 }
 
-// Reads BlockPlaced message from server.
-static void read_block_placed(ClientData &data) {
-    Position position = read_position(data.server_fd);
-    data.blocks.emplace(position);
+// Reads BlockRuns event (only in compact encoding) from server.
+static bool read_block_runs(ClientData &data, ServerReader &reader) {
+    List<Position> blocks;
+    uint32_t runs = read_list_length(reader);
+    uint64_t size_x = ntohs(data.size_x);
+    uint64_t end = 0;
+    for (uint32_t i = 0; i < runs && reader.complete(); i++) {
+        uint64_t first = end + reader.read_varint();
+        end = first + reader.read_varint();
+        if (size_x == 0 || end > size_x * ntohs(data.size_y)) {
+            fatal("Invalid BlockRuns event.");
+        }
+        for (uint64_t index = first; index < end && reader.complete(); index++) {
+            blocks.push_back(convertPosition(Position((uint16_t) (index % size_x), (uint16_t) (index / size_x))));
+        }
+    }
+    if (!reader.complete()) {
+        return false;
+    }
+
+    for (const Position &position : blocks) {
+        if (is_own_position(data, position)) {
+            data.latency.own_event(OWN_BLOCK_PLACED);
+        }
+        if (data.blocks.emplace(position).second) {
+            data.state_hash ^= zobrist_block_key(convertPosition(position));
+        }
+    }
+    return true;
 }
 
-// Reads Event message from server.
-static void read_event(ClientData &data) {
-    auto event_type = read_uint<uint8_t>(data.server_fd);
-    if (event_type >= 4) {
+// Calls fatal() if server could not send event [event_type]: BlockRuns
+// exists only in compact encoding and Destroyed only with view sync.
+static void check_event_type(const ClientData &data, const ServerReader &reader, uint8_t event_type) {
+    if (event_type > DESTROYED || (event_type == BLOCK_RUNS && !reader.is_compact())
+        || (event_type == DESTROYED && !data.view_sync)) {
         fatal("Invalid event (%d).", (int) event_type);
     }
+}
+
+// Reads Event from server.
+static bool read_event(ClientData &data, ServerReader &reader) {
+    auto event_type = reader.read_uint<uint8_t>();
+    if (!reader.complete()) {
+        return false;
+    }
+    check_event_type(data, reader, event_type);
+
+    switch (event_type) {
+        case 0:
+            return read_bomb_placed(data, reader);
+        case 1:
+            return read_bomb_exploded(data, reader);
+        case 2:
+            return read_player_moved(data, reader);
+        case 3:
+            return read_block_placed(data, reader);
+        case BLOCK_RUNS:
+            return read_block_runs(data, reader);
+        default:
+            return read_destroyed(data, reader);
+    }
+}
+
+// Reads Event from server without changing [data]. Used for Turns client
+// already has.
+static bool skip_event(const ClientData &data, ServerReader &reader) {
+    auto event_type = reader.read_uint<uint8_t>();
+    if (!reader.complete()) {
+        return false;
+    }
+    check_event_type(data, reader, event_type);
 
+    uint32_t list_length;
     switch (event_type) {
         case 0:
-            read_bomb_placed(data);
+            read_bomb_id(reader);
+            read_position(reader);
             break;
         case 1:
-            read_bomb_exploded(data);
+        case DESTROYED:
+            if (event_type == 1) {
+                read_bomb_id(reader);
+            }
+            list_length = read_list_length(reader);
+            for (uint32_t i = 0; i < list_length && reader.complete(); i++) {
+                read_player_id(reader);
+            }
+            list_length = read_list_length(reader);
+            for (uint32_t i = 0; i < list_length && reader.complete(); i++) {
+                read_position(reader); // Two varints in compact encoding as well.
+            }
             break;
         case 2:
-            read_player_moved(data);
+            read_player_id(reader);
+            read_position(reader);
             break;
         case 3:
-            read_block_placed(data);
+            read_position(reader);
             break;
         default:
+            list_length = read_list_length(reader);
+            for (uint32_t i = 0; i < 2 * (uint64_t) list_length && reader.complete(); i++) {
+                reader.read_varint();
+            }
             break;
     }
+    return reader.complete();
 }
 
-// Reads Turn message from server.
-static void read_turn(ClientData &data) {
+// Reads beginning of Turn message (without events) from server. Turn that
+// client already has (it could come in a datagram) is skipped.
+static bool read_turn_header(ClientData &data, ServerReader &reader) {
+    uint16_t turn = read_turn(reader);
+    uint32_t list_length = read_list_length(reader);
+    if (!reader.complete()) {
+        return false;
+    }
+
+    data.in_turn = true;
+    data.turn_events_left = list_length;
+    data.skipping_turn = data.has_turn_0 && turn != 0 && ntohs(turn) <= ntohs(data.turn);
+    if (data.skipping_turn) {
+        return true;
+    }
+    bool consecutive = data.has_turn_0 && ntohs(turn) == ntohs(data.turn) + 1;
+
     data.explosions.clear();
     data.died_this_round.clear();
     data.blocks_destroyed_this_round.clear();
@@ -279,67 +600,374 @@ static void read_turn(ClientData &data) {
         bomb.second.timer--;
     }
 
-    data.turn = read_uint<uint16_t>(data.server_fd);
+    data.turn = turn;
+    data.has_turn_0 = true;
+
+    start_turn_window(data, consecutive);
+    return true;
+}
 
-    u_int32_t list_length = ntohl(read_uint<uint32_t>(data.server_fd));
-    for (uint32_t i = 0; i < list_length; i++) {
-        read_event(data);
+// Finishes processing Turn message after all its events were read.
+static void finish_turn(ClientData &data) {
+    data.in_turn = false;
+    data.datagram_outdated = data.datagram_token != 0;
+    if (data.skipping_turn) {
+        data.skipping_turn = false;
+        return;
     }
 
     for (PlayerId player_id : data.died_this_round) {
-        data.scores[player_id]++;
+        count_destruction(data, player_id);
     }
     for (const Position &position : data.blocks_destroyed_this_round) {
-        data.blocks.erase(position);
+        if (data.blocks.erase(position) > 0) {
+            data.state_hash ^= zobrist_block_key(convertPosition(position));
+        }
     }
+    data.latency.turn_finished(ntohs(data.turn));
+}
+
+// Reads TurnHash message from server and reports if it differs from hash of
+// client's state. Hash of other turn than the last one is not checked.
+static bool read_turn_hash(ClientData &data, ServerReader &reader) {
+    uint16_t turn = ntohs(read_turn(reader));
+    uint64_t server_hash = be64toh(reader.read_uint<uint64_t>());
+    if (!reader.complete()) {
+        return false;
+    }
+
+    if (turn == ntohs(data.turn) && server_hash != data.state_hash) {
+        fprintf(stderr, "State differs from server's state in turn %d.\n", (int) turn);
+    }
+    return true;
+}
+
+// Reads Capabilities message from server. Messages after it are in compact
+// encoding if server accepted it.
+static bool read_capabilities(ClientData &data, ServerReader &reader) {
+    auto flags = reader.read_uint<uint8_t>();
+    if (!reader.complete()) {
+        return false;
+    }
+
+    data.compact_encoding = flags & CAPABILITY_COMPACT;
+    data.view_sync = flags & CAPABILITY_VIEW_SYNC;
+    return true;
+}
+
+// Reads Session message from server.
+static bool read_session(ClientData &data, ServerReader &reader) {
+    auto player_id = reader.read_uint<PlayerId>();
+    uint64_t token = be64toh(reader.read_uint<uint64_t>());
+    if (!reader.complete()) {
+        return false;
+    }
+
+    data.session_token = token;
+    data.own_player_id = player_id;
+    data.has_own_player = true;
+    return true;
+}
+
+// Reads DatagramSession message from server.
+static bool read_datagram_session(ClientData &data, ServerReader &reader) {
+    uint64_t token = be64toh(reader.read_uint<uint64_t>());
+    uint16_t port = ntohs(reader.read_uint<uint16_t>());
+    if (!reader.complete()) {
+        return false;
+    }
+
+    data.datagram_token = token;
+    data.datagram_port = port;
+    data.datagram_outdated = true;
+    return true;
 }
 
 // Reads GameEnded message from server.
-static void read_game_ended(ClientData &data) {
+static bool read_game_ended(ClientData &data, ServerReader &reader) {
     Map<PlayerId, Score> server_scores;
 
-    u_int32_t map_length = ntohl(read_uint<uint32_t>(data.server_fd));
-    for (uint32_t i = 0; i < map_length; i++) {
-        PlayerId player_id = read_player_id(data.server_fd);
-        Score server_score = read_score(data.server_fd);
-        server_scores[player_id] = server_score;
+    uint32_t map_length = read_list_length(reader);
+    for (uint32_t i = 0; i < map_length && reader.complete(); i++) {
+        PlayerId player_id = read_player_id(reader);
+        server_scores[player_id] = read_score(reader);
+    }
+    if (!reader.complete()) {
+        return false;
     }
 
     data.clear();
+    TRACE_DUMP();
+    return true;
 }
 
-bool read_message_from_server(ClientData &data) {
-    auto message_type = read_uint<uint8_t>(data.server_fd);
-    if (message_type == 0 || message_type >= 5) {
+// Reads one message from server, or only beginning of Turn message. Returns
+// false if message was not received completely. Sets [send_to_gui] to true
+// if GUI should be sent the new state.
+static bool read_message_from_server(ClientData &data, ServerReader &reader, bool &send_to_gui) {
+    auto message_type = reader.read_uint<uint8_t>();
+    if (!reader.complete()) {
+        return false;
+    }
+    if (message_type >= 9 || (message_type == 0) == data.received_hello) {
         fatal("Invalid message (%d) from server.", (int) message_type);
     }
+    if (data.resuming && message_type != 0 && message_type != 6 && message_type != 8) {
+        // Without Session server did not resume, it sends everything again.
+        if (message_type != 7) {
+            data.clear();
+        }
+        data.resuming = false;
+    }
 
-    bool send_to_gui = false;
-
+    bool complete;
     switch (message_type) {
+        case 0:
+            complete = read_hello(data, reader);
+            break;
         case 1:
-            read_accepted_player(data);
-            send_to_gui = true;
+            complete = read_accepted_player(data, reader);
             break;
         case 2:
-            read_game_started(data);
-            send_to_gui = false;
-            break;
+            return read_game_started(data, reader);
         case 3:
-            read_turn(data);
-            send_to_gui = true;
-            break;
-        case 4:
-            read_game_ended(data);
-            send_to_gui = true;
-            break;
+            return read_turn_header(data, reader);
+        case 5:
+            return read_turn_hash(data, reader);
+        case 6:
+            return read_capabilities(data, reader);
+        case 7:
+            return read_session(data, reader);
+        case 8:
+            return read_datagram_session(data, reader);
         default:
+            complete = read_game_ended(data, reader);
             break;
     }
 
+    send_to_gui |= complete;
+    return complete;
+}
+
+bool read_messages_from_server(ClientData &data) {
+    TRACE_SPAN("read_messages_from_server");
+    bool send_to_gui = false;
+    size_t processed = 0;
+
+    while (true) {
+        ServerReader reader(data.server_in, processed, data.compact_encoding);
+        if (data.in_turn && data.turn_events_left > 0) {
+            if (!(data.skipping_turn ? skip_event(data, reader) : read_event(data, reader))) {
+                break;
+            }
+            data.turn_events_left--;
+        }
+        else if (!read_message_from_server(data, reader, send_to_gui)) {
+            break;
+        }
+
+        if (data.in_turn && data.turn_events_left == 0) {
+            send_to_gui |= !data.skipping_turn;
+            finish_turn(data);
+        }
+        processed = reader.position();
+    }
+
+    data.server_in.erase(data.server_in.begin(), data.server_in.begin() + (ssize_t) processed);
     return send_to_gui;
 }
 
+bool read_datagram_from_server(ClientData &data, const List<uint8_t> &datagram) {
+    TRACE_SPAN("read_datagram_from_server");
+    uint64_t token = 0;
+    if (datagram.size() < sizeof(token) || data.is_in_lobby || !data.has_turn_0 || data.in_turn) {
+        return false;
+    }
+    memcpy(&token, datagram.data(), sizeof(token));
+    if (be64toh(token) != data.datagram_token) {
+        return false; // Datagram of the previous game.
+    }
+
+    bool send_to_gui = false;
+    size_t processed = sizeof(token);
+    while (processed < datagram.size()) {
+        ServerReader reader(datagram, processed, false);
+        auto message_type = reader.read_uint<uint8_t>();
+        if (message_type == 3) {
+            ServerReader turn_reader = reader;
+            if (ntohs(read_turn(turn_reader)) > ntohs(data.turn) + 1) {
+                break; // Turns before it were lost, they will come again.
+            }
+            bool complete = read_turn_header(data, reader);
+            for (; complete && data.turn_events_left > 0; data.turn_events_left--) {
+                complete = data.skipping_turn ? skip_event(data, reader) : read_event(data, reader);
+            }
+            if (!complete) {
+                fatal("Invalid datagram from server.");
+            }
+            send_to_gui |= !data.skipping_turn;
+            finish_turn(data);
+        }
+        else if (message_type != 5 || !read_turn_hash(data, reader)) {
+            fatal("Invalid datagram from server.");
+        }
+        processed = reader.position();
+    }
+    return send_to_gui;
+}
+
+/********************************* TO SERVER **********************************/
+
+// Puts number of type T and value [value] into [data.server_out].
+template<class T>
+static void put_uint_to_server(ClientData &data, T value) {
+    auto bytes = (const uint8_t *) &value;
+    data.server_out.insert(data.server_out.end(), bytes, bytes + sizeof(T));
+}
+
+void send_capabilities(ClientData &data, uint8_t flags) {
+    put_uint_to_server<uint8_t>(data, 4);
+    put_uint_to_server<uint8_t>(data, flags);
+}
+
+void send_resume(ClientData &data) {
+    put_uint_to_server<uint8_t>(data, 6);
+    put_uint_to_server<uint64_t>(data, htobe64(data.session_token));
+    put_uint_to_server<uint8_t>(data, !data.is_in_lobby);
+    put_uint_to_server<uint16_t>(data, data.is_in_lobby ? 0 : data.turn);
+}
+
+// Puts Join message into [data.server_out].
+static void send_join(ClientData &data) {
+    put_uint_to_server<uint8_t>(data, 0);
+    put_uint_to_server<uint8_t>(data, (uint8_t) data.player_name.size());
+    data.server_out.insert(data.server_out.end(), data.player_name.begin(), data.player_name.end());
+}
+
+// Puts action of type [message_type], taken by player at [input_time], into
+// [data.server_out], or among actions sent in datagrams if server accepted
+// them, and notes it as the action sent in this turn.
+static void send_action(ClientData &data, uint8_t message_type, LatencyClock::time_point input_time) {
+    if (data.datagram_token != 0) {
+        data.datagram_actions.emplace_back(data.next_action_sequence++, message_type);
+        if (data.datagram_actions.size() > DATAGRAM_ACTIONS) {
+            data.datagram_actions.pop_front();
+        }
+        data.datagram_outdated = true;
+    }
+    else if (message_type < 2) { // PlaceBomb or PlaceBlock
+        put_uint_to_server<uint8_t>(data, message_type + 1);
+    }
+    else { // Move
+        put_uint_to_server<uint8_t>(data, 3);
+        put_uint_to_server<uint8_t>(data, message_type - 2);
+    }
+    data.sent_action = message_type;
+    data.pending_action = GUI_NO_MSG;
+    data.latency.action_sent(message_type, data.has_turn_0 ? ntohs(data.turn) : 0, input_time);
+}
+
+void build_datagram_to_server(const ClientData &data, List<uint8_t> &datagram) {
+    auto put_uint = [&datagram](uint64_t value, size_t length) {
+        for (size_t i = length; i > 0; i--) {
+            datagram.push_back((uint8_t) (value >> (8 * (i - 1))));
+        }
+    };
+
+    uint16_t acked_turn = 0;
+    if (!data.is_in_lobby && data.has_turn_0) {
+        acked_turn = (uint16_t) (ntohs(data.turn) - (data.in_turn && !data.skipping_turn ? 1 : 0));
+    }
+    datagram.clear();
+    put_uint(data.datagram_token, sizeof(uint64_t));
+    put_uint(acked_turn, sizeof(uint16_t));
+    put_uint(data.datagram_actions.size(), sizeof(uint8_t));
+    for (const auto &[sequence, message_type] : data.datagram_actions) {
+        put_uint(sequence, sizeof(uint16_t));
+        if (message_type < 2) { // PlaceBomb or PlaceBlock
+            put_uint(message_type + 1, sizeof(uint8_t));
+        }
+        else { // Move
+            put_uint(3, sizeof(uint8_t));
+            put_uint(message_type - 2, sizeof(uint8_t));
+        }
+    }
+}
+
+static void start_turn_window(ClientData &data, bool consecutive) {
+    auto now = LatencyClock::now();
+    if (consecutive) {
+        LatencyClock::duration interval = now - data.turn_time;
+        data.turn_interval = data.turn_interval.count() == 0
+                             ? interval
+                             : data.turn_interval + (interval - data.turn_interval) / TURN_INTERVAL_WEIGHT;
+    }
+    data.turn_time = now;
+
+    data.sent_action = GUI_NO_MSG;
+    if (data.pending_action != GUI_NO_MSG) { // Turn came earlier than expected.
+        send_action(data, data.pending_action, data.pending_action_time);
+    }
+}
+
+LatencyClock::time_point pending_action_deadline(const ClientData &data) {
+    return data.turn_time + data.turn_interval / 2;
+}
+
+void send_pending_action(ClientData &data) {
+    if (data.pending_action != GUI_NO_MSG && LatencyClock::now() >= pending_action_deadline(data)) {
+        send_action(data, data.pending_action, data.pending_action_time);
+    }
+}
+
+void send_message_to_server(ClientData &data, uint8_t message_type) {
+    if (message_type == GUI_WRONG_MSG || message_type == GUI_NO_MSG) {
+        return;
+    }
+
+    auto now = LatencyClock::now();
+    if (data.is_in_lobby) { // Join
+        send_join(data);
+    }
+    else if (message_type == data.sent_action) { // Server has it as the last action in turn already.
+        data.pending_action = GUI_NO_MSG;
+    }
+    else if ((data.immediate_input && data.sent_action == GUI_NO_MSG) || now >= pending_action_deadline(data)) {
+        send_action(data, message_type, now);
+    }
+    else { // Server takes only the last action in turn, so older ones are dropped.
+        data.pending_action = message_type;
+        data.pending_action_time = now;
+    }
+}
+
+/********************************* FROM GUI ***********************************/
+
+uint8_t read_message_from_gui(const ClientData &data) {
+    TRACE_SPAN("read_message_from_gui");
+    uint8_t buffer[2];
+    ssize_t read_length = receive_available(data.gui_rec_fd, buffer, 2);
+    if (read_length < 0) {
+        return GUI_NO_MSG;
+    }
+    if (!(read_length == 1 && buffer[0] < 2) && !(read_length == 2 && buffer[1] < 4)) {
+        return GUI_WRONG_MSG;
+    }
+
+    switch (buffer[0]) {
+        case 0:
+            return 0;
+        case 1:
+            return 1;
+        case 2:
+            return 2 + buffer[1];
+        default:
+            return 0;
+    }
+}
+
+/********************************** TO GUI ************************************/
+
 // Puts number [value] of type T into [buffer] starting at position [next_index].
 template<class T>
 static void put_uint_into_buffer(T value, uint8_t *buffer, size_t &next_index) {
@@ -414,17 +1042,9 @@ static void put_scores_into_buffer(const ClientData &data, uint8_t *buffer, size
     }
 }
 
-// Sends message of length [length] located in [buffer] to GUI.
-static void send_to_gui(int gui_send_fd, const uint8_t *buffer, size_t length) {
-    ssize_t sent_length = send(gui_send_fd, buffer, length, NO_FLAGS);
-    if (sent_length != (ssize_t) length) {
-        fatal("Connection with GUI failed.");
-    }
-}
-
-// Sends Lobby message to GUI.
-static void send_lobby(const ClientData &data) {
-    uint8_t buffer[DATAGRAM_LIMIT];
+// Builds Lobby message for GUI in [frame].
+static void build_lobby(const ClientData &data, GuiFrame &frame) {
+    uint8_t *buffer = frame.buffer;
     size_t next_index = 0;
 
     put_uint_into_buffer<uint8_t>(0, buffer, next_index);
@@ -437,12 +1057,12 @@ static void send_lobby(const ClientData &data) {
     put_uint_into_buffer<uint16_t>(data.bomb_timer, buffer, next_index);
     put_players_into_buffer(data, buffer, next_index);
 
-    send_to_gui(data.gui_send_fd, buffer, next_index);
+    frame.length = next_index;
 }
 
-// Sends Game message to GUI.
-static void send_game(const ClientData &data) {
-    uint8_t buffer[DATAGRAM_LIMIT];
+// Builds Game message for GUI in [frame].
+static void build_game(const ClientData &data, GuiFrame &frame) {
+    uint8_t *buffer = frame.buffer;
     size_t next_index = 0;
 
     put_uint_into_buffer<uint8_t>(1, buffer, next_index);
@@ -458,18 +1078,27 @@ static void send_game(const ClientData &data) {
     put_explosions_into_buffer(data, buffer, next_index);
     put_scores_into_buffer(data, buffer, next_index);
 
-    send_to_gui(data.gui_send_fd, buffer, next_index);
+    frame.length = next_index;
 }
 
-void send_message_to_gui(ClientData &data) {
-    ENSURE(pthread_mutex_lock(&data.lock) == 0);
-    bool is_in_lobby = data.is_in_lobby;
-    ENSURE(pthread_mutex_unlock(&data.lock) == 0);
-
-    if (is_in_lobby) {
-        send_lobby(data);
+void build_message_to_gui(const ClientData &data, GuiFrame &frame) {
+    TRACE_SPAN("build_message_to_gui");
+    if (data.is_in_lobby) {
+        build_lobby(data, frame);
     }
     else {
-        send_game(data);
+        build_game(data, frame);
+    }
+}
+
+bool send_frame_to_gui(int gui_send_fd, const GuiFrame &frame) {
+    TRACE_SPAN("send_frame_to_gui");
+    ssize_t sent_length = send_available(gui_send_fd, frame.buffer, frame.length);
+    if (sent_length < 0) {
+        return false;
+    }
+    if (sent_length != (ssize_t) frame.length) {
+        fatal("Connection with GUI failed.");
     }
+    return true;
 }
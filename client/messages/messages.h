@@ -3,23 +3,67 @@
 
 #include "../client-data/client_data.h"
 
-// Reads Hello from server. Updates [data].
-void read_hello(ClientData &data);
+#define DATAGRAM_LIMIT 65507
+#define GUI_WRONG_MSG 10
+#define GUI_NO_MSG 11
 
-// Reads message from GUI. Returns message type that is equal to message id
-// if message from gui is different from Move. Returns 2 + direction if
-// message is Move. If message is incorrect, returns GUI_WRONG_MSG.
+// Serialized message ready to be sent to GUI.
+struct GuiFrame {
+    uint8_t buffer[DATAGRAM_LIMIT];
+    size_t length = 0;
+};
+
+// Reads message from GUI without blocking. Returns message type that is equal
+// to message id if message from gui is different from Move. Returns
+// 2 + direction if message is Move. If message is incorrect, returns
+// GUI_WRONG_MSG. If there is no message to read, returns GUI_NO_MSG.
 uint8_t read_message_from_gui(const ClientData &data);
 
-// Sends message of type [message_type] to server. If message type is correct
-// and client is in lobby, sends Join.
+// Puts message of type [message_type] into [data.server_out]. If message type
+// is correct and client is in lobby, puts Join. During the game actions taken
+// in the first half of a turn (estimated from intervals between Turns) are
+// collapsed into the latest one, sent by send_pending_action() halfway
+// through the turn. Later actions are sent at once, so server still gets the
+// latest action of the turn. Action equal to the one already sent in this
+// turn is not sent again. If [data.immediate_input] is set, the first action
+// in a turn is sent at once as well.
 void send_message_to_server(ClientData &data, uint8_t message_type);
 
-// Reads message from server. Updates [data]. Returns true if client should
-// immediately send message to GUI.
-bool read_message_from_server(ClientData &data);
+// Returns time when action pending in the current turn is sent.
+LatencyClock::time_point pending_action_deadline(const ClientData &data);
+
+// Sends action pending in the current turn to server if it is time to.
+void send_pending_action(ClientData &data);
+
+// Puts Capabilities message (not part of the base protocol) with requested
+// [flags] into [data.server_out]. See common/compact.h.
+void send_capabilities(ClientData &data, uint8_t flags);
+
+// Puts Resume message (not part of the base protocol) into [data.server_out].
+// It contains [data.session_token] and the last turn received completely, if
+// client is in game.
+void send_resume(ClientData &data);
+
+// Processes all complete messages and Turn events in [data.server_in] and
+// removes them from it. Updates [data]. Returns true if GUI should be sent
+// the new state.
+bool read_messages_from_server(ClientData &data);
+
+// Processes Turns and TurnHashes in [datagram] received from server, the ones
+// following the last Turn client has. Datagram is ignored if it has old token
+// or Turn is received partially via TCP. Returns true if GUI should be sent
+// the new state.
+bool read_datagram_from_server(ClientData &data, const List<uint8_t> &datagram);
+
+// Builds datagram for server with the latest actions and the last turn
+// received completely, and puts it into [datagram].
+void build_datagram_to_server(const ClientData &data, List<uint8_t> &datagram);
+
+// Builds message for GUI with data in [data] and puts it into [frame].
+void build_message_to_gui(const ClientData &data, GuiFrame &frame);
 
-// Sends message to GUI with data in [data].
-void send_message_to_gui(ClientData &data);
+// Sends [frame] to GUI using socket [gui_send_fd] without blocking. Returns
+// false if GUI socket is not ready and sending should be retried.
+bool send_frame_to_gui(int gui_send_fd, const GuiFrame &frame);
 
 #endif // MESSAGES_H
@@ -7,30 +7,48 @@
 #include <cerrno>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <sys/un.h>
 #include <iostream>
 
-void turn_off_nagle(int socked_fd) {
+// Turns of Nagle's algorithm from TCP socket.
+static void turn_off_nagle(int socked_fd) {
     struct ip_mreq ipv{};
     CHECK_ERRNO(setsockopt(socked_fd, IPPROTO_TCP, TCP_NODELAY, (void *)&ipv, sizeof(ipv)));
 }
 
-size_t receive_message(int socket_fd, void *buffer, size_t max_length, int flags) {
+void set_non_blocking(int socket_fd) {
+    int flags = fcntl(socket_fd, F_GETFL);
+    ENSURE(flags != -1);
+    CHECK_ERRNO(fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK));
+}
+
+ssize_t receive_available(int socket_fd, void *buffer, size_t max_length) {
     errno = 0;
-    ssize_t received_length = recv(socket_fd, buffer, max_length, flags);
+    ssize_t received_length = recv(socket_fd, buffer, max_length, 0);
     if (received_length < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return -1;
+        }
+        if (errno == ECONNRESET) {
+            return 0;
+        }
         PRINT_ERRNO();
     }
-    return (size_t) received_length;
+    return received_length;
 }
 
-void send_message(int socket_fd, const void *message, size_t length, int flags) {
+ssize_t send_available(int socket_fd, const void *message, size_t length) {
     errno = 0;
-    ssize_t sent_length = send(socket_fd, message, length, flags);
+    ssize_t sent_length = send(socket_fd, message, length, MSG_NOSIGNAL);
     if (sent_length < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EPIPE || errno == ECONNRESET) {
+            return -1;
+        }
         PRINT_ERRNO();
     }
-    ENSURE(sent_length == (ssize_t) length);
+    return sent_length;
 }
 
 int connect(const std::string &host, uint16_t port, bool tcp) {
@@ -70,6 +88,72 @@ int connect(const std::string &host, uint16_t port, bool tcp) {
         return -1;
     }
 
+    if (tcp) {
+        turn_off_nagle(socket_fd);
+    }
+    return socket_fd;
+}
+
+int connect_datagram_socket(int server_fd, uint16_t port) {
+    sockaddr_storage address{};
+    auto address_length = (socklen_t) sizeof(address);
+    if (getpeername(server_fd, (sockaddr *) &address, &address_length) == -1
+        || (address.ss_family != AF_INET && address.ss_family != AF_INET6)) {
+        return -1;
+    }
+    if (address.ss_family == AF_INET) {
+        ((sockaddr_in *) &address)->sin_port = htons(port);
+    }
+    else {
+        ((sockaddr_in6 *) &address)->sin6_port = htons(port);
+    }
+
+    int socket_fd = socket(address.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (socket_fd == -1) {
+        return -1;
+    }
+    if (connect(socket_fd, (sockaddr *) &address, address_length) == -1) {
+        close(socket_fd);
+        return -1;
+    }
+
+    set_non_blocking(socket_fd);
+    return socket_fd;
+}
+
+ssize_t receive_datagram(int socket_fd, void *buffer, size_t max_length) {
+    errno = 0;
+    ssize_t received_length = recv(socket_fd, buffer, max_length, 0);
+    if (received_length < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) {
+            return -1;
+        }
+        PRINT_ERRNO();
+    }
+    return received_length;
+}
+
+void send_datagram(int socket_fd, const void *datagram, size_t length) {
+    send(socket_fd, datagram, length, MSG_NOSIGNAL);
+}
+
+int connect_local(const std::string &path) {
+    struct sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_fd == -1) {
+        return -1;
+    }
+    if (connect(socket_fd, (struct sockaddr *) &address, (socklen_t) sizeof(address)) == -1) {
+        close(socket_fd);
+        return -1;
+    }
+
     return socket_fd;
 }
 
@@ -6,20 +6,43 @@
 #include <string>
 #include <netdb.h>
 
-// Turns of Nagle's algorithm from TCP socket.
-void turn_off_nagle(int socked_fd);
+// Makes socket [socket_fd] non-blocking.
+void set_non_blocking(int socket_fd);
 
-// Receives message of max length [max_length] and puts it into [buffer].
-size_t receive_message(int socket_fd, void *buffer, size_t max_length, int flags);
+// Receives message of max length [max_length] from non-blocking socket and
+// puts it into [buffer]. Returns length of received message, 0 if connection
+// was closed or reset or -1 if there is nothing to receive.
+ssize_t receive_available(int socket_fd, void *buffer, size_t max_length);
 
-// Sends message located in [buffer] of length [length].
-void send_message(int socket_fd, const void *message, size_t length, int flags);
+// Sends as much of message located in [message] of length [length] as possible
+// using non-blocking socket. Returns number of sent bytes or -1 if nothing
+// could be sent now (also if connection was closed, receiving reports it).
+ssize_t send_available(int socket_fd, const void *message, size_t length);
 
 // Connects to (host):(port). If [tcp] is set tu true, connection uses
-// TCP protocol, otherwise it uses UDP protocol. Returns descriptor to newly
-// created socket. If connection failed, returns -1.
+// TCP protocol with Nagle's algorithm turned off, otherwise it uses UDP
+// protocol. Returns descriptor to newly created socket. If connection failed,
+// returns -1.
 int connect(const std::string &host, uint16_t port, bool tcp);
 
+// Creates non-blocking UDP socket connected to port [port] of the host
+// socket [server_fd] is connected to. Returns descriptor to newly created
+// socket. If connection failed, returns -1.
+int connect_datagram_socket(int server_fd, uint16_t port);
+
+// Receives datagram of max length [max_length] from non-blocking socket and
+// puts it into [buffer]. Returns length of received datagram or -1 if there
+// is nothing to receive (also if the last datagram sent was refused).
+ssize_t receive_datagram(int socket_fd, void *buffer, size_t max_length);
+
+// Sends datagram [datagram] of length [length] via connected socket. Datagram
+// that could not be sent is dropped, as if it was lost.
+void send_datagram(int socket_fd, const void *datagram, size_t length);
+
+// Connects to Unix domain stream socket [path]. Returns descriptor to newly
+// created socket. If connection failed, returns -1.
+int connect_local(const std::string &path);
+
 // Binds UDP socket to port [port].
 int bind_udp_socket(uint16_t port);
 
@@ -0,0 +1,110 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include "types.h"
+
+// Compact encoding of messages from server (not part of the base protocol).
+// Client asks for it with Capabilities message (client -> server id 4), server
+// answers with Capabilities message (server -> client id 6) containing accepted
+// flags. Every message sent by server after the answer uses compact encoding:
+//  - numbers other than PlayerId and TurnHash's hash are varints,
+//  - PlayerMoved contains varint v and varint w; if v is odd, robot moved by
+//    (zigzag(v >> 1), zigzag(w)) from its last position sent to client,
+//    otherwise it is placed on (v >> 1, w),
+//  - blocks in BombExploded are given as zigzag varints relative to the
+//    previous block on list (the first one relative to (0, 0)),
+//  - consecutive BlockPlaced events are replaced with BlockRuns events
+//    (id 4) containing list of runs of blocks in order of y * size_x + x,
+//    a run is pair of varints: gap from end of previous run and length,
+//  - addresses of players are binary if possible (see COMPACT_ADDRESS_*).
+
+#define CAPABILITY_COMPACT 1    // Flag of compact encoding in Capabilities.
+#define CAPABILITY_PIPELINING 2 // Flag of action pipelining in Capabilities.
+#define CAPABILITY_RESUME 4     // Flag of session resume in Capabilities.
+#define CAPABILITY_DATAGRAMS 8  // Flag of datagram transport in Capabilities.
+#define CAPABILITY_VIEW_SYNC 16 // Flag of view sync in Capabilities.
+
+// Action pipelining (not part of the base protocol). Client that got
+// CAPABILITY_PIPELINING accepted may send TaggedAction messages (client ->
+// server id 5): turn (2 bytes) followed by PlaceBomb, PlaceBlock or Move
+// message. Action is taken in the given turn of the current game, instead of
+// the next one. Server keeps a few turns of such actions per client and drops
+// actions for turns already processed or too far ahead. An action received
+// later for the same turn replaces the earlier one, as usual. TaggedAction
+// from other clients is an incorrect message.
+
+// Session resume (not part of the base protocol). Client that got
+// CAPABILITY_RESUME accepted gets Session message (server -> client id 7):
+// player id (1 byte) and token (8 bytes), when it is accepted as a player.
+// Right after Capabilities such client sends Resume message (client -> server
+// id 6): token (8 bytes, 0 if client has no session), in game flag (1 byte)
+// and the last turn client received completely (2 bytes). If token belongs to
+// a player of the current game, connection takes over the player, server sends
+// Session again and then only messages client missed: turns after the given
+// one, or GameStarted and all turns if client was in lobby. Otherwise server
+// sends the usual starting messages. Tokens are valid until the game ends.
+// Player with view sync resuming during a game gets Session and GameStarted
+// instead, and then the next Turn with everything in his view and scores so
+// far (see below).
+
+// Datagram transport (not part of the base protocol). Client that got
+// CAPABILITY_DATAGRAMS accepted gets DatagramSession message (server -> client
+// id 8): token (8 bytes) and server's UDP port (2 bytes), right after
+// Capabilities and again, with a new token, before every Turn 0. Client sends
+// datagrams from one UDP socket to that port: token (8 bytes), the last turn
+// it received completely (2 bytes, 0 in lobby), number of actions (1 byte)
+// and the actions, each being sequence number (2 bytes) followed by PlaceBomb,
+// PlaceBlock or Move message. Every datagram repeats DATAGRAM_ACTIONS latest
+// actions and client sends one when it takes an action or receives Turn.
+// Server takes each action once, as if it came via TCP. Once server got a
+// datagram, Turns other than Turn 0 go to client in datagrams: token followed
+// by all Turns (with their TurnHashes, if they are published) client has not
+// confirmed yet. If they do not fit in MAX_DATAGRAM bytes, and before
+// GameEnded, they are sent via TCP instead. Client takes every Turn once, in
+// order, whichever way it came. Such client does not get compact encoding and
+// the transport is not offered if view radius is set.
+
+// View sync (not part of the base protocol), offered if server has view radius
+// set. Player whose client got CAPABILITY_VIEW_SYNC accepted gets Turns with
+// only events around his robot. Robots and blocks destroyed in explosions he
+// did not see come in Destroyed event (id 5): list of robots, each entry adds
+// one to robot's score, and list of blocks that are gone, given as in
+// BombExploded. Nothing explodes there, so it is not drawn. After resuming,
+// Destroyed of the first Turn also lists every robot as many times as it was
+// destroyed before that Turn. Other clients, including players that did not
+// ask for it, get all events.
+
+#define DATAGRAM_ACTIONS 4 // Actions put into every datagram from client.
+#define MAX_DATAGRAM 1200  // Max length of datagram from server.
+
+#define BLOCK_RUNS 4           // Id of BlockRuns event.
+#define DESTROYED 5            // Id of Destroyed event.
+#define MAX_BLOCK_RUNS 256     // Max number of runs in one BlockRuns event.
+
+#define COMPACT_ADDRESS_STRING 0 // Tag followed by address string.
+#define COMPACT_ADDRESS_IPV6 1   // Tag followed by 16 bytes of IPv6 and port.
+#define COMPACT_ADDRESS_IPV4 2   // Tag followed by 4 bytes of IPv4 and port.
+
+#define MAX_VARINT_LENGTH 10
+
+// Puts [value] at the end of [bytes] as LEB128 varint: 7 bits per byte, the
+// highest bit set in all bytes but the last one.
+inline void put_varint(uint64_t value, List<uint8_t> &bytes) {
+    while (value >= 0x80) {
+        bytes.push_back((uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back((uint8_t) value);
+}
+
+// Maps signed [value] to unsigned one, so that small absolute values have
+// short varints.
+inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+#endif // COMPACT_H
@@ -0,0 +1,166 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Trace spans, compiled in only with ROBOTS_TRACE defined (cmake
+// -DROBOTS_TRACE=ON). Otherwise all TRACE_* macros expand to nothing.
+//
+// TRACE_SPAN(name) records time from the macro to the end of the enclosing
+// scope. Every thread writes its spans into its own ring buffer, keeping the
+// latest TRACE_BUFFER_SPANS of them. TRACE_DUMP() writes spans of all threads
+// to <program>-<pid>.trace.json in Chrome trace format (chrome://tracing or
+// ui.perfetto.dev), replacing the previous dump. Programs dump at the end of
+// every game and, after SIGUSR1, on the next TRACE_POLL().
+
+#ifdef ROBOTS_TRACE
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+
+#include "types.h"
+
+#define TRACE_BUFFER_SPANS 65536
+
+struct TraceSpanRecord {
+    const char *name;
+    uint64_t start;    // Nanoseconds of steady clock.
+    uint64_t duration; // Nanoseconds.
+};
+
+// Spans of one thread. The mutex is taken only by this thread and dumps.
+struct TraceBuffer {
+    std::mutex mutex;
+    uint32_t thread_id;
+    std::string thread_name;
+    List<TraceSpanRecord> spans = List<TraceSpanRecord>(TRACE_BUFFER_SPANS);
+    uint64_t written = 0; // Spans written so far, the next one goes to written % TRACE_BUFFER_SPANS.
+};
+
+// Buffers of all threads that recorded spans. They outlive their threads.
+struct TraceRegistry {
+    std::mutex mutex;
+    List<std::unique_ptr<TraceBuffer>> buffers;
+    std::string program = "robots";
+};
+
+inline TraceRegistry trace_registry;
+inline volatile sig_atomic_t trace_dump_requested = 0;
+
+inline uint64_t trace_now() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// Returns ring buffer of the calling thread.
+inline TraceBuffer &trace_buffer() {
+    thread_local TraceBuffer *buffer = nullptr;
+    if (buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(trace_registry.mutex);
+        trace_registry.buffers.push_back(std::make_unique<TraceBuffer>());
+        buffer = trace_registry.buffers.back().get();
+        buffer->thread_id = (uint32_t) trace_registry.buffers.size();
+    }
+    return *buffer;
+}
+
+// Records span lasting from its construction to its destruction.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name) : name(name), start(trace_now()) {}
+
+    ~TraceSpan() {
+        uint64_t end = trace_now();
+        TraceBuffer &buffer = trace_buffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.spans[buffer.written % TRACE_BUFFER_SPANS] = {name, start, end - start};
+        buffer.written++;
+    }
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    uint64_t start;
+};
+
+// Names the calling thread in dumps.
+inline void trace_thread_name(const std::string &name) {
+    TraceBuffer &buffer = trace_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.thread_name = name;
+}
+
+// Writes spans of all threads to the trace file.
+inline void trace_dump() {
+    trace_dump_requested = 0;
+    std::string path = trace_registry.program + "-" + std::to_string(getpid()) + ".trace.json";
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not write trace file %s.\n", path.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> registry_lock(trace_registry.mutex);
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (const auto &buffer : trace_registry.buffers) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        if (!buffer->thread_name.empty()) {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+                          "\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", (int) getpid(), buffer->thread_id, buffer->thread_name.c_str());
+            first = false;
+        }
+        uint64_t oldest = buffer->written > TRACE_BUFFER_SPANS ? buffer->written - TRACE_BUFFER_SPANS : 0;
+        for (uint64_t i = oldest; i < buffer->written; i++) {
+            const TraceSpanRecord &span = buffer->spans[i % TRACE_BUFFER_SPANS];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+                    first ? "" : ",\n", span.name, (double) span.start / 1e3, (double) span.duration / 1e3,
+                    (int) getpid(), buffer->thread_id);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+inline void trace_request_dump(int) {
+    trace_dump_requested = 1;
+}
+
+// Sets name of the trace file and makes SIGUSR1 request a dump.
+inline void trace_start(const char *program) {
+    trace_registry.program = program;
+    trace_thread_name("main");
+    signal(SIGUSR1, trace_request_dump);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#define TRACE_START(program) trace_start(program)
+#define TRACE_POLL()                \
+    do {                            \
+        if (trace_dump_requested) { \
+            trace_dump();           \
+        }                           \
+    } while (0)
+#define TRACE_DUMP() trace_dump()
+
+#else
+
+#define TRACE_SPAN(name)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_START(program)
+#define TRACE_POLL()
+#define TRACE_DUMP()
+
+#endif // ROBOTS_TRACE
+
+#endif // TRACE_H
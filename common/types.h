@@ -7,6 +7,7 @@
 #include <vector>
 #include <set>
 #include <deque>
+#include <memory_resource>
 
 // Definitions of some types used by server.
 
@@ -15,6 +16,11 @@ template<class T> using Set = std::set<T>;
 template<class T> using List = std::vector<T>;
 template<class T> using Deque = std::deque<T>;
 
+// Containers taking memory from resource given at construction.
+template<class K, class V> using ArenaMap = std::pmr::map<K, V>;
+template<class T> using ArenaSet = std::pmr::set<T>;
+template<class T> using ArenaList = std::pmr::vector<T>;
+
 using PlayerId = uint8_t;
 
 struct Player {
@@ -0,0 +1,36 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+#include "types.h"
+
+// Zobrist-style hashing of game state. Hash of a state is XOR of keys of
+// players' positions, blocks, bombs and non-zero scores, so it can be updated
+// incrementally after every event. Keys are computed from the element instead
+// of being stored in tables, so server and client get the same keys for boards
+// of any size. All values must be in host order.
+
+// Returns pseudo-random 64-bit key for [value] (splitmix64 finalizer).
+inline uint64_t zobrist_mix(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+
+inline uint64_t zobrist_player_key(PlayerId id, const Position &position) {
+    return zobrist_mix((1ull << 60) | ((uint64_t) id << 32) | ((uint64_t) position.x << 16) | position.y);
+}
+
+inline uint64_t zobrist_block_key(const Position &position) {
+    return zobrist_mix((2ull << 60) | ((uint64_t) position.x << 16) | position.y);
+}
+
+inline uint64_t zobrist_bomb_key(BombId id, const Position &position) {
+    return zobrist_mix((3ull << 60) | ((uint64_t) position.x << 16) | position.y) ^ zobrist_mix(id);
+}
+
+inline uint64_t zobrist_score_key(PlayerId id, Score score) {
+    return score == 0 ? 0 : zobrist_mix((4ull << 60) | ((uint64_t) id << 32) | score);
+}
+
+#endif // ZOBRIST_H
@@ -0,0 +1,209 @@
+#include "framing.h"
+#include "../../common/compact.h"
+
+#define COMPACTION_THRESHOLD 65536 // Bytes dropped from the front of buffer at once.
+
+// Reads numbers in net order from [bytes] starting at index [next]. If there
+// are not enough bytes, cursor becomes incomplete and returns zeroes.
+class Cursor {
+public:
+    Cursor(const List<uint8_t> &bytes, size_t next) : bytes(bytes), next(next) {}
+
+    bool complete() const {
+        return !incomplete;
+    }
+
+    size_t position() const {
+        return next;
+    }
+
+    void skip(uint64_t length) {
+        if (incomplete || next + length > bytes.size()) {
+            incomplete = true;
+            return;
+        }
+        next += length;
+    }
+
+    uint32_t read(size_t length) {
+        uint32_t value = 0;
+        if (incomplete || next + length > bytes.size()) {
+            incomplete = true;
+            return 0;
+        }
+        for (size_t i = 0; i < length; i++) {
+            value = value << 8 | bytes[next++];
+        }
+        return value;
+    }
+
+    void skip_string() {
+        skip(read(1));
+    }
+
+private:
+    const List<uint8_t> &bytes;
+    size_t next;
+    bool incomplete = false;
+};
+
+size_t Framer::turn_length(int32_t &message_turn) {
+    if (!in_turn) {
+        Cursor cursor(buffer, start + 1);
+        turn = (int32_t) cursor.read(2);
+        events_left = cursor.read(4);
+        if (!cursor.complete()) {
+            return 0;
+        }
+        in_turn = true;
+        next_event = cursor.position() - start;
+    }
+
+    while (events_left > 0) {
+        Cursor cursor(buffer, start + next_event);
+        switch (cursor.read(1)) {
+            case 0: // BombPlaced
+                cursor.skip(8);
+                break;
+            case 1: // BombExploded
+                cursor.skip(4);
+                cursor.skip(cursor.read(4));
+                cursor.skip(4 * (uint64_t) cursor.read(4));
+                break;
+            case 2: // PlayerMoved
+                cursor.skip(5);
+                break;
+            case 3: // BlockPlaced
+                cursor.skip(4);
+                break;
+            default:
+                if (cursor.complete()) {
+                    opaque = true;
+                }
+                return 0;
+        }
+        if (!cursor.complete()) {
+            return 0;
+        }
+        next_event = cursor.position() - start;
+        events_left--;
+    }
+
+    in_turn = false;
+    message_turn = turn;
+    return next_event;
+}
+
+size_t Framer::message_length(int32_t &message_turn) {
+    uint8_t type = buffer[start];
+    message_turn = -1;
+    if (from_server && type == 3) {
+        return turn_length(message_turn);
+    }
+
+    Cursor cursor(buffer, start + 1);
+    if (from_server) {
+        switch (type) {
+            case 0: // Hello
+                cursor.skip_string();
+                cursor.skip(11);
+                break;
+            case 1: // AcceptedPlayer
+                cursor.skip(1);
+                cursor.skip_string();
+                cursor.skip_string();
+                break;
+            case 2: { // GameStarted
+                uint32_t players = cursor.read(4);
+                for (uint32_t i = 0; i < players && cursor.complete(); i++) {
+                    cursor.skip(1);
+                    cursor.skip_string();
+                    cursor.skip_string();
+                }
+                break;
+            }
+            case 4: // GameEnded
+                cursor.skip(5 * (uint64_t) cursor.read(4));
+                break;
+            case 5: // TurnHash
+                message_turn = (int32_t) cursor.read(2);
+                cursor.skip(8);
+                break;
+            case 6: // Capabilities
+                cursor.skip(1);
+                break;
+            case 7: // Session
+                cursor.skip(9);
+                break;
+            case 8: // DatagramSession
+                cursor.skip(10);
+                break;
+            default:
+                opaque = true;
+                return 0;
+        }
+    }
+    else {
+        switch (type) {
+            case 0: // Join
+                cursor.skip_string();
+                break;
+            case 1: // PlaceBomb
+            case 2: // PlaceBlock
+                break;
+            case 3: // Move
+            case 4: // Capabilities
+                cursor.skip(1);
+                break;
+            case 5: // TaggedAction
+                cursor.skip(2);
+                cursor.skip(cursor.read(1) == 3 ? 1 : 0);
+                break;
+            case 6: // Resume
+                cursor.skip(11);
+                break;
+            default:
+                opaque = true;
+                return 0;
+        }
+    }
+
+    return cursor.complete() ? cursor.position() - start : 0;
+}
+
+void Framer::feed(const uint8_t *bytes, size_t length, const MessageHandler &handler) {
+    buffer.insert(buffer.end(), bytes, bytes + length);
+
+    while (!opaque && start < buffer.size()) {
+        FramedMessage message{};
+        message.type = buffer[start];
+        message.length = message_length(message.turn);
+        if (message.length == 0) {
+            break;
+        }
+
+        message.end_offset = buffer_offset + start + message.length;
+        handler(message, buffer.data() + start);
+        if (from_server && message.type == 6 && (buffer[start + 1] & CAPABILITY_COMPACT)) {
+            opaque = true; // Messages after it are in compact encoding.
+        }
+        start += message.length;
+    }
+}
+
+void Framer::take_ready(List<uint8_t> &ready) {
+    size_t limit = buffer.size();
+    if (!opaque && start < buffer.size() && from_server && buffer[start] == 8) {
+        limit = start;
+    }
+    ready.insert(ready.end(), buffer.begin() + (ssize_t) forwarded, buffer.begin() + (ssize_t) limit);
+    forwarded = limit;
+
+    size_t unneeded = opaque ? forwarded : std::min(start, forwarded);
+    if (unneeded >= COMPACTION_THRESHOLD || unneeded == buffer.size()) {
+        buffer.erase(buffer.begin(), buffer.begin() + (ssize_t) unneeded);
+        buffer_offset += unneeded;
+        start -= std::min(start, unneeded);
+        forwarded -= unneeded;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <functional>
+
+#include "../../common/types.h"
+
+// Message found in a stream.
+struct FramedMessage {
+    uint8_t type;
+    int32_t turn;        // Turn of Turn and TurnHash messages, -1 for others.
+    size_t length;
+    uint64_t end_offset; // Offset of the byte after message in the stream.
+};
+
+// Called for every complete message with its bytes, which can be changed
+// before they are forwarded.
+using MessageHandler = std::function<void(const FramedMessage &message, uint8_t *bytes)>;
+
+// Splits stream sent by server or client into messages of the base protocol
+// and its extensions (see common/compact.h). Once server turns on compact
+// encoding or a message cannot be parsed, stream becomes opaque: bytes are
+// forwarded without finding messages. Turn's events are parsed as they come,
+// so big Turns are not parsed again with every chunk.
+class Framer {
+public:
+    explicit Framer(bool from_server) : from_server(from_server) {}
+
+    // Appends [length] bytes [bytes] of stream and calls [handler] for every
+    // message completed by them.
+    void feed(const uint8_t *bytes, size_t length, const MessageHandler &handler);
+
+    // Moves bytes that can be forwarded to the other side into [ready]. All
+    // bytes received are ready, except incomplete DatagramSession, which may
+    // be changed by handler.
+    void take_ready(List<uint8_t> &ready);
+
+    bool is_opaque() const {
+        return opaque;
+    }
+
+private:
+    bool from_server;
+    bool opaque = false;
+    List<uint8_t> buffer;       // Bytes not forwarded or not parsed yet.
+    uint64_t buffer_offset = 0; // Offset of buffer's first byte in the stream.
+    size_t start = 0;           // Index of incomplete message in [buffer].
+    size_t forwarded = 0;       // Number of bytes at the front of [buffer] that were forwarded.
+
+    // Turn being parsed, indices are relative to [start].
+    bool in_turn = false;
+    int32_t turn = -1;
+    uint32_t events_left = 0;
+    size_t next_event = 0;
+
+    // Returns length of message at [start] if it is complete, 0 otherwise.
+    // Makes stream opaque if message is incorrect.
+    size_t message_length(int32_t &message_turn);
+
+    // Same as above, for Turn message.
+    size_t turn_length(int32_t &message_turn);
+};
+
+#endif // FRAMING_H
@@ -0,0 +1,56 @@
+#include "link.h"
+
+#include <algorithm>
+
+bool Link::lost() {
+    return parameters.loss > 0 && std::uniform_int_distribution<uint32_t>(0, 999)(random) < parameters.loss;
+}
+
+void Link::push_packet(const uint8_t *bytes, size_t length, uint64_t now, bool is_lost) {
+    uint64_t start = std::max(now, line_free);
+    line_free = parameters.bandwidth == 0 ? start : start + length * 1000000 / parameters.bandwidth;
+    sent_bytes += length;
+
+    uint64_t delay = (uint64_t) parameters.latency * 1000;
+    if (parameters.jitter > 0) {
+        delay += std::uniform_int_distribution<uint64_t>(0, (uint64_t) parameters.jitter * 1000)(random);
+    }
+    if (is_lost) {
+        delay += (uint64_t) parameters.retransmission * 1000;
+    }
+
+    Packet packet{now, line_free + delay, sent_bytes, List<uint8_t>(bytes, bytes + length)};
+    if (ordered && !packets.empty()) {
+        packet.delivery = std::max(packet.delivery, packets.back().delivery);
+    }
+    auto place = std::upper_bound(packets.begin(), packets.end(), packet.delivery,
+                                  [](uint64_t delivery, const Packet &other) { return delivery < other.delivery; });
+    packets.insert(place, std::move(packet));
+    queued += length;
+}
+
+bool Link::push(const uint8_t *bytes, size_t length, uint64_t now) {
+    if (!ordered) {
+        if (lost()) {
+            return false;
+        }
+        push_packet(bytes, length, now, false);
+        return true;
+    }
+
+    for (size_t begin = 0; begin < length; begin += SEGMENT_SIZE) {
+        push_packet(bytes + begin, std::min((size_t) SEGMENT_SIZE, length - begin), now, lost());
+    }
+    return true;
+}
+
+uint64_t Link::next_delivery() const {
+    return packets.empty() ? UINT64_MAX : packets.front().delivery;
+}
+
+Packet Link::pop() {
+    Packet packet = std::move(packets.front());
+    packets.pop_front();
+    queued -= packet.bytes.size();
+    return packet;
+}
@@ -0,0 +1,70 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <random>
+
+#include "../../common/types.h"
+
+#define SEGMENT_SIZE 1448 // Bytes of TCP stream that are delayed and lost together.
+
+// Conditions of emulated network, the same for every link.
+struct LinkParameters {
+    uint32_t latency = 0;          // One-way delay in milliseconds.
+    uint32_t jitter = 0;           // Max random delay added to latency, in milliseconds.
+    uint64_t bandwidth = 0;        // Bytes per second, 0 - no limit.
+    uint16_t loss = 0;             // Lost packets per mille.
+    uint32_t retransmission = 200; // Milliseconds it takes to send lost TCP segment again.
+};
+
+// Bytes travelling through a link.
+struct Packet {
+    uint64_t arrival;    // Microsecond when proxy received them.
+    uint64_t delivery;   // Microsecond when they leave the link.
+    uint64_t end_offset; // Offset of the byte after them in the stream (TCP only).
+    List<uint8_t> bytes;
+};
+
+// One direction of emulated network path. Packets are sent one after another
+// with [bandwidth], then each one is delayed by latency and jitter. Ordered
+// link (TCP) is split into segments; lost segment is not dropped, but delayed
+// by retransmission, holding back the segments after it. Unordered link (UDP)
+// drops lost datagrams and lets jitter reorder the others.
+class Link {
+public:
+    Link(const LinkParameters &parameters, std::minstd_rand &random, bool ordered)
+            : parameters(parameters), random(random), ordered(ordered) {}
+
+    // Puts [bytes] received at microsecond [now] into the link. Returns false
+    // if datagram was lost.
+    bool push(const uint8_t *bytes, size_t length, uint64_t now);
+
+    // Returns microsecond when the next packet leaves the link, UINT64_MAX if
+    // the link is empty.
+    uint64_t next_delivery() const;
+
+    // Takes the next packet out of the link. Link must not be empty.
+    Packet pop();
+
+    // Returns number of bytes in the link.
+    size_t queued_bytes() const {
+        return queued;
+    }
+
+private:
+    const LinkParameters &parameters;
+    std::minstd_rand &random;
+    bool ordered;
+    Deque<Packet> packets;  // Sorted by delivery.
+    size_t queued = 0;
+    uint64_t line_free = 0; // Microsecond when the link ends sending the last packet.
+    uint64_t sent_bytes = 0;
+
+    // Returns true with probability of loss.
+    bool lost();
+
+    // Queues packet of [length] bytes starting at [bytes], delayed by
+    // retransmission if [is_lost].
+    void push_packet(const uint8_t *bytes, size_t length, uint64_t now, bool is_lost);
+};
+
+#endif // LINK_H
@@ -0,0 +1,117 @@
+// Proxy between clients and robots-server emulating slow or lossy network
+// (see proxy.h).
+
+#include "proxy/proxy.h"
+#include "../common/err.h"
+
+#include <cstring>
+#include <iostream>
+
+static void print_help() {
+    std::cout << "USAGE:\n"
+              << "    ./robots-netem -p <port> -s <server_address:server_port> [-u <datagram_port>]"
+              << " [-l <latency>] [-j <jitter>] [-b <bandwidth>] [-x <loss>] [-r <retransmission>]"
+              << " [-q <queue_limit>] [-o <log_file>] [-g <seed>]"
+              << "\n\nOPTIONS\n"
+              << "    -b <bandwidth> (optional, bytes per second in each direction, default 0 - no limit)\n"
+              << "    -g <seed> (optional, default 0)\n"
+              << "    -h <help>\n"
+              << "    -j <jitter> (optional, max random delay added to latency in milliseconds, default 0)\n"
+              << "    -l <latency> (optional, one-way delay in milliseconds, default 0)\n"
+              << "    -o <log_file> (optional, CSV with timing of every message)\n"
+              << "    -p <port>\n"
+              << "    -q <queue_limit> (optional, bytes queued in one direction after which proxy stops"
+              << " reading, default " << DEFAULT_QUEUE_LIMIT << ")\n"
+              << "    -r <retransmission> (optional, milliseconds a lost TCP segment is delayed by,"
+              << " default 200)\n"
+              << "    -s <server_address:server_port>\n"
+              << "    -u <datagram_port> (optional, UDP port relaying datagrams of clients,"
+              << " server has to be run with -a)\n"
+              << "    -x <loss> (optional, lost packets per mille, default 0)\n";
+}
+
+// Returns value of number [str] not greater than [max_value]. Calls fatal()
+// if it is incorrect.
+static uint64_t read_number(const char *option, const char *str, uint64_t max_value) {
+    errno = 0;
+    char *end_ptr;
+    auto value = (uint64_t) strtoull(str, &end_ptr, 10);
+    if (*end_ptr != '\0' || errno != 0 || value > max_value) {
+        fatal("Incorrect value %s of parameter %s.", str, option);
+    }
+    return value;
+}
+
+// Reads address in (address):(port) format into [parameters]. Calls fatal()
+// if it is incorrect.
+static void read_server_address(const char *str, ProxyParameters &parameters) {
+    std::string address_and_port = str;
+    size_t divider = address_and_port.find_last_of(':');
+    if (divider == std::string::npos || divider == 0) {
+        fatal("Incorrect server address %s.", str);
+    }
+    size_t address_border = address_and_port[0] == '[' && address_and_port[divider - 1] == ']' ? 1 : 0;
+    parameters.server_address = address_and_port.substr(address_border, divider - 2 * address_border);
+    parameters.server_port = (uint16_t) read_number("-s", str + divider + 1, UINT16_MAX);
+}
+
+int main(int argc, char *argv[]) {
+    ProxyParameters parameters;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            print_help();
+            return 0;
+        }
+    }
+    if (argc % 2 == 0) {
+        fatal("Every parameter must have value.");
+    }
+    for (int i = 1; i < argc; i += 2) {
+        if (strcmp(argv[i], "-p") == 0) {
+            parameters.port = (uint16_t) read_number(argv[i], argv[i + 1], UINT16_MAX);
+            parameters.read_port = true;
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            read_server_address(argv[i + 1], parameters);
+        }
+        else if (strcmp(argv[i], "-u") == 0) {
+            parameters.datagram_port = (uint16_t) read_number(argv[i], argv[i + 1], UINT16_MAX);
+        }
+        else if (strcmp(argv[i], "-l") == 0) {
+            parameters.link.latency = (uint32_t) read_number(argv[i], argv[i + 1], UINT16_MAX);
+        }
+        else if (strcmp(argv[i], "-j") == 0) {
+            parameters.link.jitter = (uint32_t) read_number(argv[i], argv[i + 1], UINT16_MAX);
+        }
+        else if (strcmp(argv[i], "-b") == 0) {
+            parameters.link.bandwidth = read_number(argv[i], argv[i + 1], UINT32_MAX);
+        }
+        else if (strcmp(argv[i], "-x") == 0) {
+            parameters.link.loss = (uint16_t) read_number(argv[i], argv[i + 1], 1000);
+        }
+        else if (strcmp(argv[i], "-r") == 0) {
+            parameters.link.retransmission = (uint32_t) read_number(argv[i], argv[i + 1], UINT16_MAX);
+        }
+        else if (strcmp(argv[i], "-q") == 0) {
+            parameters.queue_limit = read_number(argv[i], argv[i + 1], UINT32_MAX);
+        }
+        else if (strcmp(argv[i], "-o") == 0) {
+            parameters.log_file = argv[i + 1];
+        }
+        else if (strcmp(argv[i], "-g") == 0) {
+            parameters.seed = (uint32_t) read_number(argv[i], argv[i + 1], UINT32_MAX);
+        }
+        else {
+            fatal("Incorrect parameter %s.", argv[i]);
+        }
+    }
+    if (!parameters.read_port || parameters.server_address.empty()) {
+        fatal("Parameters -p and -s are necessary.");
+    }
+    if (parameters.queue_limit == 0) {
+        fatal("Queue limit must be positive.");
+    }
+
+    run_proxy(parameters);
+}
@@ -0,0 +1,564 @@
+#include "proxy.h"
+#include "../framing/framing.h"
+#include "../../common/err.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <memory>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define QUEUE_LENGTH 25
+#define READ_CHUNK 65536
+#define MAX_DATAGRAM_LENGTH 65536
+#define TOKEN_LENGTH 8
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) {
+    stopping = 1;
+}
+
+// Returns microseconds since the first call.
+static uint64_t now_micros() {
+    static const auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+// Message read by proxy, waiting to be delivered.
+struct PendingMessage {
+    FramedMessage message;
+    uint64_t arrival;
+};
+
+// One direction of proxied TCP connection.
+struct Direction {
+    Link link;
+    Framer framer;
+    List<uint8_t> out;              // Bytes that left the link, waiting to be written.
+    Deque<PendingMessage> messages; // Messages read, but not delivered yet.
+    bool closed = false;            // Source closed its side.
+    bool shut = false;              // Destination was told about it.
+    uint64_t bytes = 0;
+
+    Direction(const LinkParameters &parameters, std::minstd_rand &random, bool from_server)
+            : link(parameters, random, true), framer(from_server) {}
+
+    // Returns true if nothing is waiting to be delivered.
+    bool drained() const {
+        return link.queued_bytes() == 0 && out.empty();
+    }
+};
+
+// Timing of Turn sent to client.
+struct TurnTiming {
+    uint64_t arrival;       // Microsecond of reading it first time.
+    bool delivered = false; // It left a link towards client.
+};
+
+// Client connected to server through proxy.
+struct Connection {
+    size_t id;
+    int client_fd;
+    int server_fd;
+    uint64_t accepted; // Microsecond of accepting client.
+    Direction down;    // Server to client.
+    Direction up;      // Client to server.
+    bool failed = false;
+
+    // Datagrams, used if server gave client a datagram session.
+    int datagram_fd = -1; // UDP socket connected to server's UDP port.
+    uint64_t token = 0;
+    sockaddr_in6 client_datagram_address{};
+    bool has_client_datagram_address = false;
+    Link datagrams_down;
+    Link datagrams_up;
+    uint64_t datagrams_lost = 0;
+
+    // Statistics of Turns delivered to client.
+    List<TurnTiming> turn_timings; // Of every Turn of the current game read so far.
+    uint64_t first_turn = 0; // Microsecond of delivering the first one, 0 - none yet.
+    uint64_t turns = 0;
+    uint64_t turn_delay_sum = 0;
+    uint64_t turn_delay_max = 0;
+
+    Connection(size_t id, int client_fd, int server_fd, const LinkParameters &parameters,
+               std::minstd_rand &random)
+            : id(id), client_fd(client_fd), server_fd(server_fd), accepted(now_micros()),
+              down(parameters, random, true), up(parameters, random, false),
+              datagrams_down(parameters, random, false), datagrams_up(parameters, random, false) {}
+};
+
+// State of the proxy.
+struct Proxy {
+    const ProxyParameters &parameters;
+    std::minstd_rand random;
+    int listener_fd;
+    int datagram_fd = -1; // UDP socket clients send datagrams to.
+    sockaddr_storage server_address{};
+    socklen_t server_address_length = 0;
+    List<std::unique_ptr<Connection>> connections;
+    size_t next_id = 1;
+    FILE *log = nullptr;
+
+    explicit Proxy(const ProxyParameters &parameters) : parameters(parameters), random(parameters.seed) {}
+};
+
+static void set_non_blocking(int socket_fd) {
+    int flags = fcntl(socket_fd, F_GETFL);
+    ENSURE(flags != -1);
+    CHECK_ERRNO(fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK));
+}
+
+// Binds socket of [type] to [port] on all addresses, IPv4 and IPv6.
+static int bind_socket(int type, uint16_t port) {
+    int socket_fd = socket(AF_INET6, type, 0);
+    ENSURE(socket_fd > 0);
+    int on = 1;
+    CHECK_ERRNO(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)));
+
+    sockaddr_in6 address{};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = IN6ADDR_ANY_INIT;
+    address.sin6_port = htons(port);
+    CHECK_ERRNO(bind(socket_fd, (sockaddr *) &address, (socklen_t) sizeof(address)));
+    set_non_blocking(socket_fd);
+    return socket_fd;
+}
+
+// Finds address of server given in parameters. Calls fatal() if it is incorrect.
+static void resolve_server(Proxy &proxy) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result;
+    if (getaddrinfo(proxy.parameters.server_address.c_str(), std::to_string(proxy.parameters.server_port).c_str(),
+                    &hints, &result) != 0) {
+        fatal("Could not resolve server address %s.", proxy.parameters.server_address.c_str());
+    }
+    memcpy(&proxy.server_address, result->ai_addr, result->ai_addrlen);
+    proxy.server_address_length = result->ai_addrlen;
+    freeaddrinfo(result);
+}
+
+// Returns server's address with port changed to [port].
+static sockaddr_storage server_address_with_port(const Proxy &proxy, uint16_t port) {
+    sockaddr_storage address = proxy.server_address;
+    if (address.ss_family == AF_INET) {
+        ((sockaddr_in *) &address)->sin_port = htons(port);
+    }
+    else {
+        ((sockaddr_in6 *) &address)->sin6_port = htons(port);
+    }
+    return address;
+}
+
+// Writes timing of [length] bytes of [type] (-1 for datagram) to log.
+// [delivery] equal to 0 means they were lost.
+static void log_message(Proxy &proxy, const Connection &connection, bool down, bool datagram,
+                        int type, int32_t turn, size_t length, uint64_t arrival, uint64_t delivery) {
+    if (proxy.log == nullptr) {
+        return;
+    }
+    fprintf(proxy.log, "%zu,%s,%s,%d,%d,%zu,%lu,", connection.id, down ? "down" : "up",
+            datagram ? "udp" : "tcp", type, (int) turn, length, arrival);
+    if (delivery == 0) {
+        fprintf(proxy.log, "lost\n");
+    }
+    else {
+        fprintf(proxy.log, "%lu\n", delivery);
+    }
+}
+
+// Remembers that Turn [turn] was read from server at [now], unless it was
+// read before. Server sends Turns again until client confirms them.
+static void record_turn(Connection &connection, int32_t turn, uint64_t now) {
+    if (turn == 0) {
+        connection.turn_timings.clear();
+    }
+    if ((size_t) turn == connection.turn_timings.size()) {
+        connection.turn_timings.push_back({now});
+    }
+}
+
+// Counts Turn [turn] as delivered to client at [delivery], unless it was
+// delivered before. Delay is counted from the first time it was read.
+static void count_turn(Connection &connection, int32_t turn, uint64_t delivery) {
+    if ((size_t) turn >= connection.turn_timings.size() || connection.turn_timings[(size_t) turn].delivered) {
+        return;
+    }
+    connection.turn_timings[(size_t) turn].delivered = true;
+    uint64_t arrival = connection.turn_timings[(size_t) turn].arrival;
+    if (connection.first_turn == 0) {
+        connection.first_turn = delivery;
+    }
+    connection.turns++;
+    connection.turn_delay_sum += delivery - arrival;
+    connection.turn_delay_max = std::max(connection.turn_delay_max, delivery - arrival);
+}
+
+// Prints statistics of [connection] to stderr.
+static void print_statistics(const Connection &connection) {
+    double seconds = (double) (now_micros() - connection.accepted) / 1e6;
+    fprintf(stderr, "Connection %zu: %.1f s, %lu bytes down, %lu bytes up, ", connection.id, seconds,
+            connection.down.bytes, connection.up.bytes);
+    if (connection.turns == 0) {
+        fprintf(stderr, "no Turns");
+    }
+    else {
+        fprintf(stderr, "first Turn after %.1f ms, %lu Turns delayed by %.1f ms on average, %.1f ms at most",
+                (double) (connection.first_turn - connection.accepted) / 1e3, connection.turns,
+                (double) connection.turn_delay_sum / (double) connection.turns / 1e3,
+                (double) connection.turn_delay_max / 1e3);
+    }
+    fprintf(stderr, ", %lu datagrams lost.\n", connection.datagrams_lost);
+}
+
+// Handles message of TCP stream from server. DatagramSession is changed, so
+// that client sends datagrams to proxy.
+static void handle_server_message(Proxy &proxy, Connection &connection, const FramedMessage &message,
+                                  uint8_t *bytes) {
+    uint64_t now = now_micros();
+    connection.down.messages.push_back({message, now});
+    if (message.type == 3) {
+        record_turn(connection, message.turn, now);
+    }
+    if (message.type != 8 || proxy.datagram_fd == -1) {
+        return;
+    }
+
+    connection.token = 0;
+    for (size_t i = 1; i <= TOKEN_LENGTH; i++) {
+        connection.token = connection.token << 8 | bytes[i];
+    }
+    auto server_port = (uint16_t) (bytes[9] << 8 | bytes[10]);
+    bytes[9] = (uint8_t) (proxy.parameters.datagram_port >> 8);
+    bytes[10] = (uint8_t) proxy.parameters.datagram_port;
+
+    if (connection.datagram_fd == -1) {
+        sockaddr_storage address = server_address_with_port(proxy, server_port);
+        connection.datagram_fd = socket(address.ss_family, SOCK_DGRAM, 0);
+        ENSURE(connection.datagram_fd != -1);
+        CHECK_ERRNO(connect(connection.datagram_fd, (sockaddr *) &address, proxy.server_address_length));
+        set_non_blocking(connection.datagram_fd);
+    }
+}
+
+// Reads bytes available on [fd] into [direction]. Returns false if source
+// closed its side.
+static bool read_stream(Proxy &proxy, Connection &connection, Direction &direction, int fd) {
+    static uint8_t buffer[READ_CHUNK];
+    static List<uint8_t> ready;
+
+    ssize_t length = read(fd, buffer, READ_CHUNK);
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    if (length <= 0) {
+        return false;
+    }
+
+    uint64_t now = now_micros();
+    direction.bytes += (uint64_t) length;
+    direction.framer.feed(buffer, (size_t) length, [&](const FramedMessage &message, uint8_t *bytes) {
+        if (&direction == &connection.down) {
+            handle_server_message(proxy, connection, message, bytes);
+        }
+        else {
+            direction.messages.push_back({message, now});
+        }
+    });
+    ready.clear();
+    direction.framer.take_ready(ready);
+    direction.link.push(ready.data(), ready.size(), now);
+    return true;
+}
+
+// Writes bytes that left the link of [direction] to [fd].
+static void write_stream(Connection &connection, Direction &direction, int fd) {
+    if (direction.out.empty()) {
+        return;
+    }
+    ssize_t length = send(fd, direction.out.data(), direction.out.size(), MSG_NOSIGNAL);
+    if (length < 0) {
+        connection.failed = errno != EAGAIN && errno != EWOULDBLOCK;
+        return;
+    }
+    direction.out.erase(direction.out.begin(), direction.out.begin() + length);
+}
+
+// Moves packets that left the link of [direction] to its output and logs
+// messages completed by them.
+static void deliver_stream(Proxy &proxy, Connection &connection, Direction &direction, uint64_t now) {
+    bool down = &direction == &connection.down;
+    while (direction.link.next_delivery() <= now) {
+        Packet packet = direction.link.pop();
+        direction.out.insert(direction.out.end(), packet.bytes.begin(), packet.bytes.end());
+        while (!direction.messages.empty() && direction.messages.front().message.end_offset <= packet.end_offset) {
+            const PendingMessage &pending = direction.messages.front();
+            log_message(proxy, connection, down, false, pending.message.type, pending.message.turn,
+                        pending.message.length, pending.arrival, now);
+            if (down && pending.message.type == 3) {
+                count_turn(connection, pending.message.turn, now);
+            }
+            direction.messages.pop_front();
+        }
+    }
+}
+
+// Returns Turns in datagram [bytes] from server.
+static List<int32_t> turns_in_datagram(const uint8_t *bytes, size_t length) {
+    List<int32_t> turns;
+    if (length > TOKEN_LENGTH) {
+        Framer framer(true);
+        framer.feed(bytes + TOKEN_LENGTH, length - TOKEN_LENGTH, [&](const FramedMessage &message, uint8_t *) {
+            if (message.type == 3) {
+                turns.push_back(message.turn);
+            }
+        });
+    }
+    return turns;
+}
+
+// Receives datagrams from clients and puts them into links of their connections.
+static void read_client_datagrams(Proxy &proxy) {
+    static uint8_t buffer[MAX_DATAGRAM_LENGTH];
+
+    while (true) {
+        sockaddr_in6 address{};
+        auto address_length = (socklen_t) sizeof(address);
+        ssize_t length = recvfrom(proxy.datagram_fd, buffer, sizeof(buffer), 0, (sockaddr *) &address,
+                                  &address_length);
+        if (length < 0) {
+            return;
+        }
+        if (length < TOKEN_LENGTH) {
+            continue;
+        }
+
+        uint64_t token = 0;
+        for (size_t i = 0; i < TOKEN_LENGTH; i++) {
+            token = token << 8 | buffer[i];
+        }
+        for (auto &connection : proxy.connections) {
+            if (connection->token == token && connection->datagram_fd != -1) {
+                connection->client_datagram_address = address;
+                connection->has_client_datagram_address = true;
+                uint64_t now = now_micros();
+                if (!connection->datagrams_up.push(buffer, (size_t) length, now)) {
+                    connection->datagrams_lost++;
+                    log_message(proxy, *connection, false, true, -1, -1, (size_t) length, now, 0);
+                }
+                break;
+            }
+        }
+    }
+}
+
+// Receives datagrams from server to client of [connection].
+static void read_server_datagrams(Proxy &proxy, Connection &connection) {
+    static uint8_t buffer[MAX_DATAGRAM_LENGTH];
+
+    ssize_t length;
+    while ((length = recv(connection.datagram_fd, buffer, sizeof(buffer), 0)) >= 0) {
+        uint64_t now = now_micros();
+        List<int32_t> turns = turns_in_datagram(buffer, (size_t) length);
+        for (int32_t turn : turns) {
+            record_turn(connection, turn, now);
+        }
+        if (!connection.datagrams_down.push(buffer, (size_t) length, now)) {
+            connection.datagrams_lost++;
+            log_message(proxy, connection, true, true, -1, turns.empty() ? -1 : turns.back(), (size_t) length,
+                        now, 0);
+        }
+    }
+}
+
+// Sends datagrams of [connection] that left their links.
+static void deliver_datagrams(Proxy &proxy, Connection &connection, uint64_t now) {
+    while (connection.datagrams_up.next_delivery() <= now) {
+        Packet packet = connection.datagrams_up.pop();
+        send(connection.datagram_fd, packet.bytes.data(), packet.bytes.size(), 0);
+        log_message(proxy, connection, false, true, -1, -1, packet.bytes.size(), packet.arrival, now);
+    }
+    while (connection.datagrams_down.next_delivery() <= now) {
+        Packet packet = connection.datagrams_down.pop();
+        if (connection.has_client_datagram_address) {
+            sendto(proxy.datagram_fd, packet.bytes.data(), packet.bytes.size(), 0,
+                   (sockaddr *) &connection.client_datagram_address,
+                   (socklen_t) sizeof(connection.client_datagram_address));
+        }
+        List<int32_t> turns = turns_in_datagram(packet.bytes.data(), packet.bytes.size());
+        log_message(proxy, connection, true, true, -1, turns.empty() ? -1 : turns.back(), packet.bytes.size(),
+                    packet.arrival, now);
+        for (int32_t turn : turns) {
+            count_turn(connection, turn, now);
+        }
+    }
+}
+
+// Accepts new client and connects it to server.
+static void accept_client(Proxy &proxy) {
+    int client_fd = accept(proxy.listener_fd, nullptr, nullptr);
+    if (client_fd == -1) {
+        return;
+    }
+
+    int server_fd = socket(proxy.server_address.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    ENSURE(server_fd != -1);
+    if (connect(server_fd, (sockaddr *) &proxy.server_address, proxy.server_address_length) == -1) {
+        fprintf(stderr, "Could not connect to server.\n");
+        close(server_fd);
+        close(client_fd);
+        return;
+    }
+
+    int on = 1;
+    for (int fd : {client_fd, server_fd}) {
+        set_non_blocking(fd);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    proxy.connections.push_back(std::make_unique<Connection>(proxy.next_id++, client_fd, server_fd,
+                                                             proxy.parameters.link, proxy.random));
+}
+
+// Tells the other side that source of [direction] closed its side, once
+// everything it sent is delivered.
+static void shut_if_drained(Direction &direction, int destination_fd) {
+    if (direction.closed && !direction.shut && direction.drained()) {
+        shutdown(destination_fd, SHUT_WR);
+        direction.shut = true;
+    }
+}
+
+// Returns microseconds until the next packet leaves any link, -1 if there are
+// no packets.
+static int64_t time_to_next_delivery(const Proxy &proxy, uint64_t now) {
+    uint64_t next = UINT64_MAX;
+    for (const auto &connection : proxy.connections) {
+        next = std::min({next, connection->down.link.next_delivery(), connection->up.link.next_delivery(),
+                         connection->datagrams_down.next_delivery(), connection->datagrams_up.next_delivery()});
+    }
+    if (next == UINT64_MAX) {
+        return -1;
+    }
+    return next <= now ? 0 : (int64_t) (next - now);
+}
+
+// Adds descriptors of [connection] to [descriptors].
+static void watch_connection(const Proxy &proxy, const Connection &connection, List<pollfd> &descriptors) {
+    auto watch = [&](int fd, const Direction &source, const Direction &destination) {
+        short events = 0;
+        if (!source.closed && source.link.queued_bytes() + source.out.size() < proxy.parameters.queue_limit) {
+            events |= POLLIN;
+        }
+        if (!destination.out.empty()) {
+            events |= POLLOUT;
+        }
+        descriptors.push_back({fd, events, 0});
+    };
+    watch(connection.client_fd, connection.up, connection.down);
+    watch(connection.server_fd, connection.down, connection.up);
+    descriptors.push_back({connection.datagram_fd, POLLIN, 0});
+}
+
+// Handles events of [connection] reported in [descriptors] and delivers what
+// left its links.
+static void serve_connection(Proxy &proxy, Connection &connection, const pollfd *descriptors) {
+    if ((descriptors[0].revents & (POLLIN | POLLHUP | POLLERR)) && !connection.up.closed) {
+        connection.up.closed = !read_stream(proxy, connection, connection.up, connection.client_fd);
+    }
+    if ((descriptors[1].revents & (POLLIN | POLLHUP | POLLERR)) && !connection.down.closed) {
+        connection.down.closed = !read_stream(proxy, connection, connection.down, connection.server_fd);
+    }
+    if (connection.datagram_fd != -1 && (descriptors[2].revents & POLLIN)) {
+        read_server_datagrams(proxy, connection);
+    }
+
+    uint64_t now = now_micros();
+    deliver_stream(proxy, connection, connection.down, now);
+    deliver_stream(proxy, connection, connection.up, now);
+    deliver_datagrams(proxy, connection, now);
+    write_stream(connection, connection.down, connection.client_fd);
+    write_stream(connection, connection.up, connection.server_fd);
+    shut_if_drained(connection.down, connection.client_fd);
+    shut_if_drained(connection.up, connection.server_fd);
+}
+
+// Closes sockets of [connection] and prints its statistics.
+static void close_connection(Connection &connection) {
+    print_statistics(connection);
+    close(connection.client_fd);
+    close(connection.server_fd);
+    if (connection.datagram_fd != -1) {
+        close(connection.datagram_fd);
+    }
+}
+
+void run_proxy(const ProxyParameters &parameters) {
+    Proxy proxy(parameters);
+    resolve_server(proxy);
+    proxy.listener_fd = bind_socket(SOCK_STREAM, parameters.port);
+    CHECK_ERRNO(listen(proxy.listener_fd, QUEUE_LENGTH));
+    if (parameters.datagram_port != 0) {
+        proxy.datagram_fd = bind_socket(SOCK_DGRAM, parameters.datagram_port);
+    }
+    if (!parameters.log_file.empty()) {
+        proxy.log = fopen(parameters.log_file.c_str(), "w");
+        if (proxy.log == nullptr) {
+            fatal("Could not create log file %s.", parameters.log_file.c_str());
+        }
+        fprintf(proxy.log, "connection,direction,transport,type,turn,bytes,arrival_us,delivery_us\n");
+    }
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+
+    List<pollfd> descriptors;
+    while (!stopping) {
+        descriptors.clear();
+        descriptors.push_back({proxy.listener_fd, POLLIN, 0});
+        descriptors.push_back({proxy.datagram_fd, POLLIN, 0});
+        for (const auto &connection : proxy.connections) {
+            watch_connection(proxy, *connection, descriptors);
+        }
+
+        int64_t wait = time_to_next_delivery(proxy, now_micros());
+        timespec timeout{wait / 1000000, wait % 1000000 * 1000};
+        if (ppoll(descriptors.data(), descriptors.size(), wait < 0 ? nullptr : &timeout, nullptr) == -1) {
+            continue; // Interrupted, stopping is checked.
+        }
+
+        if (descriptors[0].revents & POLLIN) {
+            accept_client(proxy);
+        }
+        if (proxy.datagram_fd != -1 && (descriptors[1].revents & POLLIN)) {
+            read_client_datagrams(proxy);
+        }
+        for (size_t i = 0; i < proxy.connections.size(); i++) {
+            // Connections accepted in this iteration have no descriptors yet.
+            if (2 + 3 * i < descriptors.size()) {
+                serve_connection(proxy, *proxy.connections[i], descriptors.data() + 2 + 3 * i);
+            }
+        }
+
+        std::erase_if(proxy.connections, [](std::unique_ptr<Connection> &connection) {
+            if (connection->failed || (connection->up.shut && connection->down.shut)) {
+                close_connection(*connection);
+                return true;
+            }
+            return false;
+        });
+    }
+
+    for (const auto &connection : proxy.connections) {
+        close_connection(*connection);
+    }
+    if (proxy.log != nullptr) {
+        fclose(proxy.log);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <string>
+
+#include "../link/link.h"
+
+#define DEFAULT_QUEUE_LIMIT 65536
+
+// Struct containing information from command line parameters.
+struct ProxyParameters {
+    uint16_t port = 0;        // TCP port clients connect to.
+    bool read_port = false;
+    std::string server_address;
+    uint16_t server_port = 0;
+    uint16_t datagram_port = 0; // UDP port relaying datagrams of clients, 0 - they are not relayed.
+    size_t queue_limit = DEFAULT_QUEUE_LIMIT; // Bytes in one direction after which proxy stops reading.
+    std::string log_file;     // Timing of every message is written there if set.
+    uint32_t seed = 0;
+    LinkParameters link;
+};
+
+// Accepts clients on [parameters.port] and connects each one to the server.
+// Bytes in both directions, and datagrams if [parameters.datagram_port] is set,
+// go through emulated links. Returns after SIGINT or SIGTERM, printing
+// statistics of connections that are still open.
+void run_proxy(const ProxyParameters &parameters);
+
+#endif // PROXY_H
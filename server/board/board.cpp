@@ -0,0 +1,72 @@
+#include "board.h"
+
+#define INITIAL_CHUNKS 16
+
+ChunkedBoard::ChunkedBoard() : chunks(INITIAL_CHUNKS, Chunk{EMPTY, 0}) {}
+
+void ChunkedBoard::place_block(const Position &position) {
+    if (2 * (used + 1) > chunks.size()) {
+        grow();
+    }
+
+    uint32_t key = chunk_key(position);
+    size_t i = home_slot(key);
+    while (chunks[i].key != EMPTY && chunks[i].key != key) {
+        i = (i + 1) & (chunks.size() - 1);
+    }
+
+    if (chunks[i].key == EMPTY) {
+        chunks[i] = Chunk{key, 0};
+        used++;
+    }
+    chunks[i].bits |= 1ull << bit(position);
+}
+
+void ChunkedBoard::remove_block(const Position &position) {
+    uint32_t key = chunk_key(position);
+    size_t mask = chunks.size() - 1;
+    size_t i = home_slot(key);
+    while (chunks[i].key != key) {
+        if (chunks[i].key == EMPTY) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    chunks[i].bits &= ~(1ull << bit(position));
+    if (chunks[i].bits != 0) {
+        return;
+    }
+
+    // Chunk is empty, remove it. Following chunks are shifted back so that
+    // searching never stops at a free slot too early.
+    for (size_t j = (i + 1) & mask; chunks[j].key != EMPTY; j = (j + 1) & mask) {
+        size_t home = home_slot(chunks[j].key);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            chunks[i] = chunks[j];
+            i = j;
+        }
+    }
+    chunks[i].key = EMPTY;
+    used--;
+}
+
+void ChunkedBoard::clear() {
+    List<Chunk>(INITIAL_CHUNKS, Chunk{EMPTY, 0}).swap(chunks);
+    used = 0;
+}
+
+void ChunkedBoard::grow() {
+    List<Chunk> old_chunks(2 * chunks.size(), Chunk{EMPTY, 0});
+    old_chunks.swap(chunks);
+
+    for (const Chunk &chunk : old_chunks) {
+        if (chunk.key != EMPTY) {
+            size_t i = home_slot(chunk.key);
+            while (chunks[i].key != EMPTY) {
+                i = (i + 1) & (chunks.size() - 1);
+            }
+            chunks[i] = chunk;
+        }
+    }
+}
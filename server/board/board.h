@@ -0,0 +1,235 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <array>
+#include <cstdint>
+
+#include "../../common/types.h"
+
+#define SET_NODE_OVERHEAD 32 // Bytes of red-black tree node besides its value.
+
+// Boards store blocks and know the board's dimensions. Game engine is
+// templated on the board type, so every board must provide:
+//   - resize(size_x, size_y),
+//   - contains_block(position), place_block(position), remove_block(position),
+//   - clear(),
+//   - memory_usage() - number of bytes keeping blocks,
+//   - step(position, direction) - moves [position] by one tile towards
+//     [direction] (0 - up, 1 - right, 2 - down, 3 - left) and returns false
+//     if it would leave the board.
+
+// Moves [position] by one tile towards [direction] on board of size
+// [size_x]x[size_y]. Returns false if it would leave the board.
+constexpr bool step_on_board(Position &position, uint8_t direction, uint16_t size_x, uint16_t size_y) {
+    switch (direction) {
+        case 0:
+            if (position.y + 1 >= size_y) {
+                return false;
+            }
+            position.y++;
+            return true;
+        case 1:
+            if (position.x + 1 >= size_x) {
+                return false;
+            }
+            position.x++;
+            return true;
+        case 2:
+            if (position.y == 0) {
+                return false;
+            }
+            position.y--;
+            return true;
+        default:
+            if (position.x == 0) {
+                return false;
+            }
+            position.x--;
+            return true;
+    }
+}
+
+// Board of any size. Blocks are kept in a set. It is the simplest board,
+// kept as a reference for the other ones.
+class GenericBoard {
+public:
+    static constexpr bool fits([[maybe_unused]] uint16_t size_x, [[maybe_unused]] uint16_t size_y) {
+        return true;
+    }
+
+    void resize(uint16_t new_size_x, uint16_t new_size_y) {
+        size_x = new_size_x;
+        size_y = new_size_y;
+    }
+
+    bool contains_block(const Position &position) const {
+        return blocks.contains(position);
+    }
+
+    void place_block(const Position &position) {
+        blocks.emplace(position);
+    }
+
+    void remove_block(const Position &position) {
+        blocks.erase(position);
+    }
+
+    void clear() {
+        blocks.clear();
+    }
+
+    bool step(Position &position, uint8_t direction) const {
+        return step_on_board(position, direction, size_x, size_y);
+    }
+
+    // Returns approximate number of bytes used by set's nodes.
+    size_t memory_usage() const {
+        return blocks.size() * (SET_NODE_OVERHEAD + sizeof(Position));
+    }
+
+private:
+    uint16_t size_x = 0;
+    uint16_t size_y = 0;
+    Set<Position> blocks;
+};
+
+// Board not larger than [SIDE]x[SIDE]. Blocks are kept in a fixed-size bitboard,
+// tile (x, y) is the bit number x * SIDE + y.
+template<uint16_t SIDE>
+class BitBoard {
+    static_assert(SIDE > 0 && SIDE * SIDE % 64 == 0, "BitBoard must consist of whole words.");
+
+public:
+    static constexpr bool fits(uint16_t size_x, uint16_t size_y) {
+        return size_x <= SIDE && size_y <= SIDE;
+    }
+
+    constexpr void resize(uint16_t new_size_x, uint16_t new_size_y) {
+        size_x = new_size_x;
+        size_y = new_size_y;
+    }
+
+    constexpr bool contains_block(const Position &position) const {
+        size_t bit = index(position);
+        return (words[bit / 64] >> (bit % 64)) & 1;
+    }
+
+    constexpr void place_block(const Position &position) {
+        size_t bit = index(position);
+        words[bit / 64] |= 1ull << (bit % 64);
+    }
+
+    constexpr void remove_block(const Position &position) {
+        size_t bit = index(position);
+        words[bit / 64] &= ~(1ull << (bit % 64));
+    }
+
+    constexpr void clear() {
+        words.fill(0);
+    }
+
+    constexpr bool step(Position &position, uint8_t direction) const {
+        return step_on_board(position, direction, size_x, size_y);
+    }
+
+    constexpr size_t memory_usage() const {
+        return sizeof(words);
+    }
+
+private:
+    static constexpr size_t WORDS = SIDE * SIDE / 64;
+
+    std::array<uint64_t, WORDS> words{};
+    uint16_t size_x = SIDE;
+    uint16_t size_y = SIDE;
+
+    static constexpr size_t index(const Position &position) {
+        return (size_t) position.x * SIDE + position.y;
+    }
+};
+
+// Board used when both dimensions do not exceed 16.
+using SmallBoard = BitBoard<16>;
+
+// Board of any size for sparse and very large maps. Board is divided into 8x8
+// chunks, each kept as a 64-bit bitmap. Only chunks containing blocks are
+// stored, in an open addressing hash table, so memory scales with occupied
+// area instead of board's size.
+class ChunkedBoard {
+public:
+    static constexpr bool fits([[maybe_unused]] uint16_t size_x, [[maybe_unused]] uint16_t size_y) {
+        return true;
+    }
+
+    ChunkedBoard();
+
+    void resize(uint16_t new_size_x, uint16_t new_size_y) {
+        size_x = new_size_x;
+        size_y = new_size_y;
+    }
+
+    bool contains_block(const Position &position) const {
+        const Chunk *chunk = find(chunk_key(position));
+        return chunk != nullptr && ((chunk->bits >> bit(position)) & 1);
+    }
+
+    void place_block(const Position &position);
+
+    void remove_block(const Position &position);
+
+    void clear();
+
+    bool step(Position &position, uint8_t direction) const {
+        return step_on_board(position, direction, size_x, size_y);
+    }
+
+    // Returns number of stored chunks.
+    size_t chunks_count() const {
+        return used;
+    }
+
+    // Returns number of bytes used by hash table.
+    size_t memory_usage() const {
+        return chunks.capacity() * sizeof(Chunk);
+    }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    struct Chunk {
+        uint32_t key;  // (x / 8) << 16 | (y / 8), or EMPTY if slot is free
+        uint64_t bits; // tile (x, y) is the bit number (x % 8) * 8 + y % 8
+    };
+
+    uint16_t size_x = 0;
+    uint16_t size_y = 0;
+    List<Chunk> chunks; // Size is a power of two, at most half of slots is used.
+    size_t used = 0;
+
+    static uint32_t chunk_key(const Position &position) {
+        return (uint32_t) (position.x >> 3) << 16 | (uint32_t) (position.y >> 3);
+    }
+
+    static uint32_t bit(const Position &position) {
+        return (uint32_t) (position.x & 7) * 8 + (position.y & 7);
+    }
+
+    // Returns index of slot where chunk with [key] should be placed.
+    size_t home_slot(uint32_t key) const {
+        return (size_t) ((key * 0x9e3779b97f4a7c15ull) >> 32) & (chunks.size() - 1);
+    }
+
+    const Chunk *find(uint32_t key) const {
+        for (size_t i = home_slot(key); chunks[i].key != EMPTY; i = (i + 1) & (chunks.size() - 1)) {
+            if (chunks[i].key == key) {
+                return &chunks[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // Doubles number of slots.
+    void grow();
+};
+
+#endif // BOARD_H
@@ -0,0 +1,200 @@
+#include "game_state.h"
+#include "../../common/zobrist.h"
+
+#include <algorithm>
+
+template<class Board>
+GameState<Board>::GameState(const ServerParameters &parameters, const ServerData &data)
+        : size_x(parameters.size_x), size_y(parameters.size_y), explosion_radius(parameters.explosion_radius),
+          bomb_timer(parameters.bomb_timer), current_turn(data.turn), state_hash(data.state_hash),
+          random(data.random), positions(parameters.players_count, Position(0, 0)),
+          scores(parameters.players_count, 0), disconnected_players(parameters.players_count, false),
+          next_bomb_id(data.next_bomb_id), blocks(data.board<Board>()),
+          robots_destroyed(parameters.players_count, false) {
+    for (const auto &[id, position] : data.player_positions) {
+        positions[id] = position;
+    }
+    for (const auto &[id, score] : data.scores) {
+        if (id < parameters.players_count) {
+            scores[id] = score;
+        }
+    }
+    for (PlayerId id : data.disconnected_players) {
+        disconnected_players[id] = true;
+    }
+    bombs_list.assign(data.bombs.begin(), data.bombs.end());
+}
+
+template<class Board>
+void GameState<Board>::explode(const Position &bomb_position) {
+    for (uint8_t direction = 0; direction < 4; direction++) {
+        Position explosion_position = bomb_position;
+        for (uint16_t i = 0; i <= explosion_radius; i++) {
+            for (size_t id = 0; id < positions.size(); id++) {
+                if (positions[id] == explosion_position) {
+                    robots_destroyed[id] = true;
+                }
+            }
+            if (blocks.contains_block(explosion_position)) {
+                blocks_destroyed.push_back(explosion_position);
+                break;
+            }
+            if (!blocks.step(explosion_position, direction)) {
+                break;
+            }
+        }
+    }
+}
+
+template<class Board>
+void GameState<Board>::remove_exploded_bombs() {
+    // Logged from the last one, so undoing them in reverse order puts every
+    // bomb back on its index.
+    for (size_t i = bombs_list.size(); i-- > 0;) {
+        if (bombs_list[i].second.timer == 0) {
+            const auto &[id, bomb] = bombs_list[i];
+            state_hash ^= zobrist_bomb_key(id, bomb.position);
+            changes.push_back(Change{BOMB_REMOVED, 0, bomb.position, (uint32_t) i, id, bomb});
+        }
+    }
+    std::erase_if(bombs_list, [](const std::pair<BombId, Bomb> &bomb) { return bomb.second.timer == 0; });
+}
+
+template<class Board>
+void GameState<Board>::move_player(PlayerId id, const Position &position) {
+    changes.push_back(Change{PLAYER_MOVED, id, positions[id], 0, 0, Bomb()});
+    state_hash ^= zobrist_player_key(id, positions[id]) ^ zobrist_player_key(id, position);
+    positions[id] = position;
+}
+
+template<class Board>
+void GameState<Board>::place_block(const Position &position) {
+    changes.push_back(Change{BLOCK_PLACED, 0, position, 0, 0, Bomb()});
+    blocks.place_block(position);
+    state_hash ^= zobrist_block_key(position);
+}
+
+template<class Board>
+uint32_t GameState<Board>::step(const List<uint8_t> &actions) {
+    turn_starts.push_back(TurnStart{state_hash, random});
+    changes.push_back(Change{TURN_STARTED, 0, Position(0, 0), 0, 0, Bomb()});
+    current_turn++;
+    uint32_t events = 0;
+
+    // Explosions see the world from the start of the turn.
+    std::fill(robots_destroyed.begin(), robots_destroyed.end(), false);
+    blocks_destroyed.clear();
+    for (auto &[id, bomb] : bombs_list) {
+        bomb.timer--;
+        if (bomb.timer == 0) {
+            explode(bomb.position);
+            events++;
+        }
+    }
+    remove_exploded_bombs();
+
+    std::sort(blocks_destroyed.begin(), blocks_destroyed.end());
+    blocks_destroyed.erase(std::unique(blocks_destroyed.begin(), blocks_destroyed.end()), blocks_destroyed.end());
+    for (const Position &position : blocks_destroyed) {
+        changes.push_back(Change{BLOCK_REMOVED, 0, position, 0, 0, Bomb()});
+        blocks.remove_block(position);
+        state_hash ^= zobrist_block_key(position);
+    }
+
+    for (size_t id = 0; id < positions.size(); id++) {
+        uint8_t action = actions[id];
+        if (robots_destroyed[id]) {
+            uint16_t x = (uint16_t) (random() % size_x);
+            uint16_t y = (uint16_t) (random() % size_y);
+            move_player((PlayerId) id, Position(x, y));
+            changes.push_back(Change{SCORE_INCREASED, (PlayerId) id, Position(0, 0), 0, 0, Bomb()});
+            state_hash ^= zobrist_score_key((PlayerId) id, scores[id]);
+            scores[id]++;
+            state_hash ^= zobrist_score_key((PlayerId) id, scores[id]);
+            events++;
+        }
+        else if (disconnected_players[id]) {
+            continue;
+        }
+        else if (action == PLACE_BOMB) {
+            changes.push_back(Change{BOMB_PLACED, 0, Position(0, 0), 0, 0, Bomb()});
+            bombs_list.emplace_back(next_bomb_id, Bomb(positions[id], bomb_timer));
+            state_hash ^= zobrist_bomb_key(next_bomb_id, positions[id]);
+            next_bomb_id++;
+            events++;
+        }
+        else if (action == PLACE_BLOCK && !blocks.contains_block(positions[id])) {
+            place_block(positions[id]);
+            events++;
+        }
+        else if (action != NO_MSG && action != JOIN) {
+            Position position = positions[id];
+            if (blocks.step(position, (uint8_t) (action - MOVE)) && !blocks.contains_block(position)) {
+                move_player((PlayerId) id, position);
+                events++;
+            }
+        }
+    }
+
+    return events;
+}
+
+template<class Board>
+void GameState<Board>::undo(const Change &change) {
+    switch (change.type) {
+        case TURN_STARTED:
+            for (auto &bomb : bombs_list) {
+                bomb.second.timer++;
+            }
+            current_turn--;
+            state_hash = turn_starts.back().hash;
+            random = turn_starts.back().random;
+            turn_starts.pop_back();
+            break;
+        case BOMB_PLACED:
+            bombs_list.pop_back();
+            next_bomb_id--;
+            break;
+        case BOMB_REMOVED:
+            bombs_list.emplace(bombs_list.begin() + change.index, change.bomb_id, change.bomb);
+            break;
+        case BLOCK_PLACED:
+            blocks.remove_block(change.position);
+            break;
+        case BLOCK_REMOVED:
+            blocks.place_block(change.position);
+            break;
+        case PLAYER_MOVED:
+            positions[change.player] = change.position;
+            break;
+        case SCORE_INCREASED:
+            scores[change.player]--;
+            break;
+    }
+}
+
+template<class Board>
+void GameState<Board>::restore(Snapshot snapshot) {
+    // The hash is restored with the turn, changes within it need not touch it.
+    while (changes.size() > snapshot) {
+        undo(changes.back());
+        changes.pop_back();
+    }
+}
+
+template<class Board>
+void GameState<Board>::clear_history() {
+    changes.clear();
+    turn_starts.clear();
+}
+
+template<class Board>
+size_t GameState<Board>::memory_usage() const {
+    return sizeof(GameState) + blocks.memory_usage() + positions.capacity() * sizeof(Position)
+           + scores.capacity() * sizeof(Score) + bombs_list.capacity() * sizeof(std::pair<BombId, Bomb>)
+           + changes.capacity() * sizeof(Change) + turn_starts.capacity() * sizeof(TurnStart);
+}
+
+template class GameState<GenericBoard>;
+template class GameState<SmallBoard>;
+template class GameState<ChunkedBoard>;
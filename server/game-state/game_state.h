@@ -0,0 +1,139 @@
+#ifndef GAME_STATE_H
+#define GAME_STATE_H
+
+#include "../server-data/server_data.h"
+
+// State of one game reduced to what rules need: robots, scores, blocks and
+// bombs, without clients and messages. Used by bots searching ahead.
+//
+// step() plays one turn exactly as build_turn() does, including positions of
+// respawned robots drawn from the game's random generator and the state hash.
+// Every change it makes is recorded in an undo log, so restore() goes back to
+// any snapshot() in time proportional to the changes made since. Copying the
+// state clones it together with its board and log, which is cheap only for
+// SmallBoard.
+template<class Board>
+class GameState {
+public:
+    // Number of changes recorded so far, the state can be restored to it.
+    using Snapshot = size_t;
+
+    // Takes state of the game in [data], played with [parameters], after its
+    // last Turn.
+    GameState(const ServerParameters &parameters, const ServerData &data);
+
+    // Plays the next turn in which player with id i takes action [actions][i]
+    // (PLACE_BOMB, PLACE_BLOCK, MOVE + direction or NO_MSG). Returns number of
+    // events of the Turn, as in the Turn message.
+    uint32_t step(const List<uint8_t> &actions);
+
+    Snapshot snapshot() const {
+        return changes.size();
+    }
+
+    // Undoes turns played since [snapshot] was taken.
+    void restore(Snapshot snapshot);
+
+    // Forgets the undo log, states before can no longer be restored.
+    void clear_history();
+
+    uint16_t turn() const {
+        return current_turn;
+    }
+
+    uint64_t hash() const {
+        return state_hash;
+    }
+
+    uint8_t players_count() const {
+        return (uint8_t) positions.size();
+    }
+
+    const Position &position(PlayerId id) const {
+        return positions[id];
+    }
+
+    Score score(PlayerId id) const {
+        return scores[id];
+    }
+
+    bool disconnected(PlayerId id) const {
+        return disconnected_players[id];
+    }
+
+    // Bombs on board, in order of ids.
+    const List<std::pair<BombId, Bomb>> &bombs() const {
+        return bombs_list;
+    }
+
+    const Board &board() const {
+        return blocks;
+    }
+
+    // Returns approximate number of bytes copied when state is cloned.
+    size_t memory_usage() const;
+
+private:
+    enum ChangeType : uint8_t {
+        TURN_STARTED,   // Timers went down, hash and random generator changed.
+        BOMB_PLACED,    // Bomb was appended.
+        BOMB_REMOVED,   // Bomb [bomb_id] was removed from [index].
+        BLOCK_PLACED,   // Block on [position] was placed.
+        BLOCK_REMOVED,  // Block on [position] was removed.
+        PLAYER_MOVED,   // Robot [player] left [position].
+        SCORE_INCREASED // Score of [player] went up.
+    };
+
+    struct Change {
+        ChangeType type;
+        PlayerId player;
+        Position position;
+        uint32_t index;
+        BombId bomb_id;
+        Bomb bomb;
+    };
+
+    // State of turn before TURN_STARTED, kept apart because it is bigger than
+    // other changes.
+    struct TurnStart {
+        uint64_t hash;
+        std::minstd_rand random;
+    };
+
+    uint16_t size_x;
+    uint16_t size_y;
+    uint16_t explosion_radius;
+    uint16_t bomb_timer;
+
+    uint16_t current_turn;
+    uint64_t state_hash;
+    std::minstd_rand random;
+    List<Position> positions;
+    List<Score> scores;
+    List<bool> disconnected_players;
+    List<std::pair<BombId, Bomb>> bombs_list;
+    BombId next_bomb_id;
+    Board blocks;
+
+    List<Change> changes;
+    List<TurnStart> turn_starts;
+
+    // Scratch of step(), not part of the state.
+    List<bool> robots_destroyed;
+    List<Position> blocks_destroyed;
+
+    // Marks robots and blocks destroyed by explosion of bomb on [bomb_position]
+    // in [robots_destroyed] and [blocks_destroyed].
+    void explode(const Position &bomb_position);
+
+    // Removes bombs whose timers reached zero.
+    void remove_exploded_bombs();
+
+    void move_player(PlayerId id, const Position &position);
+
+    void place_block(const Position &position);
+
+    void undo(const Change &change);
+};
+
+#endif // GAME_STATE_H
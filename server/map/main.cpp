@@ -0,0 +1,92 @@
+// Generates map files for robots-server (see map.h).
+
+#include "map.h"
+#include "../board/board.h"
+#include "../../common/err.h"
+
+#include <cstring>
+#include <iostream>
+
+static void print_help() {
+    std::cout << "USAGE:\n"
+              << "    ./robots-map -x <size_x> -y <size_y> -k <blocks> -o <map_file> [-s <seed>]"
+              << "\n\nOPTIONS\n"
+              << "    -h <help>\n"
+              << "    -k <blocks> (exact number of distinct blocks)\n"
+              << "    -o <map_file>\n"
+              << "    -s <seed> (optional, default 0)\n"
+              << "    -x <size_x>\n"
+              << "    -y <size_y>\n";
+}
+
+// Returns value of number [str] not greater than [max_value]. Calls fatal()
+// if it is incorrect.
+static uint64_t read_number(const char *option, const char *str, uint64_t max_value) {
+    errno = 0;
+    char *end_ptr;
+    auto value = (uint64_t) strtoull(str, &end_ptr, 10);
+    if (*end_ptr != '\0' || errno != 0 || value > max_value) {
+        fatal("Incorrect value %s of parameter %s.", str, option);
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t size_x = 0;
+    uint64_t size_y = 0;
+    uint64_t blocks_count = 0;
+    bool read_blocks_count = false;
+    uint64_t seed = 0;
+    std::string path;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0) {
+            print_help();
+            return 0;
+        }
+    }
+    if (argc % 2 == 0) {
+        fatal("Every parameter must have value.");
+    }
+    for (int i = 1; i < argc; i += 2) {
+        if (strcmp(argv[i], "-x") == 0) {
+            size_x = read_number(argv[i], argv[i + 1], UINT16_MAX);
+        }
+        else if (strcmp(argv[i], "-y") == 0) {
+            size_y = read_number(argv[i], argv[i + 1], UINT16_MAX);
+        }
+        else if (strcmp(argv[i], "-k") == 0) {
+            blocks_count = read_number(argv[i], argv[i + 1], UINT32_MAX);
+            read_blocks_count = true;
+        }
+        else if (strcmp(argv[i], "-s") == 0) {
+            seed = read_number(argv[i], argv[i + 1], UINT32_MAX);
+        }
+        else if (strcmp(argv[i], "-o") == 0) {
+            path = argv[i + 1];
+        }
+        else {
+            fatal("Incorrect parameter %s.", argv[i]);
+        }
+    }
+    if (size_x == 0 || size_y == 0 || !read_blocks_count || path.empty()) {
+        fatal("Parameters -x, -y, -k and -o are necessary.");
+    }
+    if (blocks_count > size_x * size_y) {
+        fatal("Board %dx%d cannot contain %lu blocks.", (int) size_x, (int) size_y, blocks_count);
+    }
+
+    ChunkedBoard board;
+    board.resize((uint16_t) size_x, (uint16_t) size_y);
+    std::minstd_rand random((uint32_t) seed);
+    List<Position> blocks;
+    blocks.reserve(blocks_count);
+    sample_positions(blocks_count, (uint16_t) size_x, (uint16_t) size_y, random,
+                     [&](const Position &position) { return board.contains_block(position); },
+                     [&](const Position &position) {
+                         board.place_block(position);
+                         blocks.push_back(position);
+                     });
+
+    save_map_file(path, (uint16_t) size_x, (uint16_t) size_y, blocks);
+}
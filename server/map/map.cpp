@@ -0,0 +1,79 @@
+#include "map.h"
+#include "../../common/err.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MapFile load_map_file(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        fatal("Could not open map file %s.", path.c_str());
+    }
+
+    struct stat file_stat{};
+    CHECK_ERRNO(fstat(fd, &file_stat));
+    auto length = (size_t) file_stat.st_size;
+    if (length < MAP_HEADER_LENGTH) {
+        fatal("Map file %s is too short.", path.c_str());
+    }
+
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        fatal("Could not map file %s.", path.c_str());
+    }
+    close(fd);
+
+    auto bytes = (const uint8_t *) mapping;
+    if (memcmp(bytes, MAP_MAGIC, MAP_MAGIC_LENGTH) != 0) {
+        fatal("File %s is not a map file.", path.c_str());
+    }
+
+    MapFile map;
+    map.size_x = (uint16_t) (bytes[8] << 8 | bytes[9]);
+    map.size_y = (uint16_t) (bytes[10] << 8 | bytes[11]);
+    map.blocks_count = (uint32_t) bytes[12] << 24 | (uint32_t) bytes[13] << 16
+                       | (uint32_t) bytes[14] << 8 | bytes[15];
+    map.blocks = bytes + MAP_HEADER_LENGTH;
+    if (length != MAP_HEADER_LENGTH + 4 * (size_t) map.blocks_count) {
+        fatal("Map file %s has incorrect length.", path.c_str());
+    }
+
+    for (uint32_t i = 0; i < map.blocks_count; i++) {
+        Position position = map.block(i);
+        if (position.x >= map.size_x || position.y >= map.size_y) {
+            fatal("Block (%d, %d) in map file %s is outside of the board.",
+                  (int) position.x, (int) position.y, path.c_str());
+        }
+    }
+    madvise(mapping, length, MADV_WILLNEED);
+
+    return map;
+}
+
+void save_map_file(const std::string &path, uint16_t size_x, uint16_t size_y, const List<Position> &blocks) {
+    List<uint8_t> bytes(MAP_MAGIC, MAP_MAGIC + MAP_MAGIC_LENGTH);
+    auto put_uint16 = [&bytes](uint16_t value) {
+        bytes.push_back((uint8_t) (value >> 8));
+        bytes.push_back((uint8_t) value);
+    };
+
+    put_uint16(size_x);
+    put_uint16(size_y);
+    put_uint16((uint16_t) (blocks.size() >> 16));
+    put_uint16((uint16_t) blocks.size());
+    for (const Position &block : blocks) {
+        put_uint16(block.x);
+        put_uint16(block.y);
+    }
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        fatal("Could not create map file %s.", path.c_str());
+    }
+    if (fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size() || fclose(file) != 0) {
+        fatal("Could not write map file %s.", path.c_str());
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <random>
+#include <string>
+
+#include "../../common/types.h"
+
+// Map file is a binary file consisting of a 16-byte header: magic "RBMAP001",
+// size_x (2 bytes), size_y (2 bytes), number of blocks (4 bytes), followed by
+// positions of blocks (x and y, 2 bytes each). All numbers are in net order,
+// so blocks are stored exactly as in BlockPlaced events.
+
+#define MAP_MAGIC "RBMAP001"
+#define MAP_MAGIC_LENGTH 8
+#define MAP_HEADER_LENGTH 16
+
+// Map file mapped into memory.
+struct MapFile {
+    uint16_t size_x = 0;
+    uint16_t size_y = 0;
+    uint32_t blocks_count = 0;
+    const uint8_t *blocks = nullptr; // Positions of blocks, nullptr if no map is loaded.
+
+    // Returns position of block number [i].
+    Position block(uint32_t i) const {
+        const uint8_t *bytes = blocks + 4 * (size_t) i;
+        return Position((uint16_t) (bytes[0] << 8 | bytes[1]), (uint16_t) (bytes[2] << 8 | bytes[3]));
+    }
+};
+
+// Maps map file [path] into memory and returns it. Calls fatal() if file is
+// not a correct map. File stays mapped until the process ends.
+MapFile load_map_file(const std::string &path);
+
+// Saves map of size [size_x]x[size_y] with blocks [blocks] to file [path].
+// Calls fatal() on failure.
+void save_map_file(const std::string &path, uint16_t size_x, uint16_t size_y, const List<Position> &blocks);
+
+// Chooses exactly [count] distinct positions on board of size [size_x]x[size_y]
+// uniformly at random (Floyd's algorithm) and calls [place] for each of them.
+// [contains] tells if position was already chosen, it must see positions
+// passed to [place]. Draws [count] numbers from [random], whatever the density
+// of the board. [count] must not exceed number of tiles.
+template<class Contains, class Place>
+void sample_positions(uint64_t count, uint16_t size_x, uint16_t size_y, std::minstd_rand &random,
+                      Contains contains, Place place) {
+    uint64_t tiles = (uint64_t) size_x * size_y;
+    auto position_of = [size_x](uint64_t index) {
+        return Position((uint16_t) (index % size_x), (uint16_t) (index / size_x));
+    };
+
+    for (uint64_t j = tiles - count; j < tiles; j++) {
+        Position position = position_of(std::uniform_int_distribution<uint64_t>(0, j)(random));
+        if (contains(position)) {
+            position = position_of(j); // Tile j could not be chosen before.
+        }
+        place(position);
+    }
+}
+
+#endif // MAP_H
@@ -0,0 +1,55 @@
+#include "memory.h"
+
+#include <algorithm>
+
+static const char *const SUBSYSTEM_NAMES[MEMORY_SUBSYSTEMS] = {"game", "turn", "replay", "input", "output"};
+
+void *CountingResource::do_allocate(size_t bytes, size_t alignment) {
+    void *pointer = upstream->allocate(bytes, alignment);
+    current_bytes += bytes;
+    peak_bytes = std::max(peak_bytes, current_bytes);
+    allocations_count++;
+    return pointer;
+}
+
+void CountingResource::do_deallocate(void *pointer, size_t bytes, size_t alignment) {
+    upstream->deallocate(pointer, bytes, alignment);
+    current_bytes -= bytes;
+}
+
+void MemoryAccounting::update(MemorySubsystem subsystem, size_t current, size_t peak, uint64_t allocations) {
+    MemoryUsage &usage = usages[subsystem];
+    usage.current = current;
+    usage.peak = std::max({usage.peak, peak, current});
+    usage.allocations = allocations;
+    total_peak = std::max(total_peak, total());
+}
+
+size_t MemoryAccounting::total() const {
+    size_t bytes = 0;
+    for (const MemoryUsage &usage : usages) {
+        bytes += usage.current;
+    }
+    return bytes;
+}
+
+void MemoryAccounting::reset_peaks() {
+    for (MemoryUsage &usage : usages) {
+        usage.peak = usage.current;
+    }
+    total_peak = total();
+}
+
+void MemoryAccounting::report(FILE *file, uint16_t turn) const {
+    fprintf(file, "Memory in turn %d: total %.1f KiB (peak %.1f KiB)", (int) turn, (double) total() / 1024,
+            (double) total_peak / 1024);
+    for (size_t i = 0; i < MEMORY_SUBSYSTEMS; i++) {
+        fprintf(file, ", %s %.1f KiB (peak %.1f KiB", SUBSYSTEM_NAMES[i], (double) usages[i].current / 1024,
+                (double) usages[i].peak / 1024);
+        if (usages[i].allocations > 0) {
+            fprintf(file, ", %lu allocations", usages[i].allocations);
+        }
+        fprintf(file, ")");
+    }
+    fprintf(file, ".\n");
+}
@@ -0,0 +1,94 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <cstdio>
+#include <memory_resource>
+
+#include "../../common/types.h"
+
+// Parts of server whose memory is accounted.
+enum MemorySubsystem {
+    MEMORY_GAME,   // State living as long as the game: board, bombs, known bombs.
+    MEMORY_TURN,   // State built in every turn: turn memory and Turn being built.
+    MEMORY_REPLAY, // Messages kept for clients that connect late or resume.
+    MEMORY_INPUT,  // Bytes received from clients and not processed yet.
+    MEMORY_OUTPUT, // Messages queued for send threads, counted for every client.
+    MEMORY_SUBSYSTEMS
+};
+
+// Memory resource taking memory from [upstream] and counting it. It is used
+// by containers directly or as upstream of pool resources. Not thread-safe.
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+            : upstream(upstream) {}
+
+    // Returns number of bytes taken and not returned.
+    size_t current() const {
+        return current_bytes;
+    }
+
+    // Returns the highest number of bytes taken at once since the last
+    // reset_peak().
+    size_t peak() const {
+        return peak_bytes;
+    }
+
+    // Returns number of allocations made so far.
+    uint64_t allocations() const {
+        return allocations_count;
+    }
+
+    void reset_peak() {
+        peak_bytes = current_bytes;
+    }
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void *pointer, size_t bytes, size_t alignment) override;
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource *upstream;
+    size_t current_bytes = 0;
+    size_t peak_bytes = 0;
+    uint64_t allocations_count = 0;
+};
+
+// Memory used by one subsystem.
+struct MemoryUsage {
+    size_t current = 0;
+    size_t peak = 0;        // Since the start of the game.
+    uint64_t allocations = 0;
+};
+
+// Memory used by server's subsystems, updated at turn boundaries.
+class MemoryAccounting {
+public:
+    // Sets memory used by [subsystem] to [current] bytes, at most [peak] bytes
+    // since the last update, in [allocations] allocations since the start.
+    void update(MemorySubsystem subsystem, size_t current, size_t peak, uint64_t allocations);
+
+    const MemoryUsage &usage(MemorySubsystem subsystem) const {
+        return usages[subsystem];
+    }
+
+    // Returns bytes used by all subsystems.
+    size_t total() const;
+
+    // Starts measuring peaks of a new game.
+    void reset_peaks();
+
+    // Writes current and peak usage of every subsystem in turn [turn] to
+    // [file], in one line.
+    void report(FILE *file, uint16_t turn) const;
+
+private:
+    MemoryUsage usages[MEMORY_SUBSYSTEMS];
+    size_t total_peak = 0;
+};
+
+#endif // MEMORY_H
@@ -0,0 +1,269 @@
+#include "compact.h"
+#include "../../common/compact.h"
+#include "../../common/trace.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+
+// Reads numbers in net order from messages built by server.
+class MessageCursor {
+public:
+    explicit MessageCursor(const List<uint8_t> &bytes) : bytes(bytes) {}
+
+    bool finished() const {
+        return next == bytes.size();
+    }
+
+    template<class T>
+    T read_uint() {
+        uint64_t value = 0;
+        for (size_t i = 0; i < sizeof(T); i++) {
+            value = value << 8 | bytes[next++];
+        }
+        return (T) value;
+    }
+
+    Position read_position() {
+        auto x = read_uint<uint16_t>();
+        auto y = read_uint<uint16_t>();
+        return Position(x, y);
+    }
+
+    std::string read_string() {
+        size_t length = bytes[next];
+        std::string result((const char *) bytes.data() + next + 1, length);
+        next += length + 1;
+        return result;
+    }
+
+    // Puts [length] next bytes at the end of [message].
+    void copy(size_t length, List<uint8_t> &message) {
+        message.insert(message.end(), bytes.begin() + (ssize_t) next, bytes.begin() + (ssize_t) (next + length));
+        next += length;
+    }
+
+private:
+    const List<uint8_t> &bytes;
+    size_t next = 0;
+};
+
+static void put_string(const std::string &string, List<uint8_t> &message) {
+    message.push_back((uint8_t) string.size());
+    message.insert(message.end(), string.begin(), string.end());
+}
+
+// Puts [address] of form [ipv6]:port (see get_address()) at the end of
+// [message] in binary form, or as string if it has different form.
+static void put_address(const std::string &address, List<uint8_t> &message) {
+    size_t end = address.find("]:");
+    in6_addr ip{};
+    if (address.empty() || address[0] != '[' || end == std::string::npos
+        || inet_pton(AF_INET6, address.substr(1, end - 1).c_str(), &ip) != 1) {
+        message.push_back(COMPACT_ADDRESS_STRING);
+        put_string(address, message);
+        return;
+    }
+
+    unsigned long port = strtoul(address.c_str() + end + 2, nullptr, 10);
+    if (port > UINT16_MAX || std::to_string(port) != address.substr(end + 2)) {
+        message.push_back(COMPACT_ADDRESS_STRING);
+        put_string(address, message);
+        return;
+    }
+
+    if (IN6_IS_ADDR_V4MAPPED(&ip)) {
+        message.push_back(COMPACT_ADDRESS_IPV4);
+        message.insert(message.end(), ip.s6_addr + 12, ip.s6_addr + 16);
+    }
+    else {
+        message.push_back(COMPACT_ADDRESS_IPV6);
+        message.insert(message.end(), ip.s6_addr, ip.s6_addr + 16);
+    }
+    message.push_back((uint8_t) (port >> 8));
+    message.push_back((uint8_t) port);
+}
+
+// Converts player's id, name and address.
+static void encode_player(MessageCursor &cursor, List<uint8_t> &message) {
+    cursor.copy(1, message);
+    put_string(cursor.read_string(), message);
+    put_address(cursor.read_string(), message);
+}
+
+// Puts blocks [blocks] as BlockRuns events at the end of [message]. Returns
+// number of events.
+static uint32_t put_block_runs(List<Position> &blocks, uint16_t size_x, List<uint8_t> &message) {
+    List<uint32_t> indices;
+    indices.reserve(blocks.size());
+    for (const Position &block : blocks) {
+        indices.push_back((uint32_t) block.y * size_x + block.x);
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+    List<std::pair<uint32_t, uint32_t>> runs; // first index and length
+    for (uint32_t index : indices) {
+        if (!runs.empty() && runs.back().first + runs.back().second == index) {
+            runs.back().second++;
+        }
+        else {
+            runs.emplace_back(index, 1);
+        }
+    }
+
+    uint32_t events = 0;
+    for (size_t first = 0; first < runs.size(); first += MAX_BLOCK_RUNS) {
+        size_t last = std::min(runs.size(), first + MAX_BLOCK_RUNS);
+        message.push_back(BLOCK_RUNS);
+        put_varint(last - first, message);
+        uint32_t end = 0;
+        for (size_t i = first; i < last; i++) {
+            put_varint(runs[i].first - end, message);
+            put_varint(runs[i].second, message);
+            end = runs[i].first + runs[i].second;
+        }
+        events++;
+    }
+    return events;
+}
+
+// Converts [events_count] events of Turn message. Puts number of events and
+// events at the end of [message].
+static void encode_events(MessageCursor &cursor, uint32_t events_count, uint16_t size_x,
+                          Map<PlayerId, Position> &positions, List<uint8_t> &message) {
+    List<uint8_t> events_message;
+    uint32_t events = 0;
+    List<Position> blocks; // Consecutive BlockPlaced events, not converted yet.
+
+    auto put_blocks = [&]() {
+        if (blocks.size() == 1) {
+            events_message.push_back(3);
+            put_varint(blocks[0].x, events_message);
+            put_varint(blocks[0].y, events_message);
+            events++;
+        }
+        else if (blocks.size() > 1) {
+            events += put_block_runs(blocks, size_x, events_message);
+        }
+        blocks.clear();
+    };
+
+    for (uint32_t i = 0; i < events_count; i++) {
+        auto event_type = cursor.read_uint<uint8_t>();
+        if (event_type == 3) { // BlockPlaced
+            blocks.push_back(cursor.read_position());
+            continue;
+        }
+
+        put_blocks();
+        events_message.push_back(event_type);
+        events++;
+        if (event_type == 0) { // BombPlaced
+            put_varint(cursor.read_uint<BombId>(), events_message);
+            Position position = cursor.read_position();
+            put_varint(position.x, events_message);
+            put_varint(position.y, events_message);
+        }
+        else if (event_type == 1 || event_type == DESTROYED) { // BombExploded or Destroyed
+            if (event_type == 1) {
+                put_varint(cursor.read_uint<BombId>(), events_message);
+            }
+            auto robots_count = cursor.read_uint<uint32_t>();
+            put_varint(robots_count, events_message);
+            cursor.copy(robots_count, events_message);
+
+            auto blocks_count = cursor.read_uint<uint32_t>();
+            put_varint(blocks_count, events_message);
+            Position previous(0, 0);
+            for (uint32_t j = 0; j < blocks_count; j++) {
+                Position block = cursor.read_position();
+                put_varint(zigzag_encode((int64_t) block.x - previous.x), events_message);
+                put_varint(zigzag_encode((int64_t) block.y - previous.y), events_message);
+                previous = block;
+            }
+        }
+        else { // PlayerMoved
+            auto player_id = cursor.read_uint<PlayerId>();
+            Position position = cursor.read_position();
+            events_message.push_back(player_id);
+            auto old_position = positions.find(player_id);
+            if (old_position != positions.end()) {
+                int64_t dx = (int64_t) position.x - old_position->second.x;
+                int64_t dy = (int64_t) position.y - old_position->second.y;
+                put_varint(zigzag_encode(dx) << 1 | 1, events_message);
+                put_varint(zigzag_encode(dy), events_message);
+            }
+            else {
+                put_varint((uint64_t) position.x << 1, events_message);
+                put_varint(position.y, events_message);
+            }
+            positions[player_id] = position;
+        }
+    }
+    put_blocks();
+
+    put_varint(events, message);
+    message.insert(message.end(), events_message.begin(), events_message.end());
+}
+
+List<uint8_t> encode_compact(const List<uint8_t> &messages, uint16_t size_x, Map<PlayerId, Position> &positions) {
+    TRACE_SPAN("encode_compact");
+    List<uint8_t> result;
+    MessageCursor cursor(messages);
+
+    while (!cursor.finished()) {
+        auto message_type = cursor.read_uint<uint8_t>();
+        result.push_back(message_type);
+        switch (message_type) {
+            case 0: { // Hello
+                put_string(cursor.read_string(), result);
+                cursor.copy(11, result);
+                break;
+            }
+            case 1: { // AcceptedPlayer
+                encode_player(cursor, result);
+                break;
+            }
+            case 2: { // GameStarted
+                auto players_count = cursor.read_uint<uint32_t>();
+                put_varint(players_count, result);
+                for (uint32_t i = 0; i < players_count; i++) {
+                    encode_player(cursor, result);
+                }
+                positions.clear();
+                break;
+            }
+            case 3: { // Turn
+                put_varint(cursor.read_uint<uint16_t>(), result);
+                encode_events(cursor, cursor.read_uint<uint32_t>(), size_x, positions, result);
+                break;
+            }
+            case 4: { // GameEnded
+                auto scores_count = cursor.read_uint<uint32_t>();
+                put_varint(scores_count, result);
+                for (uint32_t i = 0; i < scores_count; i++) {
+                    cursor.copy(1, result);
+                    put_varint(cursor.read_uint<Score>(), result);
+                }
+                positions.clear();
+                break;
+            }
+            case 5: { // TurnHash
+                put_varint(cursor.read_uint<uint16_t>(), result);
+                cursor.copy(sizeof(uint64_t), result);
+                break;
+            }
+            case 6: { // Capabilities
+                cursor.copy(1, result);
+                break;
+            }
+            default: { // Session
+                cursor.copy(1 + sizeof(uint64_t), result);
+                break;
+            }
+        }
+    }
+
+    return result;
+}
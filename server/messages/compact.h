@@ -0,0 +1,11 @@
+#ifndef SERVER_COMPACT_H
+#define SERVER_COMPACT_H
+
+#include "../../common/types.h"
+
+// Converts complete messages [messages] built by server to compact encoding
+// (see common/compact.h) and returns them. [positions] contains robots'
+// positions last sent to client, it is updated. [size_x] is board's width.
+List<uint8_t> encode_compact(const List<uint8_t> &messages, uint16_t size_x, Map<PlayerId, Position> &positions);
+
+#endif // SERVER_COMPACT_H
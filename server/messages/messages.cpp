@@ -1,6 +1,15 @@
 #include "messages.h"
 #include "../net/net.h"
 #include "../../common/err.h"
+#include "../../common/trace.h"
+#include "../../common/zobrist.h"
+
+#include <algorithm>
+#include <bit>
+
+#define TURN_HEADER_LENGTH 7 // Message id, turn and number of events.
+#define INDEX_CELL_SHIFT 4   // Cells of events index are 16x16 tiles.
+#define PARALLEL_EXPLOSIONS 64 // Fewer explosions are resolved by the main thread alone.
 
 /************ FUNCTIONS RESPONSIBLE FOR APPENDING DATA TO MESSAGE *************/
 
@@ -34,82 +43,105 @@ static void put_position_into_message(const Position &position, List<uint8_t> &m
     put_uint_into_message<uint16_t>(position.y, message);
 }
 
+// Records event put into [message] starting at offset [begin] in
+// [data.turn_events], if events are recorded.
+static void record_event(ServerData &data, size_t begin, const List<uint8_t> &message,
+                         const Position &position, const Position &previous, BombId bomb_id = 0) {
+    if (!data.record_events) {
+        return;
+    }
+    data.turn_events.push_back(EventInfo{begin, message.size(), position, previous, message[begin], bomb_id});
+}
+
+// Puts BombPlaced with bomb id [id] and position [position] into [message].
+static void put_bomb_placed_into_message(BombId id, const Position &position, List<uint8_t> &message) {
+    put_uint_into_message<uint8_t>(0, message);
+    put_uint_into_message<BombId>(id, message);
+    put_position_into_message(position, message);
+}
+
+// Puts PlayerMoved with player id [id] and position [position] into [message].
+static void put_player_moved_into_message(PlayerId id, const Position &position, List<uint8_t> &message) {
+    put_uint_into_message<uint8_t>(2, message);
+    put_uint_into_message<PlayerId>(id, message);
+    put_position_into_message(position, message);
+}
+
+// Puts BlockPlaced with position [position] into [message].
+static void put_block_placed_into_message(const Position &position, List<uint8_t> &message) {
+    put_uint_into_message<uint8_t>(3, message);
+    put_position_into_message(position, message);
+}
+
 // Spawns bomb with timer [timer] on position [position]. Puts BombPlaced
 // into [message].
 static void spawn_bomb(ServerData &data, const Position &position,
                        uint16_t timer, List<uint8_t> &message) {
+    size_t begin = message.size();
     data.bombs[data.next_bomb_id] = Bomb(position, timer);
-    put_uint_into_message<uint8_t>(0, message);
-    put_uint_into_message<BombId>(data.next_bomb_id, message);
+    data.state_hash ^= zobrist_bomb_key(data.next_bomb_id, position);
+    put_bomb_placed_into_message(data.next_bomb_id, position, message);
+    record_event(data, begin, message, position, position, data.next_bomb_id);
     data.next_bomb_id++;
-    put_position_into_message(position, message);
 }
 
-// Puts BombExploded into [message]. Bomb with id [id] is the one that exploded.
-static void put_bomb_exploded_into_message(ServerData &data, BombId id, List<uint8_t> &message) {
+// Puts BombExploded into [message]. Bomb with id [id] on [position] is the one
+// that exploded, destroying [robots] and [blocks] (sets, so they are sorted).
+// Adds them to [data.all_robots_destroyed] and [data.all_blocks_destroyed].
+template<class Robots, class Blocks>
+static void put_bomb_exploded_into_message(ServerData &data, BombId id, const Position &position,
+                                           const Robots &robots, const Blocks &blocks, List<uint8_t> &message) {
+    size_t begin = message.size();
     put_uint_into_message<uint8_t>(1, message);
     put_uint_into_message<BombId>(id, message);
 
-    put_uint_into_message<uint32_t>((uint32_t) data.robots_destroyed.size(), message);
-    for (const auto &player_id : data.robots_destroyed) {
+    put_uint_into_message<uint32_t>((uint32_t) robots.size(), message);
+    for (const auto &player_id : robots) {
         put_uint_into_message<PlayerId>(player_id, message);
     }
 
-    put_uint_into_message<uint32_t>((uint32_t) data.blocks_destroyed.size(), message);
-    for (const auto &block_position : data.blocks_destroyed) {
+    put_uint_into_message<uint32_t>((uint32_t) blocks.size(), message);
+    for (const auto &block_position : blocks) {
         put_position_into_message(block_position, message);
     }
 
-    data.all_robots_destroyed.insert(data.robots_destroyed.begin(), data.robots_destroyed.end());
-    data.all_blocks_destroyed.insert(data.blocks_destroyed.begin(), data.blocks_destroyed.end());
+    data.all_robots_destroyed.insert(robots.begin(), robots.end());
+    data.all_blocks_destroyed.insert(blocks.begin(), blocks.end());
+    record_event(data, begin, message, position, position, id);
 }
 
 // Spawns player with id [id] on position [position]. Puts PlayerMoved into [message].
 static void spawn_player(ServerData &data, PlayerId id, const Position &position, List<uint8_t> &message) {
+    size_t begin = message.size();
+    Position previous = position;
+    auto old_position = data.player_positions.find(id);
+    if (old_position != data.player_positions.end()) {
+        previous = old_position->second;
+        data.state_hash ^= zobrist_player_key(id, previous);
+    }
     data.player_positions[id] = position;
-    put_uint_into_message<uint8_t>(2, message);
-    put_uint_into_message<PlayerId>(id, message);
-    put_position_into_message(position, message);
+    data.state_hash ^= zobrist_player_key(id, position);
+    put_player_moved_into_message(id, position, message);
+    record_event(data, begin, message, position, previous);
 }
 
 // Spawns block on position [position]. Puts BlockPlaced into [message].
+template<class Board>
 static void spawn_block(ServerData &data, const Position &position, List<uint8_t> &message) {
-    data.blocks.emplace(position);
-    put_uint_into_message<uint8_t>(3, message);
-    put_position_into_message(position, message);
+    size_t begin = message.size();
+    data.board<Board>().place_block(position);
+    data.state_hash ^= zobrist_block_key(position);
+    put_block_placed_into_message(position, message);
+    record_event(data, begin, message, position, position);
 }
 
 // Moves player with id [id] towards [direction] if it is possible.
 // If movement is possible, returns true and puts PlayerMoved into [message].
-static bool try_moving_player(const ServerParameters &parameters, ServerData &data,
-                              PlayerId id, uint8_t direction, List<uint8_t> &message) {
+template<class Board>
+static bool try_moving_player(ServerData &data, PlayerId id, uint8_t direction, List<uint8_t> &message) {
+    const Board &board = data.board<Board>();
     Position new_position = data.player_positions[id];
-    if (direction == 0) {
-        if (new_position.y == parameters.size_y - 1) {
-            return false;
-        }
-        new_position.y++;
-    }
-    else if (direction == 1) {
-        if (new_position.x == parameters.size_x - 1) {
-            return false;
-        }
-        new_position.x++;
-    }
-    else if (direction == 2) {
-        if (new_position.y == 0) {
-            return false;
-        }
-        new_position.y--;
-    }
-    else {
-        if (new_position.x == 0) {
-            return false;
-        }
-        new_position.x--;
-    }
-
-    if (data.blocks.contains(new_position)) {
+    if (!board.step(new_position, direction) || board.contains_block(new_position)) {
         return false;
     }
 
@@ -139,111 +171,169 @@ static Position get_random_position(const ServerParameters &parameters, ServerDa
 }
 
 // Find robots that are destroyed by explosion on [explosion_position].
-// Updates [data.robots_destroyed].
-static void find_destroyed_robots(ServerData &data, const Position &explosion_position) {
+// Puts them into [robots].
+template<class Robots>
+static void find_destroyed_robots(const ServerData &data, const Position &explosion_position, Robots &robots) {
     for (const auto &player : data.player_positions) {
         if (player.second == explosion_position) {
-            data.robots_destroyed.emplace(player.first);
+            robots.emplace(player.first);
         }
     }
 }
 
-// Finds robots and blocks destroyed by explosion of bomb with id [id] up to
-// the bomb. Updates [data.robots_destroyed] and [data.blocks_destroyed].
-static void find_destroyed_up(const ServerParameters &parameters, ServerData &data, BombId id) {
-    Position explosion_position = data.bombs[id].position;
+// Finds robots and blocks destroyed by explosion of bomb on [bomb_position]
+// towards [direction]. Puts them into [robots] and [blocks].
+template<class Board, class Robots, class Blocks>
+static void find_destroyed_in_direction(const ServerParameters &parameters, const ServerData &data,
+                                        const Position &bomb_position, uint8_t direction,
+                                        Robots &robots, Blocks &blocks) {
+    const Board &board = data.board<Board>();
+    Position explosion_position = bomb_position;
     for (uint16_t i = 0; i <= parameters.explosion_radius; i++) {
-        find_destroyed_robots(data, explosion_position);
-        if (data.blocks.contains(explosion_position)) {
-            data.blocks_destroyed.emplace(explosion_position);
+        find_destroyed_robots(data, explosion_position, robots);
+        if (board.contains_block(explosion_position)) {
+            blocks.emplace(explosion_position);
             break;
         }
-        if (explosion_position.y == parameters.size_y - 1) {
+        if (!board.step(explosion_position, direction)) {
             break;
         }
-        explosion_position.y++;
     }
 }
 
-// Finds robots and blocks destroyed by explosion of bomb with id [id] right to
-// the bomb. Updates [data.robots_destroyed] and [data.blocks_destroyed].
-static void find_destroyed_right(const ServerParameters &parameters, ServerData &data, BombId id) {
-    Position explosion_position = data.bombs[id].position;
-    for (uint16_t i = 0; i <= parameters.explosion_radius; i++) {
-        find_destroyed_robots(data, explosion_position);
-        if (data.blocks.contains(explosion_position)) {
-            data.blocks_destroyed.emplace(explosion_position);
-            break;
-        }
-        if (explosion_position.x == parameters.size_x - 1) {
-            break;
-        }
-        explosion_position.x++;
+// Finds robots and blocks destroyed by explosion of bomb on [bomb_position].
+// Puts them into [robots] and [blocks]. [data] is only read, explosions of one
+// turn see the world from its start, so they can be resolved in parallel.
+template<class Board, class Robots, class Blocks>
+static void find_destroyed(const ServerParameters &parameters, const ServerData &data,
+                           const Position &bomb_position, Robots &robots, Blocks &blocks) {
+    robots.clear();
+    blocks.clear();
+
+    for (uint8_t direction = 0; direction < 4; direction++) {
+        find_destroyed_in_direction<Board>(parameters, data, bomb_position, direction, robots, blocks);
     }
 }
 
-// Finds robots and blocks destroyed by explosion of bomb with id [id] down to
-// the bomb. Updates [data.robots_destroyed] and [data.blocks_destroyed].
-static void find_destroyed_down(const ServerParameters &parameters, ServerData &data, BombId id) {
-    Position explosion_position = data.bombs[id].position;
-    for (uint16_t i = 0; i <= parameters.explosion_radius; i++) {
-        find_destroyed_robots(data, explosion_position);
-        if (data.blocks.contains(explosion_position)) {
-            data.blocks_destroyed.emplace(explosion_position);
-            break;
-        }
-        if (explosion_position.y == 0) {
-            break;
-        }
-        explosion_position.y--;
+// Robots destroyed by one bomb, one bit per player id.
+struct DestroyedRobots {
+    uint64_t words[4];
+
+    void clear() {
+        std::fill(std::begin(words), std::end(words), 0);
     }
-}
 
-// Finds robots and blocks destroyed by explosion of bomb with id [id] left to
-// the bomb. Updates [data.robots_destroyed] and [data.blocks_destroyed].
-static void find_destroyed_left(const ServerParameters &parameters, ServerData &data, BombId id) {
-    Position explosion_position = data.bombs[id].position;
-    for (uint16_t i = 0; i <= parameters.explosion_radius; i++) {
-        find_destroyed_robots(data, explosion_position);
-        if (data.blocks.contains(explosion_position)) {
-            data.blocks_destroyed.emplace(explosion_position);
-            break;
+    void emplace(PlayerId id) {
+        words[id / 64] |= (uint64_t) 1 << (id % 64);
+    }
+
+    // Puts ids of robots into [robots] in increasing order.
+    void put_into(List<PlayerId> &robots) const {
+        robots.clear();
+        for (size_t i = 0; i < 4; i++) {
+            for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+                robots.push_back((PlayerId) (i * 64 + (size_t) std::countr_zero(word)));
+            }
         }
-        if (explosion_position.x == 0) {
-            break;
+    }
+};
+
+// Blocks destroyed by one bomb, at most one in each direction, kept sorted.
+struct DestroyedBlocks {
+    Position positions[4];
+    uint8_t count;
+
+    void clear() {
+        count = 0;
+    }
+
+    void emplace(const Position &position) {
+        Position *it = std::lower_bound(begin(), end(), position);
+        if (it == end() || !(*it == position)) {
+            std::move_backward(it, end(), end() + 1);
+            *it = position;
+            count++;
         }
-        explosion_position.x--;
     }
-}
 
-// Finds robots and blocks destroyed by explosion of bomb with id [id].
-// Updates [data.robots_destroyed] and [data.blocks_destroyed].
-static void find_destroyed(const ServerParameters &parameters, ServerData &data, BombId id) {
-    data.robots_destroyed.clear();
-    data.blocks_destroyed.clear();
+    size_t size() const {
+        return count;
+    }
+
+    Position *begin() {
+        return positions;
+    }
+
+    Position *end() {
+        return positions + count;
+    }
+
+    const Position *begin() const {
+        return positions;
+    }
+
+    const Position *end() const {
+        return positions + count;
+    }
+};
+
+// Robots and blocks destroyed by one bomb, found by one of pool's threads.
+// Kept in place, so resolving an explosion allocates nothing.
+struct ExplosionResult {
+    DestroyedRobots robots;
+    DestroyedBlocks blocks;
+};
+
+// Resolves explosions of bombs [exploded] on threads of [data.explosion_pool]
+// and puts BombExploded events into [message] in the order of [exploded], so
+// the message is the same as if they were resolved one by one.
+template<class Board>
+static void resolve_explosions_in_parallel(const ServerParameters &parameters, ServerData &data,
+                                           const ArenaList<std::pair<BombId, Position>> &exploded,
+                                           List<uint8_t> &message) {
+    static List<ExplosionResult> results; // Reused, grows to the most explosions in one turn.
+    static List<PlayerId> robots;
 
-    find_destroyed_up(parameters, data, id);
-    find_destroyed_right(parameters, data, id);
-    find_destroyed_down(parameters, data, id);
-    find_destroyed_left(parameters, data, id);
+    results.resize(exploded.size());
+    const ServerData &world = data;
+    data.explosion_pool.run(exploded.size(), [&](size_t i) {
+        find_destroyed<Board>(parameters, world, exploded[i].second, results[i].robots, results[i].blocks);
+    });
+
+    for (size_t i = 0; i < exploded.size(); i++) {
+        results[i].robots.put_into(robots);
+        put_bomb_exploded_into_message(data, exploded[i].first, exploded[i].second, robots,
+                                       results[i].blocks, message);
+    }
 }
 
 // Handles explosions in new turn. Puts BombExploded messages into [message].
 // Returns number of explosions.
+template<class Board>
 static uint32_t handle_explosions(const ServerParameters &parameters,
                                   ServerData &data, List<uint8_t> &message) {
-    uint32_t explosions = 0;
+    TRACE_SPAN("handle_explosions");
+    ArenaList<std::pair<BombId, Position>> exploded(&data.turn_memory);
 
     for (auto &bomb : data.bombs) {
         bomb.second.timer--;
         if (bomb.second.timer == 0) {
-            find_destroyed(parameters, data, bomb.first);
-            put_bomb_exploded_into_message(data, bomb.first, message);
-            explosions++;
+            exploded.emplace_back(bomb.first, bomb.second.position);
+        }
+    }
+
+    if (data.explosion_pool.threads() > 0 && exploded.size() >= PARALLEL_EXPLOSIONS) {
+        resolve_explosions_in_parallel<Board>(parameters, data, exploded, message);
+    }
+    else {
+        for (const auto &[id, position] : exploded) {
+            find_destroyed<Board>(parameters, data, position, data.robots_destroyed, data.blocks_destroyed);
+            put_bomb_exploded_into_message(data, id, position, data.robots_destroyed, data.blocks_destroyed,
+                                           message);
         }
     }
 
-    return explosions;
+    return (uint32_t) exploded.size();
 }
 
 // Removes exploded bombs from [data].
@@ -251,6 +341,7 @@ static void clear_exploded_bombs(ServerData &data) {
     bool finish = true;
     for (auto it = data.bombs.begin(); it != data.bombs.end(); it++) {
         if (it->second.timer == 0) {
+            data.state_hash ^= zobrist_bomb_key(it->first, it->second.position);
             data.bombs.erase(it);
             finish = false;
             break;
@@ -263,12 +354,13 @@ static void clear_exploded_bombs(ServerData &data) {
 }
 
 // Removes destroyed blocks from [data].
+template<class Board>
 static void clear_destroyed_blocks(ServerData &data) {
-    Set<Position> survived_blocks;
-    std::set_difference(data.blocks.begin(), data.blocks.end(),
-                        data.all_blocks_destroyed.begin(), data.all_blocks_destroyed.end(),
-                        std::inserter(survived_blocks, survived_blocks.end()));
-    data.blocks = survived_blocks;
+    Board &board = data.board<Board>();
+    for (const Position &position : data.all_blocks_destroyed) {
+        board.remove_block(position);
+        data.state_hash ^= zobrist_block_key(position);
+    }
 }
 
 /******************************** TO CLIENTS **********************************/
@@ -303,11 +395,14 @@ List<uint8_t> build_game_started(const ServerData &data) {
     return message;
 }
 
+template<class Board>
 List<uint8_t> build_turn_0(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("build_turn_0");
     List<uint8_t> message = {3};
     List<uint8_t> events_message; // suffix of message containing events
     put_uint_into_message<uint16_t>(0, message);
     uint32_t events = (uint32_t) parameters.players_count;
+    data.turn_events.clear();
 
     // Place players.
     for (PlayerId id = 0; id < parameters.players_count; id++) {
@@ -315,11 +410,32 @@ List<uint8_t> build_turn_0(const ServerParameters &parameters, ServerData &data)
     }
 
     // Place blocks.
-    for (uint16_t i = 0; i < parameters.initial_blocks; i++) {
-        Position position = get_random_position(parameters, data);
-        if (!data.blocks.contains(position)) {
-            spawn_block(data, position, events_message);
-            events++;
+    Board &board = data.board<Board>();
+    uint64_t max_blocks = data.map.blocks != nullptr ? data.map.blocks_count : parameters.initial_blocks;
+    max_blocks = std::min(max_blocks, (uint64_t) parameters.size_x * parameters.size_y);
+    events_message.reserve(events_message.size() + 5 * max_blocks); // BlockPlaced has 5 bytes.
+    if (data.map.blocks != nullptr) {
+        for (uint32_t i = 0; i < data.map.blocks_count; i++) {
+            Position position = data.map.block(i);
+            if (!board.contains_block(position)) {
+                spawn_block<Board>(data, position, events_message);
+                events++;
+            }
+        }
+    }
+    else if (parameters.exact_blocks) {
+        sample_positions(parameters.initial_blocks, parameters.size_x, parameters.size_y, data.random,
+                         [&](const Position &position) { return board.contains_block(position); },
+                         [&](const Position &position) { spawn_block<Board>(data, position, events_message); });
+        events += parameters.initial_blocks;
+    }
+    else {
+        for (uint32_t i = 0; i < parameters.initial_blocks; i++) {
+            Position position = get_random_position(parameters, data);
+            if (!board.contains_block(position)) {
+                spawn_block<Board>(data, position, events_message);
+                events++;
+            }
         }
     }
 
@@ -328,21 +444,27 @@ List<uint8_t> build_turn_0(const ServerParameters &parameters, ServerData &data)
     return message;
 }
 
+template<class Board>
 List<uint8_t> build_turn(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("build_turn");
     List<uint8_t> message = {3};
-    List<uint8_t> events_message; // suffix of message containing events
+    List<uint8_t> &events_message = data.events_message; // suffix of message containing events
+    events_message.clear();
     put_uint_into_message<uint16_t>(data.turn, message);
     uint32_t events = 0;
+    data.turn_events.clear();
 
-    events += handle_explosions(parameters, data, events_message);
+    events += handle_explosions<Board>(parameters, data, events_message);
     clear_exploded_bombs(data);
-    clear_destroyed_blocks(data);
+    clear_destroyed_blocks<Board>(data);
 
     for (PlayerId id = 0; id < parameters.players_count; id++) {
         uint8_t last_message = data.clients_last_messages[data.poll_ids[id]];
         if (data.all_robots_destroyed.contains(id)) {
             spawn_player(data, id, get_random_position(parameters, data), events_message);
+            data.state_hash ^= zobrist_score_key(id, data.scores[id]);
             data.scores[id]++;
+            data.state_hash ^= zobrist_score_key(id, data.scores[id]);
             events++;
         }
         else if (data.disconnected_players.contains(id)) {
@@ -352,23 +474,32 @@ List<uint8_t> build_turn(const ServerParameters &parameters, ServerData &data) {
             spawn_bomb(data, data.player_positions[id], parameters.bomb_timer, events_message);
             events++;
         }
-        else if (last_message == PLACE_BLOCK && !data.blocks.contains(data.player_positions[id])) {
-            spawn_block(data, data.player_positions[id], events_message);
+        else if (last_message == PLACE_BLOCK
+                 && !data.board<Board>().contains_block(data.player_positions[id])) {
+            spawn_block<Board>(data, data.player_positions[id], events_message);
             events++;
         }
         else if (last_message != NO_MSG && last_message != JOIN) {
             uint8_t direction = last_message - MOVE;
-            if (try_moving_player(parameters, data, id, direction, events_message)) {
+            if (try_moving_player<Board>(data, id, direction, events_message)) {
                 events++;
             }
         }
     }
 
+    message.reserve(TURN_HEADER_LENGTH + events_message.size());
     put_uint_into_message<uint32_t>(events, message);
     message.insert(message.end(), events_message.begin(), events_message.end());
     return message;
 }
 
+template List<uint8_t> build_turn_0<GenericBoard>(const ServerParameters &, ServerData &);
+template List<uint8_t> build_turn_0<SmallBoard>(const ServerParameters &, ServerData &);
+template List<uint8_t> build_turn<GenericBoard>(const ServerParameters &, ServerData &);
+template List<uint8_t> build_turn<SmallBoard>(const ServerParameters &, ServerData &);
+template List<uint8_t> build_turn_0<ChunkedBoard>(const ServerParameters &, ServerData &);
+template List<uint8_t> build_turn<ChunkedBoard>(const ServerParameters &, ServerData &);
+
 List<uint8_t> build_game_ended(const ServerData &data) {
     List<uint8_t> message = {4};
     put_uint_into_message<uint32_t>((uint32_t) data.scores.size(), message);
@@ -379,32 +510,393 @@ List<uint8_t> build_game_ended(const ServerData &data) {
     return message;
 }
 
+List<uint8_t> build_turn_hash(uint16_t turn, const ServerData &data) {
+    List<uint8_t> message = {5};
+    put_uint_into_message<uint16_t>(turn, message);
+    put_uint_into_message<uint64_t>(data.state_hash, message);
+    return message;
+}
+
+List<uint8_t> build_datagram_session(uint64_t token, uint16_t port) {
+    List<uint8_t> message = {8};
+    put_uint_into_message<uint64_t>(token, message);
+    put_uint_into_message<uint16_t>(port, message);
+    return message;
+}
+
+List<uint8_t> build_session(PlayerId player_id, uint64_t token) {
+    List<uint8_t> message = {7};
+    put_uint_into_message<PlayerId>(player_id, message);
+    put_uint_into_message<uint64_t>(token, message);
+    return message;
+}
+
+List<uint8_t> build_capabilities(uint8_t flags) {
+    return {6, flags};
+}
+
+/**************************** AREA OF INTEREST ********************************/
+
+// Empty view, contains no tiles.
+static const View EMPTY_VIEW = {1, 1, 0, 0};
+
+// Returns view containing tiles in distance at most [radius] from [center]
+// in both coordinates.
+static View view_around(const ServerParameters &parameters, const Position &center, uint32_t radius) {
+    View view;
+    view.min_x = (uint16_t) (center.x > radius ? center.x - radius : 0);
+    view.min_y = (uint16_t) (center.y > radius ? center.y - radius : 0);
+    view.max_x = (uint16_t) std::min<uint32_t>(center.x + radius, parameters.size_x - 1u);
+    view.max_y = (uint16_t) std::min<uint32_t>(center.y + radius, parameters.size_y - 1u);
+    return view;
+}
+
+static bool in_view(const View &view, const Position &position) {
+    return view.min_x <= position.x && position.x <= view.max_x
+           && view.min_y <= position.y && position.y <= view.max_y;
+}
+
+// Puts rectangles covering tiles of [view] that are not in [old_view] into [parts].
+static void view_difference(const View &view, const View &old_view, List<View> &parts) {
+    if (old_view.min_x > old_view.max_x || old_view.max_x < view.min_x || view.max_x < old_view.min_x
+        || old_view.max_y < view.min_y || view.max_y < old_view.min_y) {
+        parts.push_back(view);
+        return;
+    }
+
+    uint16_t middle_min_x = std::max(view.min_x, old_view.min_x);
+    uint16_t middle_max_x = std::min(view.max_x, old_view.max_x);
+    if (view.min_x < old_view.min_x) {
+        parts.push_back(View{view.min_x, view.min_y, (uint16_t) (old_view.min_x - 1), view.max_y});
+    }
+    if (old_view.max_x < view.max_x) {
+        parts.push_back(View{(uint16_t) (old_view.max_x + 1), view.min_y, view.max_x, view.max_y});
+    }
+    if (view.min_y < old_view.min_y) {
+        parts.push_back(View{middle_min_x, view.min_y, middle_max_x, (uint16_t) (old_view.min_y - 1)});
+    }
+    if (old_view.max_y < view.max_y) {
+        parts.push_back(View{middle_min_x, (uint16_t) (old_view.max_y + 1), middle_max_x, view.max_y});
+    }
+}
+
+// Returns key of events index cell containing tile ([x], [y]).
+static uint32_t index_cell(uint32_t x, uint32_t y) {
+    return (x >> INDEX_CELL_SHIFT) << 16 | (y >> INDEX_CELL_SHIFT);
+}
+
+void index_turn_events(ServerData &data) {
+    TRACE_SPAN("index_turn_events");
+    data.events_index.clear();
+    data.explosions_index.clear();
+    for (uint32_t i = 0; i < data.turn_events.size(); i++) {
+        const EventInfo &event = data.turn_events[i];
+        if (event.type == 1) {
+            data.explosions_index[event.bomb_id] = i;
+        }
+        uint32_t cell = index_cell(event.position.x, event.position.y);
+        uint32_t previous_cell = index_cell(event.previous.x, event.previous.y);
+        data.events_index[cell].push_back(i);
+        if (previous_cell != cell) {
+            data.events_index[previous_cell].push_back(i);
+        }
+    }
+}
+
+// Puts indices of events of the last turn that should be seen by client with
+// poll id [poll_id] and view [view] into [events], in order of appearance.
+// Bombs are seen within [bomb_view], so that explosions reaching [view] are
+// seen. Explosions of bombs known by client are always seen.
+static void find_events_in_view(const ServerData &data, size_t poll_id, const View &view,
+                                const View &bomb_view, ArenaList<uint32_t> &events) {
+    auto is_seen = [&](uint32_t i) {
+        const EventInfo &event = data.turn_events[i];
+        return event.type <= 1 ? in_view(bomb_view, event.position)
+                               : in_view(view, event.position) || in_view(view, event.previous);
+    };
+
+    for (BombId bomb_id : data.known_bombs[poll_id]) {
+        auto explosion = data.explosions_index.find(bomb_id);
+        if (explosion != data.explosions_index.end()) {
+            events.push_back(explosion->second);
+        }
+    }
+
+    size_t cells = (size_t) ((bomb_view.max_x >> INDEX_CELL_SHIFT) - (bomb_view.min_x >> INDEX_CELL_SHIFT) + 1)
+                   * (size_t) ((bomb_view.max_y >> INDEX_CELL_SHIFT) - (bomb_view.min_y >> INDEX_CELL_SHIFT) + 1);
+    if (cells >= data.turn_events.size()) { // Checking all events is cheaper.
+        for (uint32_t i = 0; i < data.turn_events.size(); i++) {
+            if (is_seen(i)) {
+                events.push_back(i);
+            }
+        }
+    }
+    else {
+        for (uint32_t x = bomb_view.min_x >> INDEX_CELL_SHIFT; x <= (uint32_t) bomb_view.max_x >> INDEX_CELL_SHIFT; x++) {
+            for (uint32_t y = bomb_view.min_y >> INDEX_CELL_SHIFT; y <= (uint32_t) bomb_view.max_y >> INDEX_CELL_SHIFT; y++) {
+                auto cell = data.events_index.find(x << 16 | y);
+                if (cell == data.events_index.end()) {
+                    continue;
+                }
+                for (uint32_t i : cell->second) {
+                    if (is_seen(i)) {
+                        events.push_back(i);
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort(events.begin(), events.end());
+    events.erase(std::unique(events.begin(), events.end()), events.end());
+}
+
+// Returns uint of type [T] at [offset] in [message].
+template<class T>
+static T get_uint_from_message(const List<uint8_t> &message, size_t offset) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        value = (T) (value << 8 | message[offset + i]);
+    }
+    return value;
+}
+
+// Puts robots destroyed in explosions of Turn [turn_message] that client with
+// poll id [poll_id] did not see (not in [seen_events]), and in none it saw,
+// into [robots]. Blocks destroyed in them are added to client's stale blocks.
+static void find_unseen_destructions(ServerData &data, size_t poll_id, const List<uint8_t> &turn_message,
+                                     const ArenaList<uint32_t> &seen_events, ArenaSet<PlayerId> &robots) {
+    ArenaSet<PlayerId> seen_robots(&data.turn_memory);
+    for (const auto &explosion : data.explosions_index) {
+        bool seen = std::binary_search(seen_events.begin(), seen_events.end(), explosion.second);
+        size_t offset = TURN_HEADER_LENGTH + data.turn_events[explosion.second].begin + 5; // Event and bomb id.
+        uint32_t robots_count = get_uint_from_message<uint32_t>(turn_message, offset);
+        offset += sizeof(uint32_t);
+        for (uint32_t i = 0; i < robots_count; i++, offset++) {
+            (seen ? seen_robots : robots).insert(turn_message[offset]);
+        }
+        if (seen) {
+            continue;
+        }
+
+        uint32_t blocks_count = get_uint_from_message<uint32_t>(turn_message, offset);
+        offset += sizeof(uint32_t);
+        for (uint32_t i = 0; i < blocks_count; i++, offset += 4) {
+            data.stale_blocks[poll_id].emplace(get_uint_from_message<uint16_t>(turn_message, offset),
+                                               get_uint_from_message<uint16_t>(turn_message, offset + 2));
+        }
+    }
+
+    for (PlayerId id : seen_robots) {
+        robots.erase(id);
+    }
+}
+
+// Puts every robot into [robots] as many times as it was destroyed before
+// this turn, for client that gets the game from scratch in its middle.
+static void list_earlier_destructions(const ServerData &data, ArenaList<PlayerId> &robots) {
+    for (const auto &[player_id, score] : data.scores) {
+        Score earlier = score - (data.all_robots_destroyed.contains(player_id) ? 1 : 0);
+        robots.insert(robots.end(), earlier, player_id);
+    }
+}
+
+// Puts Destroyed event with [robots] and [blocks] into [message], so client
+// counts robots and removes blocks destroyed in explosions it did not see.
+static void put_destroyed_into_message(const ArenaList<PlayerId> &robots, const ArenaList<Position> &blocks,
+                                       List<uint8_t> &message) {
+    put_uint_into_message<uint8_t>(DESTROYED, message);
+    put_uint_into_message<uint32_t>((uint32_t) robots.size(), message);
+    for (PlayerId player_id : robots) {
+        put_uint_into_message<PlayerId>(player_id, message);
+    }
+    put_uint_into_message<uint32_t>((uint32_t) blocks.size(), message);
+    for (const Position &block_position : blocks) {
+        put_position_into_message(block_position, message);
+    }
+}
+
+// Puts PlayerMoved of robots whose positions client with poll id [poll_id]
+// does not know into [message], if they are in [view] or client thinks they
+// are there. Returns number of events.
+static uint32_t put_robots(ServerData &data, size_t poll_id, const View &view, List<uint8_t> &message) {
+    uint32_t events = 0;
+    ArenaMap<PlayerId, Position> &known = data.known_positions[poll_id];
+    for (const auto &[player_id, position] : data.player_positions) {
+        auto known_position = known.find(player_id);
+        bool is_known = known_position != known.end();
+        if (is_known && known_position->second == position) {
+            continue;
+        }
+        if (in_view(view, position) || (is_known && in_view(view, known_position->second))) {
+            put_player_moved_into_message(player_id, position, message);
+            known[player_id] = position;
+            events++;
+        }
+    }
+    return events;
+}
+
+// Puts events describing blocks that are in [view] but were not in [old_view]
+// and bombs in [bomb_view] unknown to client with poll id [poll_id] into
+// [message]. Puts client's stale blocks in new part of [view] that are gone
+// into [blocks_removed]. Returns number of events.
+template<class Board>
+static uint32_t put_snapshot(ServerData &data, size_t poll_id, const View &view, const View &old_view,
+                             const View &bomb_view, ArenaList<Position> &blocks_removed, List<uint8_t> &message) {
+    uint32_t events = 0;
+
+    List<View> parts;
+    view_difference(view, old_view, parts);
+    const Board &board = data.board<Board>();
+    ArenaSet<Position> &stale = data.stale_blocks[poll_id];
+    for (const View &part : parts) {
+        for (uint32_t x = part.min_x; x <= part.max_x; x++) {
+            for (uint32_t y = part.min_y; y <= part.max_y; y++) {
+                Position position((uint16_t) x, (uint16_t) y);
+                if (board.contains_block(position)) {
+                    put_block_placed_into_message(position, message);
+                    events++;
+                }
+            }
+        }
+
+        auto block = stale.lower_bound(Position(part.min_x, 0));
+        while (block != stale.end() && block->x <= part.max_x) {
+            if (block->y < part.min_y || block->y > part.max_y) {
+                block++;
+                continue;
+            }
+            if (!board.contains_block(*block)) {
+                blocks_removed.push_back(*block);
+            }
+            block = stale.erase(block);
+        }
+    }
+
+    for (const auto &bomb : data.bombs) {
+        if (in_view(bomb_view, bomb.second.position) && !data.known_bombs[poll_id].contains(bomb.first)) {
+            put_bomb_placed_into_message(bomb.first, bomb.second.position, message);
+            data.known_bombs[poll_id].insert(bomb.first);
+            events++;
+        }
+    }
+
+    return events;
+}
+
+template<class Board>
+List<uint8_t> build_turn_for_client(const ServerParameters &parameters, ServerData &data, size_t poll_id,
+                                    const List<uint8_t> &turn_message, bool initial) {
+    TRACE_SPAN("build_turn_for_client");
+    PlayerId player_id = get_player_id_by_poll_id(data, poll_id);
+    const Position &center = data.player_positions[player_id];
+    View view = view_around(parameters, center, parameters.view_radius);
+    View bomb_view = view_around(parameters, center, (uint32_t) parameters.view_radius + parameters.explosion_radius);
+
+    List<uint8_t> &events_message = data.events_message; // suffix of message containing events
+    events_message.clear();
+    uint32_t events = 0;
+
+    ArenaList<uint32_t> seen_events(&data.turn_memory);
+    find_events_in_view(data, poll_id, view, bomb_view, seen_events);
+    auto events_begin = turn_message.begin() + TURN_HEADER_LENGTH;
+    for (uint32_t i : seen_events) {
+        const EventInfo &event = data.turn_events[i];
+        if (event.type == 1 && !data.known_bombs[poll_id].contains(event.bomb_id)) {
+            // Bomb came into view when exploding, client has to know it first.
+            put_bomb_placed_into_message(event.bomb_id, event.position, events_message);
+            events++;
+        }
+        events_message.insert(events_message.end(), events_begin + (ssize_t) event.begin,
+                              events_begin + (ssize_t) event.end);
+        if (event.type == 0) {
+            data.known_bombs[poll_id].insert(event.bomb_id);
+        }
+        else if (event.type == 1) {
+            data.known_bombs[poll_id].erase(event.bomb_id);
+        }
+        else if (event.type == 2) {
+            PlayerId moved_id = turn_message[TURN_HEADER_LENGTH + event.begin + 1];
+            data.known_positions[poll_id][moved_id] = event.position;
+        }
+        events++;
+    }
+
+    ArenaSet<PlayerId> robots_destroyed(&data.turn_memory);
+    ArenaList<Position> blocks_removed(&data.turn_memory);
+    find_unseen_destructions(data, poll_id, turn_message, seen_events, robots_destroyed);
+    ArenaList<PlayerId> robots_listed(robots_destroyed.begin(), robots_destroyed.end(), &data.turn_memory);
+    if (!initial) {
+        const View &old_view = data.has_view[poll_id] ? data.views[poll_id] : EMPTY_VIEW;
+        events += put_snapshot<Board>(data, poll_id, view, old_view, bomb_view, blocks_removed, events_message);
+        if (!data.has_view[poll_id]) {
+            list_earlier_destructions(data, robots_listed);
+        }
+    }
+    events += put_robots(data, poll_id, view, events_message);
+    if (!robots_listed.empty() || !blocks_removed.empty()) {
+        put_destroyed_into_message(robots_listed, blocks_removed, events_message);
+        events++;
+    }
+    data.views[poll_id] = view;
+    data.has_view[poll_id] = true;
+
+    List<uint8_t> message;
+    message.reserve(TURN_HEADER_LENGTH + events_message.size());
+    message.insert(message.end(), turn_message.begin(), turn_message.begin() + 3); // id and turn
+    put_uint_into_message<uint32_t>(events, message);
+    message.insert(message.end(), events_message.begin(), events_message.end());
+    return message;
+}
+
+template List<uint8_t> build_turn_for_client<GenericBoard>(const ServerParameters &, ServerData &, size_t,
+                                                           const List<uint8_t> &, bool);
+template List<uint8_t> build_turn_for_client<SmallBoard>(const ServerParameters &, ServerData &, size_t,
+                                                         const List<uint8_t> &, bool);
+template List<uint8_t> build_turn_for_client<ChunkedBoard>(const ServerParameters &, ServerData &, size_t,
+                                                           const List<uint8_t> &, bool);
+
 /******************************* FROM CLIENTS *********************************/
 
-bool client_sent_join(const Deque<uint8_t> &buffer) {
+bool client_sent_join(const InputBuffer &buffer) {
     return buffer.size() > 2 && buffer[0] == JOIN &&
            buffer[1] > 0 && buffer.size() > (size_t) buffer[1] + 1;
 }
 
-bool client_sent_place_bomb(const Deque<uint8_t> &buffer) {
+bool client_sent_place_bomb(const InputBuffer &buffer) {
     return buffer.size() > 0 && buffer[0] == PLACE_BOMB;
 }
 
-bool client_sent_place_block(const Deque<uint8_t> &buffer) {
+bool client_sent_place_block(const InputBuffer &buffer) {
     return buffer.size() > 0 && buffer[0] == PLACE_BLOCK;
 }
 
-bool client_sent_move(const Deque<uint8_t> &buffer) {
+bool client_sent_move(const InputBuffer &buffer) {
     return buffer.size() > 1 && buffer[0] == MOVE && buffer[1] < 4;
 }
 
-bool client_sent_incorrect_message(const Deque<uint8_t> &buffer) {
-    return (buffer.size() > 0 && buffer[0] > MOVE) ||
+bool client_sent_capabilities(const InputBuffer &buffer) {
+    return buffer.size() > 1 && buffer[0] == CAPABILITIES;
+}
+
+bool client_sent_tagged_action(const InputBuffer &buffer) {
+    return buffer.size() > 3 && buffer[0] == TAGGED_ACTION && (buffer[3] != MOVE || buffer.size() > 4);
+}
+
+bool client_sent_resume(const InputBuffer &buffer) {
+    return buffer.size() >= 12 && buffer[0] == RESUME;
+}
+
+bool client_sent_incorrect_message(const InputBuffer &buffer) {
+    return (buffer.size() > 0 && buffer[0] > RESUME) ||
            (buffer.size() > 1 && buffer[0] == MOVE && buffer[1] > 3) ||
-           (buffer.size() > 1 && buffer[0] == JOIN && buffer[1] == 0);
+           (buffer.size() > 1 && buffer[0] == JOIN && buffer[1] == 0) ||
+           (buffer.size() > 3 && buffer[0] == TAGGED_ACTION && (buffer[3] < PLACE_BOMB || buffer[3] > MOVE)) ||
+           (buffer.size() > 4 && buffer[0] == TAGGED_ACTION && buffer[3] == MOVE && buffer[4] > 3);
 }
 
-std::string read_join(Deque<uint8_t> &buffer) {
+std::string read_join(InputBuffer &buffer) {
     buffer.pop_front();
     size_t name_length = buffer.front();
     buffer.pop_front();
@@ -417,17 +909,117 @@ std::string read_join(Deque<uint8_t> &buffer) {
     return result;
 }
 
-void read_place_bomb(Deque<uint8_t> &buffer) {
+void read_place_bomb(InputBuffer &buffer) {
     buffer.pop_front();
 }
 
-void read_place_block(Deque<uint8_t> &buffer) {
+void read_place_block(InputBuffer &buffer) {
     buffer.pop_front();
 }
 
-uint8_t read_move(Deque<uint8_t> &buffer) {
+uint8_t read_move(InputBuffer &buffer) {
     char result = (char) buffer[1];
     buffer.pop_front();
     buffer.pop_front();
     return (uint8_t) result;
 }
+
+uint8_t read_capabilities(InputBuffer &buffer) {
+    uint8_t result = buffer[1];
+    buffer.pop_front();
+    buffer.pop_front();
+    return result;
+}
+
+uint8_t read_tagged_action(InputBuffer &buffer, uint16_t &target_turn) {
+    target_turn = (uint16_t) (buffer[1] << 8 | buffer[2]);
+    uint8_t action = buffer[3] == MOVE ? MOVE + buffer[4] : buffer[3];
+    buffer.erase(buffer.begin(), buffer.begin() + (buffer[3] == MOVE ? 5 : 4));
+    return action;
+}
+
+void read_resume(InputBuffer &buffer, uint64_t &token, bool &in_game, uint16_t &turn) {
+    token = 0;
+    for (size_t i = 1; i <= 8; i++) {
+        token = token << 8 | buffer[i];
+    }
+    in_game = buffer[9] != 0;
+    turn = (uint16_t) (buffer[10] << 8 | buffer[11]);
+    buffer.erase(buffer.begin(), buffer.begin() + 12);
+}
+
+bool read_client_datagram(const uint8_t *bytes, size_t length, ClientDatagram &datagram) {
+    if (length < 11 || bytes[10] > DATAGRAM_ACTIONS) {
+        return false;
+    }
+    datagram.token = 0;
+    for (size_t i = 0; i < 8; i++) {
+        datagram.token = datagram.token << 8 | bytes[i];
+    }
+    datagram.acked_turn = (uint16_t) (bytes[8] << 8 | bytes[9]);
+    datagram.actions_count = bytes[10];
+
+    size_t next = 11;
+    for (uint8_t i = 0; i < datagram.actions_count; i++) {
+        if (next + 3 > length || bytes[next + 2] < PLACE_BOMB || bytes[next + 2] > MOVE
+            || (bytes[next + 2] == MOVE && (next + 4 > length || bytes[next + 3] > 3))) {
+            return false;
+        }
+        datagram.sequences[i] = (uint16_t) (bytes[next] << 8 | bytes[next + 1]);
+        datagram.actions[i] = bytes[next + 2] == MOVE ? MOVE + bytes[next + 3] : bytes[next + 2];
+        next += bytes[next + 2] == MOVE ? 4 : 3;
+    }
+    return next == length;
+}
+
+bool skip_complete_messages(InputBuffer &buffer, bool tagged_actions, uint8_t &last_action, size_t &skipped) {
+    size_t next = 0;
+    skipped = 0;
+
+    while (next < buffer.size()) {
+        size_t length;
+        if (buffer[next] == PLACE_BOMB || buffer[next] == PLACE_BLOCK) {
+            length = 1;
+        }
+        else if (buffer[next] == MOVE) {
+            if (next + 1 == buffer.size()) {
+                break;
+            }
+            if (buffer[next + 1] > 3) {
+                return false;
+            }
+            length = 2;
+        }
+        else if (buffer[next] == TAGGED_ACTION) {
+            if (!tagged_actions) {
+                return false;
+            }
+            if (next + 3 >= buffer.size()) {
+                break;
+            }
+            if (buffer[next + 3] < PLACE_BOMB || buffer[next + 3] > MOVE
+                || (buffer[next + 3] == MOVE && next + 4 < buffer.size() && buffer[next + 4] > 3)) {
+                return false;
+            }
+            length = buffer[next + 3] == MOVE ? 5 : 4;
+        }
+        else if (buffer[next] == JOIN || buffer[next] == CAPABILITIES || buffer[next] == RESUME) {
+            break; // Processed as usual.
+        }
+        else {
+            return false;
+        }
+
+        if (next + length > buffer.size()) {
+            break;
+        }
+        if (buffer[next] == PLACE_BOMB || buffer[next] == PLACE_BLOCK || buffer[next] == MOVE) {
+            last_action = buffer[next] == MOVE ? MOVE + buffer[next + 1] : buffer[next];
+        }
+        next += length;
+        skipped++;
+    }
+
+    buffer.erase(buffer.begin(), buffer.begin() + (ssize_t) next);
+    return true;
+}
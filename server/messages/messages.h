@@ -3,9 +3,19 @@
 
 #include "../server-data/server_data.h"
 #include "../server-parameters/server_parameters.h"
+#include "../../common/compact.h"
 
 #define NO_FLAGS 0
 
+// Datagram from client (not part of the base protocol), see common/compact.h.
+struct ClientDatagram {
+    uint64_t token;
+    uint16_t acked_turn;
+    uint8_t actions_count;
+    uint16_t sequences[DATAGRAM_ACTIONS];
+    uint8_t actions[DATAGRAM_ACTIONS]; // Encoded as in [ServerData::clients_last_messages].
+};
+
 /******************************** TO CLIENTS **********************************/
 
 // Builds Hello message and returns it.
@@ -19,45 +29,128 @@ List<uint8_t> build_accepted_player(const ServerData &data, size_t poll_id);
 List<uint8_t> build_game_started(const ServerData &data);
 
 // Builds Turn message with turn equal to 0. Changes [data] by spawning players
-// and placing blocks.
+// and placing blocks on board of type [Board]. Instantiated for GenericBoard,
+// SmallBoard and ChunkedBoard.
+template<class Board>
 List<uint8_t> build_turn_0(const ServerParameters &parameters, ServerData &data);
 
-// Builds Turn message. Updates [data].
+// Builds Turn message. Updates [data], blocks are kept on board of type [Board].
+// Instantiated for GenericBoard, SmallBoard and ChunkedBoard.
+template<class Board>
 List<uint8_t> build_turn(const ServerParameters &parameters, ServerData &data);
 
 // Builds GameEnded message and returns it.
 List<uint8_t> build_game_ended(const ServerData &data);
 
+// Builds TurnHash message (not part of the base protocol) and returns it. It
+// contains [turn] and hash of state in [data] after this turn.
+List<uint8_t> build_turn_hash(uint16_t turn, const ServerData &data);
+
+// Builds Session message (not part of the base protocol) for player
+// [player_id] with token [token] and returns it.
+List<uint8_t> build_session(PlayerId player_id, uint64_t token);
+
+// Builds Capabilities message (not part of the base protocol) and returns it.
+// It contains flags of features accepted by server, see common/compact.h.
+List<uint8_t> build_capabilities(uint8_t flags);
+
+// Builds DatagramSession message (not part of the base protocol) with token
+// [token] and UDP port [port] and returns it.
+List<uint8_t> build_datagram_session(uint64_t token, uint16_t port);
+
+/**************************** AREA OF INTEREST ********************************/
+
+// Builds spatial index of events of the last Turn message, used by
+// build_turn_for_client().
+void index_turn_events(ServerData &data);
+
+// Builds Turn message for player with poll id [poll_id] from [turn_message]
+// built in this turn. Message contains only events seen in square of radius
+// [parameters.view_radius] around player's robot and explosions of bombs the
+// player was told about. Blocks and bombs that came into view are added as
+// BlockPlaced and BombPlaced, unless [initial] is set (for the first turn of
+// the game). Robots whose positions player does not know are added as
+// PlayerMoved if they are in view or player thinks they are there. Robots and
+// blocks destroyed in explosions player did not see are sent in Destroyed
+// event (see common/compact.h), robots at once, so scores do not drift, and
+// blocks when they come into view. Player without a view yet in a Turn other
+// than the first one (he resumed) gets everything in view and all scores so
+// far. Updates player's view in [data]. Only for clients that negotiated
+// CAPABILITY_VIEW_SYNC.
+// Instantiated for GenericBoard, SmallBoard and ChunkedBoard.
+template<class Board>
+List<uint8_t> build_turn_for_client(const ServerParameters &parameters, ServerData &data, size_t poll_id,
+                                    const List<uint8_t> &turn_message, bool initial);
+
 /******************************* FROM CLIENTS *********************************/
 
 // Returns true if client sent correct and complete Join message.
-bool client_sent_join(const Deque<uint8_t> &buffer);
+bool client_sent_join(const InputBuffer &buffer);
 
 // Returns true if client sent correct and complete PlaceBomb message.
-bool client_sent_place_bomb(const Deque<uint8_t> &buffer);
+bool client_sent_place_bomb(const InputBuffer &buffer);
 
 // Returns true if client sent correct and complete PlaceBlock message.
-bool client_sent_place_block(const Deque<uint8_t> &buffer);
+bool client_sent_place_block(const InputBuffer &buffer);
 
 // Returns true if client sent correct and complete Move message.
-bool client_sent_move(const Deque<uint8_t> &buffer);
+bool client_sent_move(const InputBuffer &buffer);
+
+// Returns true if client sent complete Capabilities message (not part of the
+// base protocol).
+bool client_sent_capabilities(const InputBuffer &buffer);
+
+// Returns true if client sent complete TaggedAction message (not part of the
+// base protocol).
+bool client_sent_tagged_action(const InputBuffer &buffer);
+
+// Returns true if client sent complete Resume message (not part of the base
+// protocol).
+bool client_sent_resume(const InputBuffer &buffer);
 
 // Returns true if client sent incorrect message. If client sent message that
 // is incomplete but may be correct, false is returned.
-bool client_sent_incorrect_message(const Deque<uint8_t> &buffer);
+bool client_sent_incorrect_message(const InputBuffer &buffer);
 
 // Reads Join message from [buffer]. Returns client's name. Message should be
 // correct.
-std::string read_join(Deque<uint8_t> &buffer);
+std::string read_join(InputBuffer &buffer);
 
 // Reads PlaceBomb message from [buffer]. Message should be correct.
-void read_place_bomb(Deque<uint8_t> &buffer);
+void read_place_bomb(InputBuffer &buffer);
 
 // Reads PlaceBlock message from [buffer]. Message should be correct.
-void read_place_block(Deque<uint8_t> &buffer);
+void read_place_block(InputBuffer &buffer);
 
 // Reads Move message from [buffer]. Returns direction. Message should be
 // correct.
-uint8_t read_move(Deque<uint8_t> &buffer);
+uint8_t read_move(InputBuffer &buffer);
+
+// Reads Capabilities message from [buffer]. Returns flags requested by client.
+// Message should be correct.
+uint8_t read_capabilities(InputBuffer &buffer);
+
+// Reads TaggedAction message from [buffer]. Puts turn into [target_turn] and
+// returns action (encoded as in [ServerData::clients_last_messages]). Message
+// should be correct.
+uint8_t read_tagged_action(InputBuffer &buffer, uint16_t &target_turn);
+
+// Reads Resume message from [buffer]. Puts its fields into [token], [in_game]
+// and [turn]. Message should be correct.
+void read_resume(InputBuffer &buffer, uint64_t &token, bool &in_game, uint16_t &turn);
+
+// Reads datagram of [length] bytes [bytes] received from client into
+// [datagram]. Returns false if datagram is incorrect.
+bool read_client_datagram(const uint8_t *bytes, size_t length, ClientDatagram &datagram);
+
+// Removes complete PlaceBomb, PlaceBlock, Move and TaggedAction messages from
+// the beginning of [buffer] without fully processing them, up to the first
+// Join, Capabilities or Resume, which are left to be processed as usual.
+// Sets [last_action] to the last PlaceBomb, PlaceBlock or Move removed (encoded
+// as in [ServerData::clients_last_messages]) and leaves it unchanged if there
+// was no such message. TaggedActions are dropped, they are incorrect unless
+// [tagged_actions] is set. Sets [skipped] to number of removed messages.
+// Returns false if incorrect message was found.
+bool skip_complete_messages(InputBuffer &buffer, bool tagged_actions, uint8_t &last_action, size_t &skipped);
 
 #endif // SERVER_MESSAGES_H
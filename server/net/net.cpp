@@ -1,7 +1,11 @@
 #include "net.h"
+#include "../../common/trace.h"
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 int bind_tcp_socket(uint16_t port) {
     int socket_fd = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP);
@@ -18,8 +22,62 @@ int bind_tcp_socket(uint16_t port) {
     return socket_fd;
 }
 
+int bind_datagram_socket(uint16_t port) {
+    int socket_fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    ENSURE(socket_fd > 0);
+
+    sockaddr_in6 address{};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = IN6ADDR_ANY_INIT;
+    address.sin6_port = htons(port);
+    CHECK_ERRNO(bind(socket_fd, (sockaddr *) &address, (socklen_t) sizeof(address)));
+
+    make_non_blocking(socket_fd);
+    return socket_fd;
+}
+
+int bind_local_socket(const std::string &path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        fatal("Local socket path %s is too long.", path.c_str());
+    }
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ENSURE(socket_fd > 0);
+
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    struct stat status;
+    if (lstat(path.c_str(), &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            fatal("%s exists and is not a socket.", path.c_str());
+        }
+        // Socket is stale (left by server that did not exit cleanly) only if
+        // nobody listens on it.
+        int probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        ENSURE(probe_fd > 0);
+        int connected = connect(probe_fd, (sockaddr *) &address, (socklen_t) sizeof(address));
+        int probe_errno = errno;
+        close(probe_fd);
+        if (connected == 0 || probe_errno != ECONNREFUSED) {
+            fatal("Local socket %s is already in use.", path.c_str());
+        }
+        CHECK_ERRNO(unlink(path.c_str()));
+    }
+    CHECK_ERRNO(bind(socket_fd, (sockaddr *) &address, (socklen_t) sizeof(address)));
+
+    return socket_fd;
+}
+
 void start_listening(int socket_fd, int queue_length) {
     CHECK_ERRNO(listen(socket_fd, queue_length));
+    make_non_blocking(socket_fd);
+}
+
+void make_non_blocking(int socket_fd) {
+    int flags = fcntl(socket_fd, F_GETFL);
+    ENSURE(flags != -1);
+    CHECK_ERRNO(fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK));
 }
 
 bool turn_off_nagle(int socked_fd) {
@@ -41,8 +99,8 @@ int accept_connection(int socket_fd, sockaddr_in6 *client_address) {
 std::string get_address(const sockaddr_in6 &address) {
     char address_str[INET6_ADDRSTRLEN];
     if (inet_ntop(AF_INET6, &address.sin6_addr, address_str, INET6_ADDRSTRLEN)) {
-        std::string result(address_str);
-        result.insert(0, "[");
+        std::string result = "[";
+        result += address_str;
         result += ']';
 
         // Append port.
@@ -55,8 +113,21 @@ std::string get_address(const sockaddr_in6 &address) {
     }
 }
 
-bool send_message(int socket_fd, const List<uint8_t> &message, int flags) {
+ssize_t send_without_waiting(int socket_fd, const iovec *parts, size_t count) {
+    TRACE_SPAN("send_without_waiting");
+    msghdr header{};
+    header.msg_iov = const_cast<iovec *>(parts);
+    header.msg_iovlen = count;
     errno = 0;
-    ssize_t sent_length = send(socket_fd, message.data(), message.size(), flags);
-    return sent_length == (ssize_t) message.size();
+    ssize_t sent_length = sendmsg(socket_fd, &header, MSG_NOSIGNAL);
+    if (sent_length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    return sent_length;
 }
+
+bool send_datagram(int socket_fd, const sockaddr_in6 &address, const uint8_t *datagram, size_t length) {
+    ssize_t sent_length = sendto(socket_fd, datagram, length, 0, (const sockaddr *) &address,
+                                 (socklen_t) sizeof(address));
+    return sent_length == (ssize_t) length;
+}
\ No newline at end of file
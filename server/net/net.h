@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 #include <string>
+#include <sys/uio.h>
 
 #include "../../common/err.h"
 #include "../../common/types.h"
@@ -14,7 +15,17 @@
 // Binds TCP socket to port [port] and returns descriptor to newly created socket.
 int bind_tcp_socket(uint16_t port);
 
-// Starts listening on socket [socket_fd] with queue [queue_length].
+// Binds non-blocking UDP socket to port [port] and returns descriptor to newly
+// created socket.
+int bind_datagram_socket(uint16_t port);
+
+// Binds Unix domain stream socket to path [path], removing stale socket file
+// first. Calls fatal() if [path] exists and is not a socket, or if a server
+// listens on it. Returns descriptor to newly created socket.
+int bind_local_socket(const std::string &path);
+
+// Starts listening on socket [socket_fd] with queue [queue_length]. Socket is
+// made non-blocking, so accepting on it never waits for a connection.
 void start_listening(int socket_fd, int queue_length);
 
 // Turns of Nagle's algorithm from TCP socket. Returns false if function failed.
@@ -29,7 +40,17 @@ int accept_connection(int socket_fd, sockaddr_in6 *client_address);
 // Returns "fail" if function failed.
 std::string get_address(const sockaddr_in6 &address);
 
-// Sends [message] via [socket_fd]. Returns false if sending failed.
-bool send_message(int socket_fd, const List<uint8_t> &message, int flags);
+// Makes socket [socket_fd] non-blocking.
+void make_non_blocking(int socket_fd);
+
+// Sends [count] buffers [parts], one after another, via non-blocking socket
+// [socket_fd] as far as it accepts them. Returns number of bytes sent, 0 if
+// socket is not ready, -1 if sending failed (no SIGPIPE is raised).
+ssize_t send_without_waiting(int socket_fd, const iovec *parts, size_t count);
+
+
+// Sends [length] bytes of [datagram] via UDP socket [socket_fd] to [address].
+// Returns false if sending failed.
+bool send_datagram(int socket_fd, const sockaddr_in6 &address, const uint8_t *datagram, size_t length);
 
 #endif // SERVER_NET_H
@@ -0,0 +1,211 @@
+#include "send_pool.h"
+#include "../messages/compact.h"
+#include "../net/net.h"
+#include "../../common/err.h"
+#include "../../common/trace.h"
+
+#include <algorithm>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+SendPool::~SendPool() {
+    stopping = true;
+    for (auto &worker : workers) {
+        eventfd_write(worker->wakeup_fd, 1);
+        worker->thread.join();
+        close(worker->wakeup_fd);
+    }
+}
+
+void SendPool::start(size_t threads, size_t max_poll_id, uint16_t board_size_x) {
+    size_x = board_size_x;
+    threads_count = threads;
+    compact_positions = List<Map<PlayerId, Position>>(max_poll_id + 1);
+    connections = List<uint32_t>(max_poll_id + 1, 1);
+    failures = List<std::atomic<uint32_t>>(max_poll_id + 1);
+    queued = List<std::atomic<size_t>>(max_poll_id + 1);
+    outboxes = List<Outbox>(max_poll_id + 1);
+    for (size_t i = 0; i < threads; i++) {
+        workers.push_back(std::make_unique<Worker>());
+        Worker &worker = *workers.back();
+        worker.index = i;
+        worker.wakeup_fd = eventfd(0, 0);
+        ENSURE(worker.wakeup_fd != -1);
+        worker.thread = std::thread([this, &worker, i] {
+            TRACE_THREAD_NAME("send-" + std::to_string(i));
+            serve(worker);
+        });
+    }
+}
+
+size_t SendPool::put_into_outbox(const Job &job) {
+    Outbox &outbox = outboxes[job.poll_id];
+    outbox.fd = job.fd;
+    outbox.connection = job.connection;
+    if (job.compact) {
+        List<uint8_t> encoded = encode_compact(*job.message, size_x, compact_positions[job.poll_id]);
+        outbox.messages.push_back(std::make_shared<const List<uint8_t>>(std::move(encoded)));
+    }
+    else {
+        outbox.messages.push_back(job.message);
+    }
+    return outbox.messages.back()->size();
+}
+
+ssize_t SendPool::write_chunk(Outbox &outbox) {
+    TRACE_SPAN("write");
+    iovec parts[SEND_PARTS];
+    size_t count = 0;
+    size_t length = 0;
+    for (auto it = outbox.messages.begin(); it != outbox.messages.end() && count < SEND_PARTS
+                                            && length < (size_t) SEND_CHUNK; ++it) {
+        size_t offset = count == 0 ? outbox.sent : 0;
+        size_t part_length = std::min((*it)->size() - offset, (size_t) SEND_CHUNK - length);
+        parts[count++] = iovec{(void *) ((*it)->data() + offset), part_length};
+        length += part_length;
+    }
+    ssize_t sent_length = send_without_waiting(outbox.fd, parts, count);
+    if (sent_length < 0) {
+        return -1;
+    }
+
+    // Messages written whole are dropped.
+    outbox.sent += (size_t) sent_length;
+    while (!outbox.messages.empty() && outbox.sent >= outbox.messages.front()->size()) {
+        outbox.sent -= outbox.messages.front()->size();
+        outbox.messages.pop_front();
+    }
+    return sent_length;
+}
+
+bool SendPool::write(size_t poll_id) {
+    ssize_t sent_length = write_chunk(outboxes[poll_id]);
+    if (sent_length < 0) {
+        return false;
+    }
+    queued[poll_id] -= (size_t) sent_length;
+    return true;
+}
+
+void SendPool::count_queued(Worker &worker, size_t poll_id, uint32_t connection, size_t added, size_t removed) {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (connections[poll_id] == connection) {
+        queued[poll_id] += added;
+        queued[poll_id] -= removed;
+    }
+}
+
+void SendPool::take_job(Worker &worker, const Job &job) {
+    if (job.message == nullptr) {
+        close(job.fd);
+        compact_positions[job.poll_id].clear();
+        outboxes[job.poll_id] = Outbox();
+    }
+    else if (failures[job.poll_id] == job.connection) {
+        count_queued(worker, job.poll_id, job.connection, 0, job.message->size()); // Dropped.
+    }
+    else {
+        count_queued(worker, job.poll_id, job.connection, put_into_outbox(job), job.message->size());
+    }
+}
+
+void SendPool::write_outboxes(Worker &worker) {
+    worker.descriptors.assign(1, pollfd{worker.wakeup_fd, POLLIN, 0});
+    worker.poll_ids.assign(1, 0);
+    for (size_t poll_id = worker.index; poll_id < outboxes.size(); poll_id += threads_count) {
+        if (!outboxes[poll_id].messages.empty()) {
+            worker.descriptors.push_back(pollfd{outboxes[poll_id].fd, POLLOUT, 0});
+            worker.poll_ids.push_back(poll_id);
+        }
+    }
+
+    if (poll(worker.descriptors.data(), worker.descriptors.size(), -1) == -1) {
+        return; // Interrupted, we try again.
+    }
+    if (worker.descriptors[0].revents & POLLIN) {
+        eventfd_t value;
+        eventfd_read(worker.wakeup_fd, &value);
+    }
+    for (size_t i = 1; i < worker.descriptors.size(); i++) {
+        if (!(worker.descriptors[i].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            continue;
+        }
+        size_t poll_id = worker.poll_ids[i];
+        Outbox &outbox = outboxes[poll_id];
+        ssize_t sent_length = write_chunk(outbox);
+        if (sent_length >= 0) {
+            count_queued(worker, poll_id, outbox.connection, 0, (size_t) sent_length);
+        }
+        else {
+            failures[poll_id] = outbox.connection; // Following messages are dropped.
+            count_queued(worker, poll_id, outbox.connection, 0, unsent_bytes(outbox));
+            outbox.messages.clear();
+            outbox.sent = 0;
+        }
+    }
+}
+
+size_t SendPool::unsent_bytes(const Outbox &outbox) {
+    size_t bytes = 0;
+    for (const SharedMessage &message : outbox.messages) {
+        bytes += message->size();
+    }
+    return bytes - outbox.sent;
+}
+
+void SendPool::serve(Worker &worker) {
+    Deque<Job> jobs;
+    while (!stopping) {
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            jobs.swap(worker.jobs);
+        }
+        for (const Job &job : jobs) {
+            take_job(worker, job);
+        }
+        jobs.clear();
+        write_outboxes(worker);
+    }
+}
+
+bool SendPool::send(size_t poll_id, int fd, const SharedMessage &message, bool compact) {
+    Job job{poll_id, fd, connections[poll_id], message, compact};
+    if (workers.empty()) {
+        queued[poll_id] += put_into_outbox(job);
+        return write(poll_id);
+    }
+
+    queued[poll_id] += message->size();
+    Worker &worker = *workers[poll_id % workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.jobs.push_back(std::move(job));
+    eventfd_write(worker.wakeup_fd, 1);
+    return true;
+}
+
+void SendPool::close_client(size_t poll_id, int fd) {
+    if (workers.empty()) {
+        close(fd);
+        compact_positions[poll_id].clear();
+        outboxes[poll_id] = Outbox();
+        queued[poll_id] = 0;
+        connections[poll_id]++;
+        return;
+    }
+
+    // The thread may be writing to the socket, so it closes it. Shutting it
+    // down here makes the thread give up on it at once.
+    shutdown(fd, SHUT_RDWR);
+    Worker &worker = *workers[poll_id % workers.size()];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    std::erase_if(worker.jobs, [&](const Job &job) { return job.poll_id == poll_id && job.message != nullptr; });
+    worker.jobs.push_back(Job{poll_id, fd, connections[poll_id], nullptr, false});
+    connections[poll_id]++;
+    queued[poll_id] = 0;
+    eventfd_write(worker.wakeup_fd, 1);
+}
+
+bool SendPool::failed(size_t poll_id) const {
+    return failures[poll_id] == connections[poll_id];
+}
@@ -0,0 +1,138 @@
+#ifndef SEND_POOL_H
+#define SEND_POOL_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <thread>
+
+#include "../../common/types.h"
+
+#define SEND_CHUNK 65536 // Bytes written to one client's socket at once.
+#define SEND_PARTS 64    // Messages written to one client's socket at once.
+
+// Message shared by all clients it is sent to. It is not changed after being
+// built, so threads can send it at the same time.
+using SharedMessage = std::shared_ptr<const List<uint8_t>>;
+
+// Sends messages to clients via their non-blocking sockets. Messages are
+// encoded and put into the client's outbox, from which they are written as
+// the socket accepts them. Outboxes hold shared messages, not their copies,
+// so a message sent to many clients (like the replay) is stored once. Without threads, this is done by the calling
+// thread: one chunk at once in send(), the rest in write() when the socket is
+// ready. Otherwise every client is served by one thread (poll id modulo
+// number of threads), which fills outboxes of its clients in the order
+// messages were queued and writes to whichever socket is ready, so a client
+// that does not read holds up only himself. Then the calling thread never
+// waits for a socket and failures are reported by failed().
+class SendPool {
+public:
+    SendPool() = default;
+    ~SendPool();
+
+    SendPool(const SendPool &) = delete;
+    SendPool &operator=(const SendPool &) = delete;
+
+    // Starts [threads] threads (none is fine) serving clients with poll ids
+    // up to [max_poll_id]. [board_size_x] is board's width, used by compact encoding.
+    void start(size_t threads, size_t max_poll_id, uint16_t board_size_x);
+
+    // Sends [message] to client with poll id [poll_id] via socket [fd], in
+    // compact encoding if [compact]. Returns false if sending failed, always
+    // true if threads are running.
+    bool send(size_t poll_id, int fd, const SharedMessage &message, bool compact);
+
+    // Returns true if bytes for client with poll id [poll_id] wait in its
+    // outbox for the socket. Always false if threads are running.
+    bool pending(size_t poll_id) const {
+        return workers.empty() && !outboxes[poll_id].messages.empty();
+    }
+
+    // Writes at most SEND_CHUNK bytes of outbox of client with poll id
+    // [poll_id] to his socket. Returns false if sending failed.
+    bool write(size_t poll_id);
+
+    // Closes socket [fd] of client with poll id [poll_id], messages not sent yet
+    // are dropped. Resets the client's compact encoding state. With threads,
+    // the socket is shut down at once and closed by the client's thread.
+    void close_client(size_t poll_id, int fd);
+
+    // Returns true if sending to the current client with poll id [poll_id]
+    // failed in one of the threads.
+    bool failed(size_t poll_id) const;
+
+    // Returns number of bytes of messages queued for the current client with
+    // poll id [poll_id] and not sent yet. Shared messages count for every
+    // client.
+    size_t queued_bytes(size_t poll_id) const {
+        return queued[poll_id];
+    }
+
+private:
+    // Message to send or socket to close (if [message] is nullptr).
+    struct Job {
+        size_t poll_id;
+        int fd;
+        uint32_t connection;
+        SharedMessage message;
+        bool compact;
+    };
+
+    struct Worker {
+        size_t index;
+        std::mutex mutex; // Guards [jobs], [connections] and [queued] of the worker's clients.
+        Deque<Job> jobs;
+        int wakeup_fd;    // Event file descriptor, signalled when jobs are queued.
+        std::thread thread;
+        List<pollfd> descriptors; // Scratch of write_outboxes().
+        List<size_t> poll_ids;
+    };
+
+    // Messages waiting for client's socket. They are written in order, as the
+    // socket accepts them.
+    struct Outbox {
+        Deque<SharedMessage> messages;
+        size_t sent = 0;         // Bytes of the first message already written.
+        int fd = -1;
+        uint32_t connection = 0; // Connection the messages are for.
+    };
+
+    // Encodes message of [job] and puts it at the end of client's outbox.
+    // Returns number of bytes put.
+    size_t put_into_outbox(const Job &job);
+
+    // Writes at most SEND_CHUNK bytes of at most SEND_PARTS messages of
+    // [outbox] to its socket. Returns number of bytes written or -1 if sending
+    // failed.
+    static ssize_t write_chunk(Outbox &outbox);
+
+    // Adds [added] and subtracts [removed] bytes from bytes queued for client
+    // with poll id [poll_id], if [connection] is still the current one.
+    void count_queued(Worker &worker, size_t poll_id, uint32_t connection, size_t added, size_t removed);
+
+    // Takes job queued for [worker]: fills outbox or closes socket.
+    void take_job(Worker &worker, const Job &job);
+
+    // Writes to sockets of [worker]'s clients that are ready. Waits until a
+    // socket is ready or new jobs are queued.
+    void write_outboxes(Worker &worker);
+
+    // Returns number of bytes in [outbox] not written yet.
+    static size_t unsent_bytes(const Outbox &outbox);
+
+    // Runs jobs of [worker] until the pool is destroyed.
+    void serve(Worker &worker);
+
+    uint16_t size_x = 0;
+    size_t threads_count = 0;
+    std::atomic<bool> stopping = false;
+    List<std::unique_ptr<Worker>> workers;
+    List<Map<PlayerId, Position>> compact_positions; // Robots' positions sent in compact encoding.
+    List<uint32_t> connections;            // Number of the current connection, by poll id.
+    List<std::atomic<uint32_t>> failures;  // Number of the last connection that failed, by poll id.
+    List<std::atomic<size_t>> queued;      // Bytes of messages waiting in queues and outboxes, by poll id.
+    List<Outbox> outboxes;                 // By poll id, owned by the client's thread if threads are running.
+};
+
+#endif // SEND_POOL_H
@@ -1,17 +1,44 @@
 #include "server_data.h"
+#include "../../common/err.h"
 
+#include <algorithm>
 #include <cstring>
+#include <sys/random.h>
 
-ServerData::ServerData(uint32_t seed, uint8_t players_count) {
+ServerData::ServerData(uint32_t seed, uint8_t players_count, uint16_t size_x, uint16_t size_y) {
     random = std::minstd_rand(seed);
 
-    for (size_t i = 0; i <= MAX_CLIENTS; ++i) {
+    std::apply([&](auto &...board) { (board.resize(size_x, size_y), ...); }, boards);
+
+    for (size_t i = 0; i < POLL_DESCRIPTORS; ++i) {
         poll_descriptors[i].fd = -1;
         poll_descriptors[i].events = POLLIN;
         poll_descriptors[i].revents = 0;
     }
 
-    clients_buffers = List<Deque<uint8_t>>(MAX_CLIENTS + 1);
+    clients_buffers.reserve(MAX_CLIENTS + 1);
+    for (size_t i = 0; i <= MAX_CLIENTS; i++) {
+        clients_buffers.emplace_back(&input_memory[i]);
+    }
+    known_bombs.reserve(MAX_CLIENTS + 1);
+    known_positions.reserve(MAX_CLIENTS + 1);
+    stale_blocks.reserve(MAX_CLIENTS + 1);
+    for (size_t i = 0; i <= MAX_CLIENTS; i++) {
+        known_bombs.emplace_back(&game_memory);
+        known_positions.emplace_back(&game_memory);
+        stale_blocks.emplace_back(&game_memory);
+    }
+    memset(welcome_pending, false, sizeof(welcome_pending));
+    memset(compact_encoding, false, sizeof(compact_encoding));
+    memset(resumable, false, sizeof(resumable));
+    memset(pipelining, false, sizeof(pipelining));
+    memset(view_sync, false, sizeof(view_sync));
+    memset(replay_bytes, 0, sizeof(replay_bytes));
+    memset(has_view, false, sizeof(has_view));
+    memset(queued_turns, 0, sizeof(queued_turns));
+    for (size_t i = 0; i <= MAX_CLIENTS; i++) {
+        clear_datagram_session(i);
+    }
 
     for (PlayerId id = 0; id < players_count; id++) {
         scores[id] = 0;
@@ -19,7 +46,7 @@ ServerData::ServerData(uint32_t seed, uint8_t players_count) {
 }
 
 void ServerData::clear_poll_descriptors() {
-    for (int i = 0; i <= MAX_CLIENTS; ++i) {
+    for (int i = 0; i < POLL_DESCRIPTORS; ++i) {
         poll_descriptors[i].revents = 0;
     }
 }
@@ -28,6 +55,62 @@ void ServerData::clear_clients_last_messages() {
     memset(clients_last_messages, NO_MSG, MAX_CLIENTS + 1);
 }
 
+void ServerData::queue_action(size_t poll_id, uint16_t target_turn, uint8_t action) {
+    queued_actions[poll_id][target_turn % MAX_ACTION_QUEUE] = action;
+    queued_turns[poll_id][target_turn % MAX_ACTION_QUEUE] = target_turn;
+}
+
+void ServerData::take_queued_actions(uint16_t target_turn) {
+    size_t slot = target_turn % MAX_ACTION_QUEUE;
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        if (queued_turns[i][slot] == target_turn) {
+            clients_last_messages[i] = queued_actions[i][slot];
+            queued_turns[i][slot] = 0;
+        }
+    }
+}
+
+uint64_t ServerData::new_token() {
+    // Drawn from the kernel, so tokens of other players cannot be predicted
+    // from one's own.
+    uint64_t token = 0;
+    while (token == 0) {
+        ssize_t length = getrandom(&token, sizeof(token), 0);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        ENSURE(length == (ssize_t) sizeof(token));
+    }
+    return token;
+}
+
+void ServerData::clear_datagram_session(size_t poll_id) {
+    datagram_tokens[poll_id] = 0;
+    has_datagram_address[poll_id] = false;
+    datagram_acked[poll_id] = 0;
+    datagram_sequences[poll_id] = 0;
+}
+
+uint64_t ServerData::issue_session_token(PlayerId player_id) {
+    uint64_t token = new_token();
+    session_tokens[player_id] = token;
+    return token;
+}
+
+bool ServerData::find_session(uint64_t token, PlayerId &player_id) const {
+    for (const auto &session : session_tokens) {
+        if (session.second == token && token != 0) {
+            player_id = session.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ServerData::clear_action_queue(size_t poll_id) {
+    memset(queued_turns[poll_id], 0, sizeof(queued_turns[poll_id]));
+}
+
 // Returns [t1] - [t2] in milliseconds.
 static double time_dif_in_millis(const timeval &t1, const timeval &t2) {
     double seconds_dif = (float) (t2.tv_sec - t1.tv_sec) * 1000.f;
@@ -35,6 +118,34 @@ static double time_dif_in_millis(const timeval &t1, const timeval &t2) {
     return seconds_dif + millis_dif;
 }
 
+void ServerData::reset_input_budget(size_t poll_id, uint32_t bytes_limit, uint32_t messages_limit) {
+    input_budgets[poll_id].bytes = bytes_limit;
+    input_budgets[poll_id].messages = messages_limit;
+    input_budgets[poll_id].exceeded = false;
+    gettimeofday(&input_budgets[poll_id].last_refill, nullptr);
+}
+
+void ServerData::refill_input_budget(size_t poll_id, uint32_t bytes_limit,
+                                     uint32_t messages_limit, uint64_t turn_duration) {
+    InputBudget &budget = input_budgets[poll_id];
+    timeval current_time;
+    gettimeofday(&current_time, nullptr);
+    double turns = time_dif_in_millis(budget.last_refill, current_time) / (double) turn_duration;
+    budget.last_refill = current_time;
+
+    budget.bytes = std::min(budget.bytes + turns * bytes_limit, (double) bytes_limit);
+    budget.messages = std::min(budget.messages + turns * messages_limit, (double) messages_limit);
+    if (budget.bytes == bytes_limit && budget.messages == messages_limit) {
+        budget.exceeded = false;
+    }
+}
+
+bool ServerData::welcome_expired(size_t poll_id, uint64_t turn_duration) const {
+    timeval current_time;
+    gettimeofday(&current_time, nullptr);
+    return time_dif_in_millis(accept_times[poll_id], current_time) >= (double) turn_duration;
+}
+
 void ServerData::update_time_during_game() {
     timeval current_time;
     gettimeofday(&current_time, nullptr);
@@ -42,8 +153,17 @@ void ServerData::update_time_during_game() {
     last_time = current_time;
 }
 
+bool ServerData::turn_due(uint64_t turn_duration) {
+    if (in_lobby) {
+        return false;
+    }
+    update_time_during_game();
+    return (uint64_t) time_to_next_round >= turn_duration;
+}
+
 void ServerData::set_up_new_game() {
     in_lobby = false;
+    replay = nullptr;
     for (const auto &player : players) {
         scores[player.first] = 0;
     }
@@ -56,8 +176,18 @@ void ServerData::set_up_new_game() {
 void ServerData::next_turn() {
     turn++;
     time_to_next_round = 0;
+    clear_turn_memory();
+}
+
+void ServerData::clear_turn_memory() {
+    robots_destroyed.clear();
+    blocks_destroyed.clear();
     all_robots_destroyed.clear();
     all_blocks_destroyed.clear();
+    explosions_index.clear();
+    // clear() keeps buckets of the index, so the whole index is replaced.
+    decltype(events_index)(&turn_memory).swap(events_index);
+    turn_memory.release();
 }
 
 void ServerData::clear_state() {
@@ -66,8 +196,36 @@ void ServerData::clear_state() {
     players.clear();
     poll_ids.clear();
     player_positions.clear();
-    blocks.clear();
+    std::apply([](auto &...board) { (board.clear(), ...); }, boards);
     bombs.clear();
+    state_hash = 0;
+    memset(has_view, false, sizeof(has_view));
+    memset(queued_turns, 0, sizeof(queued_turns));
+    for (size_t i = 0; i <= MAX_CLIENTS; i++) {
+        known_bombs[i].clear();
+        known_positions[i].clear();
+        stale_blocks[i].clear();
+    }
+    game_memory.release();
+    clear_turn_memory();
     all_accepted_player_messages.clear();
     all_turn_messages.clear();
+    turn_offsets.clear();
+    replay = nullptr;
+    session_tokens.clear();
+}
+
+void ServerData::clear_state_keeping_players() {
+    List<std::pair<Player, size_t>> seated;
+    for (const auto &player : players) {
+        if (!disconnected_players.contains(player.first)) {
+            seated.emplace_back(player.second, poll_ids[player.first]);
+        }
+    }
+
+    clear_state();
+    for (const auto &[player, poll_id] : seated) {
+        poll_ids[(PlayerId) players.size()] = poll_id;
+        players[(PlayerId) players.size()] = player;
+    }
 }
@@ -1,59 +1,181 @@
 #ifndef SERVER_DATA_H
 #define SERVER_DATA_H
 
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <netinet/in.h>
 #include <poll.h>
 #include <stddef.h>
 #include <string>
 #include <random>
 #include <sys/time.h>
+#include <tuple>
+#include <unordered_map>
 
 #include "../../common/types.h"
+#include "../board/board.h"
+#include "../map/map.h"
+#include "../memory/memory.h"
+#include "../send-pool/send_pool.h"
+#include "../work-pool/work_pool.h"
+#include "../server-parameters/server_parameters.h"
 
 #define MAX_CLIENTS 25
+#define LOCAL_LISTENER (MAX_CLIENTS + 1)  // Poll id of Unix domain socket listener.
+#define DATAGRAM_SOCKET (MAX_CLIENTS + 2) // Poll id of UDP socket.
+#define POLL_DESCRIPTORS (MAX_CLIENTS + 3) // TCP listener, clients, local listener and UDP socket.
+#define TURN_MEMORY 32768                  // Bytes of turn memory kept in ServerData.
 
 // Messages from client.
 #define JOIN 0
 #define PLACE_BOMB 1
 #define PLACE_BLOCK 2
 #define MOVE 3
+#define CAPABILITIES 4 // Not part of the base protocol.
+#define TAGGED_ACTION 5 // Not part of the base protocol.
+#define RESUME 6        // Not part of the base protocol.
 #define NO_MSG 10
 
+// Bytes received from client and not processed yet.
+using InputBuffer = std::pmr::deque<uint8_t>;
+
+// Token buckets limiting bytes and messages received from one client.
+// Buckets hold at most one turn of budget and refill continuously.
+struct InputBudget {
+    double bytes;
+    double messages;
+    timeval last_refill;
+    bool exceeded; // True if client exceeded budget since it was full last time.
+};
+
+// Rectangle of tiles from (min_x, min_y) to (max_x, max_y) inclusive.
+struct View {
+    uint16_t min_x;
+    uint16_t min_y;
+    uint16_t max_x;
+    uint16_t max_y;
+};
+
+// Event put into the last Turn message. Used to send clients only events near
+// their robots.
+struct EventInfo {
+    size_t begin;      // Offset of event's first byte in Turn's events.
+    size_t end;        // Offset of the byte after event in Turn's events.
+    Position position; // Position of bomb, block or robot (after moving).
+    Position previous; // Robot's position before PlayerMoved, otherwise [position].
+    uint8_t type;      // Event id (0 - BombPlaced, 1 - BombExploded, ...).
+    BombId bomb_id;    // Bomb's id in BombPlaced and BombExploded.
+};
+
 // Structure containing data used by server.
 struct ServerData {
     // Communication with clients.
     int active_clients = 0;
-    pollfd poll_descriptors[MAX_CLIENTS + 1];
+    pollfd poll_descriptors[POLL_DESCRIPTORS];
     std::string clients_addresses[MAX_CLIENTS + 1];
-    List<Deque<uint8_t>> clients_buffers;
+    CountingResource input_memory[MAX_CLIENTS + 1]; // Memory of clients' buffers.
+    List<InputBuffer> clients_buffers;
     uint8_t clients_last_messages[MAX_CLIENTS + 1];
+    // Actions tagged with further turns. Action for turn t is kept in slot
+    // t % MAX_ACTION_QUEUE, queued_turns tells which turn it is for (0 - none).
+    uint8_t queued_actions[MAX_CLIENTS + 1][MAX_ACTION_QUEUE];
+    uint16_t queued_turns[MAX_CLIENTS + 1][MAX_ACTION_QUEUE];
+    InputBudget input_budgets[MAX_CLIENTS + 1];
+    bool welcome_pending[MAX_CLIENTS + 1];  // Client got only Hello, waiting for Capabilities.
+    timeval accept_times[MAX_CLIENTS + 1];
+    bool compact_encoding[MAX_CLIENTS + 1]; // Client gets messages in compact encoding.
+    bool resumable[MAX_CLIENTS + 1];        // Client negotiated session resume.
+    bool pipelining[MAX_CLIENTS + 1];       // Client negotiated action pipelining.
+    bool view_sync[MAX_CLIENTS + 1];        // Client negotiated view sync, as a player he gets only his view.
+    size_t replay_bytes[MAX_CLIENTS + 1];   // Bytes of the replay client got on joining or resuming.
+    SendPool send_pool;                     // All messages to clients go through it.
+    WorkPool explosion_pool;                // Resolves explosions if there are many of them.
+
+    // Datagram transport, see common/compact.h.
+    uint64_t datagram_tokens[MAX_CLIENTS + 1];         // 0 - client does not use datagrams.
+    sockaddr_in6 datagram_addresses[MAX_CLIENTS + 1];  // Where client's last datagram came from.
+    bool has_datagram_address[MAX_CLIENTS + 1];
+    uint16_t datagram_acked[MAX_CLIENTS + 1];          // Last turn client surely has.
+    uint16_t datagram_sequences[MAX_CLIENTS + 1];      // Sequence number of the last action taken.
+
+    // Memory of containers that live as long as the game, released when it
+    // ends, and of those filled anew in every turn, released when the next
+    // turn starts. Declared before the containers, so it outlives them.
+    // Memory taken from the system by both is counted.
+    CountingResource game_accounting;
+    CountingResource turn_accounting;
+    std::pmr::unsynchronized_pool_resource game_memory{&game_accounting};
+    std::byte turn_buffer[TURN_MEMORY];
+    std::pmr::monotonic_buffer_resource turn_memory{turn_buffer, TURN_MEMORY, &turn_accounting};
 
     // Game data.
     Map<PlayerId, Player> players;
     Map<PlayerId, size_t> poll_ids;
     Set<PlayerId> disconnected_players;
     Map<PlayerId, Position> player_positions;
-    Set<Position> blocks;
-    Map<BombId, Bomb> bombs;
+    std::tuple<GenericBoard, SmallBoard, ChunkedBoard> boards; // Only one is used, chosen at startup.
+    MapFile map;                        // Blocks placed in Turn 0, if map file is used.
+    ArenaMap<BombId, Bomb> bombs{&game_memory};
     uint32_t next_bomb_id;
-    Set<PlayerId> robots_destroyed;     // Robots destroyed by single bomb.
-    Set<Position> blocks_destroyed;     // Blocks destroyed by single bomb.
-    Set<PlayerId> all_robots_destroyed; // Robots destroyed by all bombs in one round.
-    Set<Position> all_blocks_destroyed; // Blocks destroyed by all bombs in one round.
+    ArenaSet<PlayerId> robots_destroyed{&turn_memory};     // Robots destroyed by single bomb.
+    ArenaSet<Position> blocks_destroyed{&turn_memory};     // Blocks destroyed by single bomb.
+    ArenaSet<PlayerId> all_robots_destroyed{&turn_memory}; // Robots destroyed by all bombs in one round.
+    ArenaSet<Position> all_blocks_destroyed{&turn_memory}; // Blocks destroyed by all bombs in one round.
     Map<PlayerId, Score> scores;
+    uint64_t state_hash = 0; // Zobrist hash of positions, blocks, bombs and scores.
+    Map<PlayerId, uint64_t> session_tokens; // Used only if session resume is on.
+
+    // Area of interest. Used only if view radius is set.
+    bool record_events = false;
+    List<EventInfo> turn_events; // Events of the last Turn.
+    std::pmr::unordered_map<uint32_t, ArenaList<uint32_t>> events_index{&turn_memory}; // Events by 16x16 cells.
+    ArenaMap<BombId, uint32_t> explosions_index{&turn_memory}; // BombExploded events by bomb id.
+    bool has_view[MAX_CLIENTS + 1];
+    View views[MAX_CLIENTS + 1];  // Last view sent to client.
+    List<ArenaSet<BombId>> known_bombs; // Bombs client was told about, by poll id.
+    List<ArenaMap<PlayerId, Position>> known_positions; // Robots' positions client was told about, by poll id.
+    List<ArenaSet<Position>> stale_blocks; // Blocks destroyed in explosions client did not see, by poll id.
 
     // Server state.
     bool in_lobby = true;
     double time_to_next_round; // in milliseconds
     timeval last_time;         // Last time when update_time_during_game() was called.
+    size_t next_reader = 1;    // Poll id of client read first in the next loop iteration.
     uint16_t turn;
 
-    // Saved messages for clients that connect late.
-    List<uint8_t> all_accepted_player_messages;
-    List<uint8_t> all_turn_messages;
+    // Persistent lobby. Turn 0 of the next game is built in [next_game]
+    // during the last turn of the current one.
+    std::unique_ptr<ServerData> next_game;
+    List<uint8_t> prepared_turn_0; // Empty if Turn 0 is not prepared.
+
+    List<uint8_t> events_message; // Events of Turn being built, keeps its capacity.
+
+    // Saved messages for clients that connect late. They keep their capacity
+    // between games.
+    CountingResource replay_memory;
+    ArenaList<uint8_t> all_accepted_player_messages{&replay_memory};
+    ArenaList<uint8_t> all_turn_messages{&replay_memory};
+    ArenaList<size_t> turn_offsets{&replay_memory}; // Offset of each Turn in [all_turn_messages].
+    SharedMessage replay; // Messages for clients joining now, shared by all of them. Built when needed.
+
+    MemoryAccounting memory;
+    bool over_memory_budget = false; // True if the last check exceeded the budget.
 
     std::minstd_rand random;
 
-    ServerData(uint32_t seed, uint8_t players_count);
+    ServerData(uint32_t seed, uint8_t players_count, uint16_t size_x, uint16_t size_y);
+
+    // Returns board of type [Board] that keeps blocks.
+    template<class Board>
+    Board &board() {
+        return std::get<Board>(boards);
+    }
+
+    template<class Board>
+    const Board &board() const {
+        return std::get<Board>(boards);
+    }
 
     // Sets poll_descriptors[i].id to -1 for every i.
     void clear_poll_descriptors();
@@ -61,17 +183,78 @@ struct ServerData {
     // Sets clients_last_messages[i] to NO_MSG for every i.
     void clear_clients_last_messages();
 
+    // Queues [action] of client with poll id [poll_id] for turn [target_turn],
+    // replacing action queued for this turn before.
+    void queue_action(size_t poll_id, uint16_t target_turn, uint8_t action);
+
+    // Sets clients_last_messages of clients that queued actions for turn
+    // [target_turn] to these actions.
+    void take_queued_actions(uint16_t target_turn);
+
+    // Returns new random token from getrandom(2), never 0.
+    uint64_t new_token();
+
+    // Forgets datagram transport of client with poll id [poll_id].
+    void clear_datagram_session(size_t poll_id);
+
+    // Gives player [player_id] new random session token and returns it.
+    uint64_t issue_session_token(PlayerId player_id);
+
+    // Returns true if [token] belongs to a player of the current game and puts
+    // his id into [player_id].
+    bool find_session(uint64_t token, PlayerId &player_id) const;
+
+    // Drops actions queued by client with poll id [poll_id].
+    void clear_action_queue(size_t poll_id);
+
+    // Fills input budget of client with poll id [poll_id] to one full turn.
+    void reset_input_budget(size_t poll_id, uint32_t bytes_limit, uint32_t messages_limit);
+
+    // Refills input budget of client with poll id [poll_id] by time elapsed
+    // since the last refill. Budget grows by [bytes_limit] and [messages_limit]
+    // per [turn_duration] milliseconds. Clears [exceeded] when budget is full.
+    void refill_input_budget(size_t poll_id, uint32_t bytes_limit,
+                             uint32_t messages_limit, uint64_t turn_duration);
+
+    // Returns true if client with poll id [poll_id] was accepted at least
+    // [turn_duration] milliseconds ago.
+    bool welcome_expired(size_t poll_id, uint64_t turn_duration) const;
+
     // Updates [time_to_next_round] and [last_time].
     void update_time_during_game();
 
+    // Returns true if game is on and next turn should be processed, i.e. at
+    // least [turn_duration] milliseconds passed since the last one.
+    bool turn_due(uint64_t turn_duration);
+
     // Sets up all attributes so game can start in a correct state.
     void set_up_new_game();
 
-    // Sets up attributes for next turn.
+    // Sets up attributes for next turn. Releases turn memory.
     void next_turn();
 
-    // Clears game state after the game finished.
+    // Clears containers using turn memory and releases it.
+    void clear_turn_memory();
+
+    // Clears game state after the game finished. Releases game memory.
     void clear_state();
+
+    // Clears game state after the game finished, but players that are still
+    // connected stay accepted. They get new ids in order of the old ones.
+    void clear_state_keeping_players();
+
+    // Moves Turn 0 prepared in [next_game] into this game and returns Turn
+    // message. State must be cleared before.
+    template<class Board>
+    List<uint8_t> take_prepared_turn_0() {
+        std::swap(board<Board>(), next_game->board<Board>());
+        std::swap(player_positions, next_game->player_positions);
+        std::swap(turn_events, next_game->turn_events);
+        state_hash = next_game->state_hash;
+        List<uint8_t> message = std::move(prepared_turn_0);
+        prepared_turn_0.clear();
+        return message;
+    }
 };
 
 #endif // SERVER_DATA_H
@@ -1,23 +1,57 @@
 #include "server_engine.h"
 #include "../net/net.h"
+#include "../../common/compact.h"
+#include "../../common/err.h"
+#include "../../common/trace.h"
 
+#include <algorithm>
+#include <cstring>
 #include <unistd.h>
 
-// Sets up server's listening socket.
-static void set_up_listener(ServerData &data, uint16_t port) {
-    data.poll_descriptors[0].fd = bind_tcp_socket(port);
+// I/O done in one iteration of the main loop. Work above these budgets waits
+// for the next iteration, so that due turn is not delayed by floods.
+#define ACCEPTS_PER_ITERATION 4                   // New connections accepted.
+#define READ_BYTES_PER_ITERATION (4 * PACKET_LIMIT) // Bytes read from all clients.
+#define READ_CHUNK 16384                          // Bytes read from one client.
+#define DATAGRAMS_PER_ITERATION 64                // Datagrams received from all clients.
+#define UNSENT_BYTES_LIMIT (4 << 20)              // Unsent bytes of one client, besides his replay.
+
+// Sets up server's listening sockets.
+static void set_up_listeners(const ServerParameters &parameters, ServerData &data) {
+    data.poll_descriptors[0].fd = bind_tcp_socket(parameters.port);
     turn_off_nagle(data.poll_descriptors[0].fd);
     start_listening(data.poll_descriptors[0].fd, QUEUE_LENGTH);
+
+    if (!parameters.local_socket.empty()) {
+        data.poll_descriptors[LOCAL_LISTENER].fd = bind_local_socket(parameters.local_socket);
+        start_listening(data.poll_descriptors[LOCAL_LISTENER].fd, QUEUE_LENGTH);
+    }
+
+    if (parameters.datagram_port != 0) {
+        data.poll_descriptors[DATAGRAM_SOCKET].fd = bind_datagram_socket(parameters.datagram_port);
+    }
 }
 
 // Disconnects client with poll id [poll_id]. Client has poll id equal to x
 // when socket [data.poll_descriptors[x].fd] is responsible for communication
 // with him.
 static void disconnect_client(ServerData &data, size_t poll_id) {
-    close(data.poll_descriptors[poll_id].fd);
+    data.send_pool.close_client(poll_id, data.poll_descriptors[poll_id].fd);
     data.poll_descriptors[poll_id].fd = -1;
     data.clients_buffers[poll_id].clear();
     data.clients_last_messages[poll_id] = NO_MSG;
+    data.welcome_pending[poll_id] = false;
+    data.compact_encoding[poll_id] = false;
+    data.resumable[poll_id] = false;
+    data.pipelining[poll_id] = false;
+    data.view_sync[poll_id] = false;
+    data.replay_bytes[poll_id] = 0;
+    data.has_view[poll_id] = false;
+    data.known_bombs[poll_id].clear();
+    data.known_positions[poll_id].clear();
+    data.stale_blocks[poll_id].clear();
+    data.clear_action_queue(poll_id);
+    data.clear_datagram_session(poll_id);
     data.active_clients--;
 
     for (const auto & player_id : data.poll_ids) {
@@ -34,54 +68,164 @@ static void disconnect_if_not(bool send_succeeded, ServerData &data, size_t poll
     }
 }
 
-// Sends starting messages to new client with poll id [poll_id].
+// Disconnects clients whose messages could not be sent by send pool's threads.
+static void disconnect_failed_clients(ServerData &data) {
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        if (data.poll_descriptors[i].fd != -1 && data.send_pool.failed(i)) {
+            disconnect_client(data, i);
+        }
+    }
+}
+
+// Sends [message] to client with poll id [poll_id], in compact encoding if
+// client negotiated it. Returns true if sending succeeded (or was queued).
+static bool send_to_client(ServerData &data, size_t poll_id, const SharedMessage &message) {
+    return data.send_pool.send(poll_id, data.poll_descriptors[poll_id].fd, message, data.compact_encoding[poll_id]);
+}
+
+// Same as above, for message built only for this client.
+static bool send_to_client(ServerData &data, size_t poll_id, List<uint8_t> message) {
+    return send_to_client(data, poll_id, std::make_shared<const List<uint8_t>>(std::move(message)));
+}
+
+// Notes that client with poll id [poll_id] got all Turns of the current game
+// via TCP, so they are not sent in datagrams.
+static void confirm_turns_sent(ServerData &data, size_t poll_id) {
+    data.datagram_acked[poll_id] = data.in_lobby ? 0 : data.turn;
+}
+
+// Returns messages describing current lobby or game. They are built once for
+// all clients that join before the next AcceptedPlayer or Turn.
+static const SharedMessage &shared_replay(ServerData &data) {
+    if (data.replay == nullptr) {
+        List<uint8_t> messages;
+        if (data.in_lobby) {
+            messages.assign(data.all_accepted_player_messages.begin(), data.all_accepted_player_messages.end());
+        }
+        else {
+            messages = build_game_started(data);
+            messages.insert(messages.end(), data.all_turn_messages.begin(), data.all_turn_messages.end());
+        }
+        data.replay = std::make_shared<const List<uint8_t>>(std::move(messages));
+    }
+    return data.replay;
+}
+
+// Sends messages describing current lobby or game to client with poll id
+// [poll_id].
+static void catch_up(ServerData &data, size_t poll_id) {
+    confirm_turns_sent(data, poll_id);
+    data.welcome_pending[poll_id] = false;
+    const SharedMessage &replay = shared_replay(data);
+    data.replay_bytes[poll_id] = replay->size();
+    disconnect_if_not(send_to_client(data, poll_id, replay), data, poll_id);
+}
+
+// Returns true if server waits for Capabilities of new clients, as there is
+// a feature they can ask for.
+static bool negotiates_capabilities(const ServerParameters &parameters) {
+    return parameters.compact_encoding || parameters.session_resume || parameters.datagram_port != 0
+           || parameters.view_radius != 0;
+}
+
+// Sends starting messages to new client with poll id [poll_id]. If compact
+// encoding, session resume or datagrams are allowed, only Hello is sent and the rest waits
+// until client sends Capabilities (and Resume, if negotiated) or any other
+// message, or one turn passes.
 static void welcome(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
-    bool sends_succeeded = true;
-    sends_succeeded &= send_message(data.poll_descriptors[poll_id].fd,
-                                    build_hello(parameters), NO_FLAGS);
-    if (data.in_lobby) {
-        sends_succeeded &= send_message(data.poll_descriptors[poll_id].fd,
-                                        data.all_accepted_player_messages, NO_FLAGS);
+    if (!send_to_client(data, poll_id, build_hello(parameters))) {
+        disconnect_client(data, poll_id);
+        return;
+    }
+
+    if (negotiates_capabilities(parameters)) {
+        data.welcome_pending[poll_id] = true;
+        gettimeofday(&data.accept_times[poll_id], nullptr);
     }
     else {
-        sends_succeeded &= send_message(data.poll_descriptors[poll_id].fd,
-                                        build_game_started(data), NO_FLAGS);
-        sends_succeeded &= send_message(data.poll_descriptors[poll_id].fd,
-                                        data.all_turn_messages, NO_FLAGS);
+        catch_up(data, poll_id);
+    }
+}
+
+// Sends starting messages to clients that have been waiting for them for one
+// turn.
+static void welcome_expired_clients(const ServerParameters &parameters, ServerData &data) {
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        if (data.welcome_pending[i] && data.welcome_expired(i, parameters.turn_duration)) {
+            catch_up(data, i);
+        }
+    }
+}
+
+// Adds client connected via socket [client_fd] with address [address] and
+// sends to him starting messages. The socket is made non-blocking, messages
+// that do not fit wait in the client's outbox.
+static void add_client(const ServerParameters &parameters, ServerData &data,
+                       int client_fd, const std::string &address) {
+    for (size_t poll_id = 1; poll_id <= MAX_CLIENTS; poll_id++) {
+        if (data.poll_descriptors[poll_id].fd == -1) {
+            make_non_blocking(client_fd);
+            data.clients_addresses[poll_id] = address;
+            data.poll_descriptors[poll_id].fd = client_fd;
+            data.reset_input_budget(poll_id, parameters.input_bytes_limit, parameters.input_messages_limit);
+            data.active_clients++;
+            welcome(parameters, data, poll_id);
+            return;
+        }
     }
-    disconnect_if_not(sends_succeeded, data, poll_id);
 }
 
 // Accepts new client and sends to him starting messages if there is new client
-// who wants to join and accepting him is possible.
-static void try_accepting_new_client(const ServerParameters &parameters, ServerData &data) {
+// who wants to join and accepting him is possible. Returns true if connection
+// was taken from the queue.
+static bool try_accepting_new_client(const ServerParameters &parameters, ServerData &data) {
     if (!(data.poll_descriptors[0].revents & POLLIN) || data.active_clients >= MAX_CLIENTS) {
-        return;
+        return false;
     }
 
     sockaddr_in6 client_address;
     int client_fd = accept_connection(data.poll_descriptors[0].fd, &client_address);
     if (client_fd == -1) {
-        return;
+        data.poll_descriptors[0].revents = 0; // Queue is empty.
+        return false;
     }
 
-    if (!turn_off_nagle(client_fd)) {
+    std::string address_str = get_address(client_address);
+    if (!turn_off_nagle(client_fd) || address_str == "fail") {
         close(client_fd);
-        return;
+        return true;
     }
 
-    size_t poll_id;
-    for (poll_id = 1; poll_id <= MAX_CLIENTS; poll_id++) {
-        if (data.poll_descriptors[poll_id].fd == -1) {
-            std::string address_str = get_address(client_address);
-            if (address_str == "fail") {
-                close(client_fd);
-                return;
-            }
-            data.clients_addresses[poll_id] = address_str;
-            data.poll_descriptors[poll_id].fd = client_fd;
-            data.active_clients++;
-            welcome(parameters, data, poll_id);
+    add_client(parameters, data, client_fd, address_str);
+    return true;
+}
+
+// Accepts new client connected via local socket, if there is one and
+// accepting him is possible. Such clients have address "local". Returns true
+// if connection was taken from the queue.
+static bool try_accepting_new_local_client(const ServerParameters &parameters, ServerData &data) {
+    if (!(data.poll_descriptors[LOCAL_LISTENER].revents & POLLIN) || data.active_clients >= MAX_CLIENTS) {
+        return false;
+    }
+
+    int client_fd = accept(data.poll_descriptors[LOCAL_LISTENER].fd, nullptr, nullptr);
+    if (client_fd == -1) {
+        data.poll_descriptors[LOCAL_LISTENER].revents = 0;
+        return false;
+    }
+
+    add_client(parameters, data, client_fd, "local");
+    return true;
+}
+
+// Accepts at most ACCEPTS_PER_ITERATION new clients. Stops earlier when the
+// next turn is due.
+static void accept_new_clients(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("accept_new_clients");
+    for (int i = 0; i < ACCEPTS_PER_ITERATION && !data.turn_due(parameters.turn_duration); i++) {
+        bool accepted = try_accepting_new_client(parameters, data);
+        accepted |= try_accepting_new_local_client(parameters, data);
+        if (!accepted) {
             return;
         }
     }
@@ -105,56 +249,162 @@ static void create_new_player(ServerData &data, size_t poll_id, const std::strin
     data.players[(PlayerId) data.players.size()] = new_player;
 }
 
-// Sends [message] to all clients.
-static void send_message_to_all(ServerData &data, const List<uint8_t> &message) {
+// Sends [message] to all clients, except those waiting for starting messages,
+// which will get it with them.
+static void send_message_to_all(ServerData &data, const SharedMessage &message) {
+    TRACE_SPAN("send_message_to_all");
     for (int i = 1; i <= MAX_CLIENTS; i++) {
-        if (data.poll_descriptors[i].fd != -1) {
-            disconnect_if_not(send_message(data.poll_descriptors[i].fd, message, NO_FLAGS), data, i);
+        if (data.poll_descriptors[i].fd != -1 && !data.welcome_pending[i]) {
+            disconnect_if_not(send_to_client(data, i, message), data, i);
         }
     }
 }
 
+// Same as above, for message not shared yet.
+static void send_message_to_all(ServerData &data, List<uint8_t> message) {
+    send_message_to_all(data, std::make_shared<const List<uint8_t>>(std::move(message)));
+}
+
 // Sends AcceptedPlayer message to all clients. Client with poll id [poll_id]
 // is the accepted player.
 static void send_accepted_player_to_all(ServerData &data, size_t poll_id) {
     List<uint8_t> message = build_accepted_player(data, poll_id);
     data.all_accepted_player_messages.insert(data.all_accepted_player_messages.end(),
                                              message.begin(), message.end());
-    send_message_to_all(data, message);
+    data.replay = nullptr;
+    send_message_to_all(data, std::move(message));
 }
 
 // Sends GameStarted message to all clients.
 static void send_game_started_to_all(ServerData &data) {
-    List<uint8_t> message = build_game_started(data);
-    send_message_to_all(data, message);
+    send_message_to_all(data, build_game_started(data));
+}
+
+// Sends Turns client with poll id [poll_id] has not confirmed yet in one
+// datagram. They are sent via TCP instead if [reliable] is set, if they do not
+// fit in a datagram or if client has not sent any datagram yet.
+static void send_unconfirmed_turns(ServerData &data, size_t poll_id, bool reliable) {
+    static uint8_t datagram[MAX_DATAGRAM];
+
+    size_t begin = data.turn_offsets[data.datagram_acked[poll_id] + 1];
+    size_t length = data.all_turn_messages.size() - begin;
+    const uint8_t *turns = data.all_turn_messages.data() + begin;
+    if (reliable || !data.has_datagram_address[poll_id] || sizeof(uint64_t) + length > MAX_DATAGRAM) {
+        disconnect_if_not(send_to_client(data, poll_id, List<uint8_t>(turns, turns + length)), data, poll_id);
+        confirm_turns_sent(data, poll_id);
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        datagram[i] = (uint8_t) (data.datagram_tokens[poll_id] >> (56 - 8 * i));
+    }
+    memcpy(datagram + sizeof(uint64_t), turns, length);
+    // Lost datagram is no different from failed sending, Turns are sent again.
+    send_datagram(data.poll_descriptors[DATAGRAM_SOCKET].fd, data.datagram_addresses[poll_id],
+                  datagram, sizeof(uint64_t) + length);
+}
+
+// Sends Turn [message] to all clients. If view radius is set, players that are
+// still connected and negotiated view sync get only events around their
+// robots, other clients get the whole [message]. Otherwise clients using datagrams get all Turns they have
+// not confirmed, in a datagram unless it is Turn 0 or the last Turn.
+template<class Board>
+static void send_turn_message_to_all(const ServerParameters &parameters, ServerData &data,
+                                     const SharedMessage &message, bool initial) {
+    TRACE_SPAN("send_turn_message_to_all");
+    if (parameters.view_radius == 0) {
+        for (int i = 1; i <= MAX_CLIENTS; i++) {
+            if (data.poll_descriptors[i].fd == -1 || data.welcome_pending[i]) {
+                continue;
+            }
+            if (data.datagram_tokens[i] != 0 && !initial) {
+                send_unconfirmed_turns(data, i, data.turn == parameters.game_length);
+            }
+            else {
+                data.datagram_acked[i] = 0;
+                disconnect_if_not(send_to_client(data, i, message), data, i);
+            }
+        }
+        return;
+    }
+
+    bool filtered[MAX_CLIENTS + 1] = {};
+    index_turn_events(data);
+    for (const auto &player_id : data.poll_ids) {
+        size_t poll_id = player_id.second;
+        if (data.disconnected_players.contains(player_id.first) || data.poll_descriptors[poll_id].fd == -1
+            || !data.view_sync[poll_id]) {
+            continue;
+        }
+        filtered[poll_id] = true;
+        List<uint8_t> client_message = build_turn_for_client<Board>(parameters, data, poll_id, *message, initial);
+        disconnect_if_not(send_to_client(data, poll_id, std::move(client_message)), data, poll_id);
+    }
+
+    for (int i = 1; i <= MAX_CLIENTS; i++) {
+        if (!filtered[i] && data.poll_descriptors[i].fd != -1 && !data.welcome_pending[i]) {
+            disconnect_if_not(send_to_client(data, i, message), data, i);
+        }
+    }
 }
 
-// Sends Turn message with turn = 0 to all clients.
+// Sends Turn message with turn = 0 to all clients. Uses Turn 0 prepared
+// during the previous game if there is one.
+template<class Board>
 static void send_turn_0_to_all(const ServerParameters &parameters, ServerData &data) {
-    List<uint8_t> message = build_turn_0(parameters, data);
+    List<uint8_t> message = data.prepared_turn_0.empty() ? build_turn_0<Board>(parameters, data)
+                                                         : data.take_prepared_turn_0<Board>();
+    if (parameters.publish_hash) {
+        List<uint8_t> hash_message = build_turn_hash(0, data);
+        message.insert(message.end(), hash_message.begin(), hash_message.end());
+    }
+    data.turn_offsets.push_back(data.all_turn_messages.size());
     data.all_turn_messages.insert(data.all_turn_messages.end(), message.begin(), message.end());
-    send_message_to_all(data, message);
+    data.replay = nullptr;
+    send_turn_message_to_all<Board>(parameters, data, std::make_shared<const List<uint8_t>>(std::move(message)), true);
 }
 
 // Sends Turn message with turn != 0 to all clients.
+template<class Board>
 static void send_turn_to_all(const ServerParameters &parameters, ServerData &data) {
-    List<uint8_t> message = build_turn(parameters, data);
+    List<uint8_t> message = build_turn<Board>(parameters, data);
+    if (parameters.publish_hash) {
+        List<uint8_t> hash_message = build_turn_hash(data.turn, data);
+        message.insert(message.end(), hash_message.begin(), hash_message.end());
+    }
+    data.turn_offsets.push_back(data.all_turn_messages.size());
     data.all_turn_messages.insert(data.all_turn_messages.end(), message.begin(), message.end());
-    send_message_to_all(data, message);
+    data.replay = nullptr;
+    send_turn_message_to_all<Board>(parameters, data, std::make_shared<const List<uint8_t>>(std::move(message)), false);
 }
 
 // Sends GameEnded message to all clients.
 static void send_game_ended_to_all(ServerData &data) {
-    List<uint8_t> message = build_game_ended(data);
-    send_message_to_all(data, message);
+    send_message_to_all(data, build_game_ended(data));
+}
+
+// Gives player [player_id] playing from client with poll id [poll_id] new
+// session token, if session resume is on. Token is sent to the client if it
+// negotiated session resume.
+static void start_session(const ServerParameters &parameters, ServerData &data, size_t poll_id,
+                          PlayerId player_id) {
+    if (!parameters.session_resume) {
+        return;
+    }
+
+    uint64_t token = data.issue_session_token(player_id);
+    if (data.resumable[poll_id] && data.poll_descriptors[poll_id].fd != -1) {
+        disconnect_if_not(send_to_client(data, poll_id, build_session(player_id, token)), data, poll_id);
+    }
 }
 
 // Processes Join message read from client with poll id [poll_id].
-static void process_join_from_client(ServerData &data, uint8_t players_count, size_t poll_id) {
+static void process_join_from_client(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
     std::string name = read_join(data.clients_buffers[poll_id]);
-    if (data.in_lobby && data.players.size() < players_count && !is_player(data, poll_id)) {
+    if (data.in_lobby && data.players.size() < parameters.players_count && !is_player(data, poll_id)) {
         create_new_player(data, poll_id, name);
         send_accepted_player_to_all(data, poll_id);
+        start_session(parameters, data, poll_id, (PlayerId) (data.players.size() - 1));
     }
 }
 
@@ -182,14 +432,227 @@ static void process_move_from_client(ServerData &data, size_t poll_id) {
     }
 }
 
+// Processes TaggedAction message read from client with poll id [poll_id].
+// Action for the next turn is taken as usual, actions for further turns are
+// queued, if they are not too far ahead.
+static void process_tagged_action_from_client(const ServerParameters &parameters, ServerData &data,
+                                              size_t poll_id) {
+    uint16_t target_turn;
+    uint8_t action = read_tagged_action(data.clients_buffers[poll_id], target_turn);
+    if (data.in_lobby || target_turn <= data.turn || target_turn - data.turn > parameters.action_queue) {
+        return;
+    }
+
+    if (target_turn == data.turn + 1) {
+        data.clients_last_messages[poll_id] = action;
+    }
+    else {
+        data.queue_action(poll_id, target_turn, action);
+    }
+}
+
+// Processes Capabilities message read from client with poll id [poll_id].
+// Answers with accepted flags, messages sent after the answer use compact
+// encoding if it was accepted.
+static void process_capabilities_from_client(const ServerParameters &parameters, ServerData &data,
+                                             size_t poll_id) {
+    uint8_t flags = read_capabilities(data.clients_buffers[poll_id]);
+    uint8_t accepted = parameters.compact_encoding ? flags & CAPABILITY_COMPACT : 0;
+    if (parameters.action_queue > 0) {
+        accepted |= flags & CAPABILITY_PIPELINING;
+    }
+    if (parameters.session_resume) {
+        accepted |= flags & CAPABILITY_RESUME;
+    }
+    if (parameters.view_radius != 0) {
+        accepted |= flags & CAPABILITY_VIEW_SYNC;
+    }
+    if (parameters.datagram_port != 0 && parameters.view_radius == 0 && (flags & CAPABILITY_DATAGRAMS)) {
+        accepted = (uint8_t) ((accepted | CAPABILITY_DATAGRAMS) & ~CAPABILITY_COMPACT);
+    }
+    if (!send_to_client(data, poll_id, build_capabilities(accepted))) {
+        disconnect_client(data, poll_id);
+        return;
+    }
+
+    if (accepted & CAPABILITY_DATAGRAMS) {
+        data.clear_datagram_session(poll_id);
+        data.datagram_tokens[poll_id] = data.new_token();
+        List<uint8_t> message = build_datagram_session(data.datagram_tokens[poll_id], parameters.datagram_port);
+        if (!send_to_client(data, poll_id, std::move(message))) {
+            disconnect_client(data, poll_id);
+            return;
+        }
+    }
+
+    if (accepted & CAPABILITY_COMPACT) {
+        data.compact_encoding[poll_id] = true;
+    }
+    data.resumable[poll_id] = accepted & CAPABILITY_RESUME;
+    data.pipelining[poll_id] = accepted & CAPABILITY_PIPELINING;
+    data.view_sync[poll_id] = accepted & CAPABILITY_VIEW_SYNC;
+    if (data.welcome_pending[poll_id] && !data.resumable[poll_id]) {
+        catch_up(data, poll_id);
+    }
+}
+
+// Processes Resume message read from client with poll id [poll_id]. If client
+// has token of a player of the current game, he takes over the player and gets
+// only messages he missed, or GameStarted and his view in the next Turn if he
+// negotiated view sync. Otherwise he gets the usual starting messages.
+static void process_resume_from_client(ServerData &data, size_t poll_id) {
+    uint64_t token;
+    bool in_game;
+    uint16_t turn;
+    read_resume(data.clients_buffers[poll_id], token, in_game, turn);
+    if (!data.welcome_pending[poll_id]) {
+        return;
+    }
+
+    PlayerId player_id;
+    if (!data.resumable[poll_id] || !data.find_session(token, player_id)
+        || (in_game && (data.in_lobby || turn > data.turn))) {
+        catch_up(data, poll_id);
+        return;
+    }
+
+    size_t old_poll_id = data.poll_ids[player_id];
+    if (old_poll_id != poll_id && !data.disconnected_players.contains(player_id)) {
+        disconnect_client(data, old_poll_id); // Old connection is still open.
+    }
+    data.poll_ids[player_id] = poll_id;
+    data.disconnected_players.erase(player_id);
+    data.welcome_pending[poll_id] = false;
+
+    List<uint8_t> messages = build_session(player_id, token);
+    if (data.in_lobby) {
+        messages.insert(messages.end(), data.all_accepted_player_messages.begin(),
+                        data.all_accepted_player_messages.end());
+    }
+    else if (data.view_sync[poll_id]) {
+        // Missed Turns were not built for his view. Client starts the game
+        // over and his view is built from scratch in the next Turn.
+        List<uint8_t> game_started = build_game_started(data);
+        messages.insert(messages.end(), game_started.begin(), game_started.end());
+    }
+    else {
+        size_t missed_from = 0;
+        if (!in_game) {
+            List<uint8_t> game_started = build_game_started(data);
+            messages.insert(messages.end(), game_started.begin(), game_started.end());
+        }
+        else if (turn < data.turn) {
+            missed_from = data.turn_offsets[turn + 1];
+        }
+        else {
+            missed_from = data.all_turn_messages.size();
+        }
+        messages.insert(messages.end(), data.all_turn_messages.begin() + (ssize_t) missed_from,
+                        data.all_turn_messages.end());
+    }
+    confirm_turns_sent(data, poll_id);
+    data.replay_bytes[poll_id] = messages.size();
+    disconnect_if_not(send_to_client(data, poll_id, std::move(messages)), data, poll_id);
+}
+
+// Reports that client with poll id [poll_id] exceeded its input budget and
+// disconnects him if [parameters.disconnect_flooders] is set.
+static void handle_flooding_client(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
+    if (!data.input_budgets[poll_id].exceeded) {
+        fprintf(stderr, "Client %s exceeded input limits.\n", data.clients_addresses[poll_id].c_str());
+        data.input_budgets[poll_id].exceeded = true;
+    }
+
+    if (parameters.disconnect_flooders) {
+        disconnect_client(data, poll_id);
+    }
+}
+
+// Returns true if client with poll id [poll_id] can send one more message.
+// If so, the message is taken from his budget. Join, Capabilities and Resume
+// are not limited, they do not come in floods from correct clients.
+static bool take_message_from_budget(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
+    const InputBuffer &buffer = data.clients_buffers[poll_id];
+    if (parameters.input_messages_limit == 0 || client_sent_join(buffer) || client_sent_capabilities(buffer)
+        || client_sent_resume(buffer)) {
+        return true;
+    }
+    if (data.input_budgets[poll_id].messages < 1) {
+        return false;
+    }
+    data.input_budgets[poll_id].messages--;
+    return true;
+}
+
+// Drops complete actions stored in [data.clients_buffers[poll_id]] up to the
+// next Join, Capabilities or Resume, keeping only the last action. Used when
+// client exceeded his messages budget, as server takes into account only the
+// last action in turn anyway.
+static void collapse_clients_buffer(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
+    uint8_t last_action = NO_MSG;
+    size_t skipped;
+    if (!skip_complete_messages(data.clients_buffers[poll_id], data.pipelining[poll_id], last_action, skipped)) {
+        disconnect_client(data, poll_id);
+        return;
+    }
+
+    if (skipped > 0) {
+        if (!data.in_lobby && last_action != NO_MSG) {
+            data.clients_last_messages[poll_id] = last_action;
+        }
+        handle_flooding_client(parameters, data, poll_id);
+    }
+}
+
+// Returns true if client with poll id [poll_id] sent incorrect message. Tagged
+// Action is incorrect if client did not negotiate pipelining.
+static bool client_sent_incorrect_message(const ServerData &data, size_t poll_id) {
+    return client_sent_incorrect_message(data.clients_buffers[poll_id])
+           || (!data.pipelining[poll_id] && client_sent_tagged_action(data.clients_buffers[poll_id]));
+}
+
 // Reads complete messages stored in [data.clients_buffers[poll_id]] it is all
-// full messages received from all clients.
+// full messages received from all clients. Messages above client's budget are
+// collapsed.
 static void clear_clients_buffer(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
     bool finished_clearing = false;
 
     while (!finished_clearing) {
-        if (client_sent_join(data.clients_buffers[poll_id])) {
-            process_join_from_client(data, parameters.players_count, poll_id);
+        if (client_sent_incorrect_message(data, poll_id)) {
+            finished_clearing = true;
+            disconnect_client(data, poll_id);
+        }
+        else if (!client_sent_join(data.clients_buffers[poll_id])
+                 && !client_sent_place_bomb(data.clients_buffers[poll_id])
+                 && !client_sent_place_block(data.clients_buffers[poll_id])
+                 && !client_sent_move(data.clients_buffers[poll_id])
+                 && !client_sent_capabilities(data.clients_buffers[poll_id])
+                 && !client_sent_tagged_action(data.clients_buffers[poll_id])
+                 && !client_sent_resume(data.clients_buffers[poll_id])) {
+            finished_clearing = true;
+        }
+        else if (data.welcome_pending[poll_id] && !client_sent_capabilities(data.clients_buffers[poll_id])
+                 && !client_sent_resume(data.clients_buffers[poll_id])) {
+            catch_up(data, poll_id);
+            finished_clearing = data.poll_descriptors[poll_id].fd == -1;
+        }
+        else if (!take_message_from_budget(parameters, data, poll_id)) {
+            collapse_clients_buffer(parameters, data, poll_id);
+            finished_clearing = data.poll_descriptors[poll_id].fd == -1;
+        }
+        else if (client_sent_capabilities(data.clients_buffers[poll_id])) {
+            process_capabilities_from_client(parameters, data, poll_id);
+            finished_clearing = data.poll_descriptors[poll_id].fd == -1;
+        }
+        else if (client_sent_resume(data.clients_buffers[poll_id])) {
+            process_resume_from_client(data, poll_id);
+            finished_clearing = data.poll_descriptors[poll_id].fd == -1;
+        }
+        else if (client_sent_join(data.clients_buffers[poll_id])) {
+            process_join_from_client(parameters, data, poll_id);
+        }
+        else if (client_sent_tagged_action(data.clients_buffers[poll_id])) {
+            process_tagged_action_from_client(parameters, data, poll_id);
         }
         else if (client_sent_place_bomb(data.clients_buffers[poll_id])) {
             process_place_bomb_from_client(data, poll_id);
@@ -197,91 +660,392 @@ static void clear_clients_buffer(const ServerParameters &parameters, ServerData
         else if (client_sent_place_block(data.clients_buffers[poll_id])) {
             process_place_block_from_client(data, poll_id);
         }
-        else if (client_sent_move(data.clients_buffers[poll_id])) {
-            process_move_from_client(data, poll_id);
-        }
         else {
-            finished_clearing = true;
-            if (client_sent_incorrect_message(data.clients_buffers[poll_id])) {
-                disconnect_client(data, poll_id);
-            }
+            process_move_from_client(data, poll_id);
         }
     }
 }
 
-// Reads all bytes received from client with poll id [poll_id].
-static void read_from_client(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
-    static uint8_t buffer[PACKET_LIMIT];
+// Refills input budget of client with poll id [poll_id], if input is limited.
+static void refill_input_budget(const ServerParameters &parameters, ServerData &data, size_t poll_id) {
+    if (parameters.input_bytes_limit != 0 || parameters.input_messages_limit != 0) {
+        data.refill_input_budget(poll_id, parameters.input_bytes_limit,
+                                 parameters.input_messages_limit, parameters.turn_duration);
+    }
+}
+
+// Reads bytes received from client with poll id [poll_id], no more than
+// [max_length] and his bytes budget allow. Returns number of bytes read.
+static size_t read_from_client(const ServerParameters &parameters, ServerData &data,
+                               size_t poll_id, size_t max_length) {
+    static uint8_t buffer[READ_CHUNK];
+
+    refill_input_budget(parameters, data, poll_id);
 
-    ssize_t read_bytes = read(data.poll_descriptors[poll_id].fd, buffer, PACKET_LIMIT);
+    max_length = std::min(max_length, (size_t) READ_CHUNK);
+    if (parameters.input_bytes_limit != 0) {
+        max_length = std::min(max_length, (size_t) data.input_budgets[poll_id].bytes);
+        if (max_length == 0) {
+            handle_flooding_client(parameters, data, poll_id);
+            return 0;
+        }
+    }
+
+    ssize_t read_bytes = read(data.poll_descriptors[poll_id].fd, buffer, max_length);
+    if (read_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
     if (read_bytes <= 0) {
         disconnect_client(data, poll_id);
+        return 0;
     }
-    else {
-        for (ssize_t i = 0; i < read_bytes; i++) {
-            data.clients_buffers[poll_id].push_back(buffer[i]);
+
+    data.input_budgets[poll_id].bytes -= (double) read_bytes;
+    data.clients_buffers[poll_id].insert(data.clients_buffers[poll_id].end(), buffer, buffer + read_bytes);
+    clear_clients_buffer(parameters, data, poll_id);
+    return (size_t) read_bytes;
+}
+
+// Reads bytes received from clients, at most READ_BYTES_PER_ITERATION in
+// total. Stops earlier when the next turn is due. Clients are read in turns
+// starting from [data.next_reader], so that the ones left unread are read
+// first in the next iteration.
+static void read_from_all_clients(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("read_from_all_clients");
+    size_t budget = READ_BYTES_PER_ITERATION;
+    size_t poll_id = data.next_reader;
+
+    for (int i = 0; i < MAX_CLIENTS && budget > 0; i++) {
+        if (data.poll_descriptors[poll_id].fd != -1
+            && (data.poll_descriptors[poll_id].revents & (POLLIN | POLLERR))) {
+            if (data.turn_due(parameters.turn_duration)) {
+                break;
+            }
+            budget -= read_from_client(parameters, data, poll_id, budget);
         }
+        poll_id = poll_id % MAX_CLIENTS + 1;
+    }
 
-        clear_clients_buffer(parameters, data, poll_id);
+    data.next_reader = poll_id;
+}
+
+// Watches sockets of clients with bytes waiting in their outboxes for writing.
+static void watch_pending_output(ServerData &data) {
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        data.poll_descriptors[i].events = data.send_pool.pending(i) ? POLLIN | POLLOUT : POLLIN;
     }
 }
 
-// Reads all bytes received from all clients.
-static void read_from_all_clients(const ServerParameters &parameters, ServerData &data) {
-    for (int i = 1; i <= MAX_CLIENTS; i++) {
-        if (data.poll_descriptors[i].fd != -1
-            && (data.poll_descriptors[i].revents & (POLLIN | POLLERR))) {
-            read_from_client(parameters, data, i);
+// Writes one chunk of outbox of every client whose socket is ready. Stops
+// when the next turn is due, so a client that reads slowly (e.g. catching up
+// with a long game) does not delay it.
+static void write_to_all_clients(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("write_to_all_clients");
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        if (data.poll_descriptors[i].fd == -1 || !(data.poll_descriptors[i].revents & (POLLOUT | POLLERR))
+            || !data.send_pool.pending(i)) {
+            continue;
+        }
+        if (data.turn_due(parameters.turn_duration)) {
+            return;
+        }
+        disconnect_if_not(data.send_pool.write(i), data, i);
+    }
+}
+
+// Processes [datagram] received from [address]. Datagram is ignored if its
+// token is not known. Actions not taken before are taken in order, each one
+// counts as a message of client's budget.
+static void process_datagram(const ServerParameters &parameters, ServerData &data,
+                             const ClientDatagram &datagram, const sockaddr_in6 &address) {
+    size_t poll_id = 1;
+    while (poll_id <= MAX_CLIENTS && (data.datagram_tokens[poll_id] != datagram.token || datagram.token == 0)) {
+        poll_id++;
+    }
+    if (poll_id > MAX_CLIENTS) {
+        return;
+    }
+
+    data.datagram_addresses[poll_id] = address;
+    data.has_datagram_address[poll_id] = true;
+    if (!data.in_lobby && datagram.acked_turn <= data.turn && datagram.acked_turn > data.datagram_acked[poll_id]) {
+        data.datagram_acked[poll_id] = datagram.acked_turn;
+    }
+
+    refill_input_budget(parameters, data, poll_id);
+    for (uint8_t i = 0; i < datagram.actions_count && data.poll_descriptors[poll_id].fd != -1; i++) {
+        if ((int16_t) (datagram.sequences[i] - data.datagram_sequences[poll_id]) <= 0) {
+            continue; // Taken before.
+        }
+        data.datagram_sequences[poll_id] = datagram.sequences[i];
+        if (!take_message_from_budget(parameters, data, poll_id)) {
+            handle_flooding_client(parameters, data, poll_id);
+        }
+        else if (!data.in_lobby) {
+            data.clients_last_messages[poll_id] = datagram.actions[i];
+        }
+    }
+}
+
+// Receives at most DATAGRAMS_PER_ITERATION datagrams. Stops earlier when the
+// next turn is due.
+static void read_datagrams(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("read_datagrams");
+    static uint8_t buffer[MAX_DATAGRAM];
+
+    if (!(data.poll_descriptors[DATAGRAM_SOCKET].revents & POLLIN)) {
+        return;
+    }
+    for (int i = 0; i < DATAGRAMS_PER_ITERATION && !data.turn_due(parameters.turn_duration); i++) {
+        sockaddr_in6 address{};
+        auto address_length = (socklen_t) sizeof(address);
+        ssize_t length = recvfrom(data.poll_descriptors[DATAGRAM_SOCKET].fd, buffer, sizeof(buffer), 0,
+                                  (sockaddr *) &address, &address_length);
+        if (length < 0) {
+            return; // No more datagrams.
+        }
+
+        ClientDatagram datagram;
+        if (read_client_datagram(buffer, (size_t) length, datagram)) {
+            process_datagram(parameters, data, datagram, address);
+        }
+    }
+}
+
+// Builds Turn 0 of the next game in [data.next_game], so that the next game
+// can start right after the current one. Random numbers are drawn from
+// [data.random], as if the next game already started.
+template<class Board>
+static void prepare_next_game(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("prepare_next_game");
+    ServerData &next = *data.next_game;
+    next.board<Board>().clear();
+    next.player_positions.clear();
+    next.state_hash = 0;
+    next.random = data.random;
+    data.prepared_turn_0 = build_turn_0<Board>(parameters, next);
+    data.random = next.random;
+}
+
+// Prepares the next game if lobby is persistent and the last turn of the
+// current game is coming.
+template<class Board>
+static void prepare_next_game_if_needed(const ServerParameters &parameters, ServerData &data) {
+    if (parameters.persistent_lobby && data.turn + 1 == parameters.game_length
+        && data.prepared_turn_0.empty()) {
+        prepare_next_game<Board>(parameters, data);
+    }
+}
+
+// Returns memory of [resource] since the last call, counted from now on.
+static std::pair<size_t, size_t> take_usage(CountingResource &resource) {
+    size_t peak = resource.peak();
+    resource.reset_peak();
+    return {resource.current(), peak};
+}
+
+// Updates memory used by server's subsystems. Called at turn boundaries.
+template<class Board>
+static void account_memory(ServerData &data) {
+    auto [game, game_peak] = take_usage(data.game_accounting);
+    size_t board = data.board<Board>().memory_usage();
+    data.memory.update(MEMORY_GAME, game + board, game_peak + board, data.game_accounting.allocations());
+
+    auto [turn, turn_peak] = take_usage(data.turn_accounting);
+    size_t turn_buffers = TURN_MEMORY + data.events_message.capacity()
+                          + data.turn_events.capacity() * sizeof(EventInfo);
+    data.memory.update(MEMORY_TURN, turn + turn_buffers, turn_peak + turn_buffers,
+                       data.turn_accounting.allocations());
+
+    auto [replay, replay_peak] = take_usage(data.replay_memory);
+    data.memory.update(MEMORY_REPLAY, replay, replay_peak, data.replay_memory.allocations());
+
+    size_t input = 0;
+    size_t input_peak = 0;
+    uint64_t input_allocations = 0;
+    size_t output = 0;
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        auto [client_input, client_input_peak] = take_usage(data.input_memory[i]);
+        input += client_input;
+        input_peak += client_input_peak;
+        input_allocations += data.input_memory[i].allocations();
+        output += data.send_pool.queued_bytes(i);
+    }
+    data.memory.update(MEMORY_INPUT, input, input_peak, input_allocations);
+    data.memory.update(MEMORY_OUTPUT, output, output, 0);
+}
+
+// Returns number of unsent bytes above which client with poll id [poll_id] is
+// disconnected, even without client memory budget: the replay he got on
+// joining, Turn 0 of the game (it carries the board) and UNSENT_BYTES_LIMIT of
+// other messages.
+static size_t unsent_bytes_limit(const ServerData &data, size_t poll_id) {
+    size_t turn_0_bytes = data.turn_offsets.size() > 1 ? data.turn_offsets[1] : data.all_turn_messages.size();
+    return data.replay_bytes[poll_id] + turn_0_bytes + UNSENT_BYTES_LIMIT;
+}
+
+// Disconnects clients that fell behind with unsent messages or whose
+// unprocessed input and unsent messages exceed [parameters.client_memory_budget]
+// and warns when server exceeds [parameters.memory_budget].
+static void enforce_memory_budgets(const ServerParameters &parameters, ServerData &data) {
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        if (data.poll_descriptors[i].fd == -1) {
+            continue;
+        }
+        size_t unsent = data.send_pool.queued_bytes(i);
+        size_t bytes = data.input_memory[i].current() + unsent;
+        if (unsent > unsent_bytes_limit(data, i)) {
+            fprintf(stderr, "Client %s fell behind with %.1f KiB of unsent messages.\n",
+                    data.clients_addresses[i].c_str(), (double) unsent / 1024);
+            disconnect_client(data, i);
+        }
+        else if (parameters.client_memory_budget > 0 && bytes > (size_t) parameters.client_memory_budget * 1024) {
+            fprintf(stderr, "Client %s exceeded memory budget with %.1f KiB.\n",
+                    data.clients_addresses[i].c_str(), (double) bytes / 1024);
+            disconnect_client(data, i);
+        }
+    }
+
+    bool over_budget = parameters.memory_budget > 0 && data.memory.total() > (size_t) parameters.memory_budget * 1024;
+    if (over_budget && !data.over_memory_budget) {
+        fprintf(stderr, "Server exceeded memory budget with %.1f KiB.\n", (double) data.memory.total() / 1024);
+    }
+    data.over_memory_budget = over_budget;
+}
+
+// Accounts memory after Turn [data.turn] was sent, reports it if it is time
+// for it and enforces budgets.
+template<class Board>
+static void check_memory(const ServerParameters &parameters, ServerData &data) {
+    account_memory<Board>(data);
+    if (parameters.memory_report > 0
+        && (data.turn % parameters.memory_report == 0 || data.turn == parameters.game_length)) {
+        data.memory.report(stderr, data.turn);
+    }
+    enforce_memory_budgets(parameters, data);
+}
+
+// Ends the game. In persistent lobby connected players stay accepted and all
+// clients are told about them, so the next game can start without Join.
+static void end_game(const ServerParameters &parameters, ServerData &data) {
+    send_game_ended_to_all(data);
+    TRACE_DUMP();
+    if (!parameters.persistent_lobby) {
+        data.clear_state();
+        return;
+    }
+
+    data.clear_state_keeping_players();
+    for (const auto &player_id : data.poll_ids) {
+        send_accepted_player_to_all(data, player_id.second);
+        start_session(parameters, data, player_id.second, player_id.first);
+    }
+}
+
+// Gives clients using datagrams new tokens, so that datagrams of the previous
+// game are ignored.
+static void renew_datagram_sessions(const ServerParameters &parameters, ServerData &data) {
+    for (size_t i = 1; i <= MAX_CLIENTS; i++) {
+        if (data.datagram_tokens[i] != 0 && data.poll_descriptors[i].fd != -1) {
+            data.datagram_tokens[i] = data.new_token();
+            List<uint8_t> message = build_datagram_session(data.datagram_tokens[i], parameters.datagram_port);
+            disconnect_if_not(send_to_client(data, i, std::move(message)), data, i);
         }
     }
 }
 
 // Starts new game with parameters [parameters].
+template<class Board>
 static void start_new_game(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("start_new_game");
     send_game_started_to_all(data);
-    send_turn_0_to_all(parameters, data);
+    renew_datagram_sessions(parameters, data);
+    send_turn_0_to_all<Board>(parameters, data);
     data.set_up_new_game();
+    data.memory.reset_peaks();
+    check_memory<Board>(parameters, data);
     data.clear_clients_last_messages();
+    prepare_next_game_if_needed<Board>(parameters, data);
 }
 
 // Processes next turn.
+template<class Board>
 static void process_next_turn(const ServerParameters &parameters, ServerData &data) {
+    TRACE_SPAN("process_next_turn");
     data.next_turn();
-    send_turn_to_all(parameters, data);
+    send_turn_to_all<Board>(parameters, data);
+    check_memory<Board>(parameters, data);
 
     if (data.turn == parameters.game_length) {
-        send_game_ended_to_all(data);
-        data.clear_state();
+        end_game(parameters, data);
+    }
+    else {
+        prepare_next_game_if_needed<Board>(parameters, data);
     }
 
     data.clear_clients_last_messages();
+    if (!data.in_lobby) {
+        data.take_queued_actions(data.turn + 1);
+    }
 }
 
-[[noreturn]] void run(const ServerParameters &parameters) {
-    ServerData data(parameters.seed, parameters.players_count);
+// Runs server's main loop with blocks kept on board of type [Board].
+template<class Board>
+[[noreturn]] static void run_on_board(const ServerParameters &parameters) {
+    ServerData data(parameters.seed, parameters.players_count, parameters.size_x, parameters.size_y);
+    data.record_events = parameters.view_radius > 0;
+    if (!parameters.map_file.empty()) {
+        data.map = load_map_file(parameters.map_file);
+        if (data.map.size_x != parameters.size_x || data.map.size_y != parameters.size_y) {
+            fatal("Map file is for board %dx%d.", (int) data.map.size_x, (int) data.map.size_y);
+        }
+    }
+    if (parameters.persistent_lobby) {
+        data.next_game = std::make_unique<ServerData>(parameters.seed, parameters.players_count,
+                                                      parameters.size_x, parameters.size_y);
+        data.next_game->record_events = data.record_events;
+        data.next_game->map = data.map;
+    }
 
-    set_up_listener(data, parameters.port);
+    data.send_pool.start(parameters.send_threads, MAX_CLIENTS, parameters.size_x);
+    data.explosion_pool.start(parameters.explosion_threads);
+    set_up_listeners(parameters, data);
 
     while (true) {
         data.clear_poll_descriptors();
+        watch_pending_output(data);
 
-        int poll_status = poll(data.poll_descriptors, MAX_CLIENTS + 1, 0);
+        int poll_status = poll(data.poll_descriptors, POLL_DESCRIPTORS, 0);
         if (poll_status == -1) {
             continue; // Calling poll() failed, we try again.
         }
         else if (poll_status > 0) {
-            try_accepting_new_client(parameters, data);
+            accept_new_clients(parameters, data);
             read_from_all_clients(parameters, data);
+            read_datagrams(parameters, data);
+            write_to_all_clients(parameters, data);
+        }
+        disconnect_failed_clients(data);
+        if (negotiates_capabilities(parameters)) {
+            welcome_expired_clients(parameters, data);
         }
 
         if (data.in_lobby && data.players.size() == parameters.players_count) {
-            start_new_game(parameters, data);
+            start_new_game<Board>(parameters, data);
         }
-        else if (!data.in_lobby) {
-            data.update_time_during_game();
-            if ((uint64_t) data.time_to_next_round >= parameters.turn_duration) {
-                process_next_turn(parameters, data);
-            }
+        else if (data.turn_due(parameters.turn_duration)) {
+            process_next_turn<Board>(parameters, data);
         }
+        TRACE_POLL();
+    }
+}
+
+[[noreturn]] void run(const ServerParameters &parameters) {
+    TRACE_START("robots-server");
+    if (SmallBoard::fits(parameters.size_x, parameters.size_y)) {
+        run_on_board<SmallBoard>(parameters);
+    }
+    else {
+        run_on_board<ChunkedBoard>(parameters);
     }
 }
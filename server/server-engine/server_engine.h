@@ -3,7 +3,8 @@
 
 #include "../messages/messages.h"
 
-// Runs server with command line parameters [parameters].
+// Runs server with command line parameters [parameters]. Board implementation
+// (SmallBoard or ChunkedBoard) is chosen once, based on the board's size.
 [[noreturn]] void run(const ServerParameters &parameters);
 
 #endif // SERVER_ENGINE_H
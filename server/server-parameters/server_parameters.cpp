@@ -25,19 +25,53 @@ static void print_help() {
               << " -k <initial_blocks> -l <game_length>"
               << " -n <server_name> -p <port>"
               << " -s <seed> -x <size_x> -y <size_y>"
+              << " [-a <datagram_port>] [-f <disconnect_flooders>] [-g <exact_blocks>] [-i <input_bytes_limit>]"
+              << " [-j <input_messages_limit>] [-m <map_file>] [-o <send_threads>] [-q <action_queue>]"
+              << " [-r <persistent_lobby>] [-t <session_resume>] [-u <local_socket>] [-v <view_radius>]"
+              << " [-w <compact_encoding>] [-z <publish_hash>]"
+              << " [-B <memory_budget>] [-C <client_memory_budget>] [-E <explosion_threads>] [-M <memory_report>]"
               << "\n\nOPTIONS\n"
+              << "    -B <memory_budget> (optional, KiB of memory of all games and clients above which"
+              << " server warns, 0 - no budget, default 0)\n"
+              << "    -C <client_memory_budget> (optional, KiB of unprocessed input and unsent messages"
+              << " of one client above which client is disconnected, 0 - no budget, default 0; clients with more than"
+              << " 4 MiB of unsent messages besides the game they got on joining and Turn 0 are disconnected anyway)\n"
+              << "    -E <explosion_threads> (optional, threads resolving explosions with the main thread"
+              << " when many bombs explode at once, at most " << MAX_EXPLOSION_THREADS << ", default 0)\n"
+              << "    -M <memory_report> (optional, print memory used by server every given number of"
+              << " turns and at the end of every game, 0 - never, default 0)\n"
+              << "    -a <datagram_port> (optional, UDP port for turns and actions of clients that ask for it,"
+              << " 0 - off, default 0)\n"
               << "    -b <bomb_timer>\n"
               << "    -c <players_count>\n"
               << "    -d <turn_duration>\n"
               << "    -e <explosion_radius>\n"
+              << "    -f <disconnect_flooders> (optional, 0 or 1, default 0)\n"
+              << "    -g <exact_blocks> (optional, 0 or 1, place exactly initial_blocks distinct blocks, default 0)\n"
               << "    -h <help>\n"
-              << "    -k <initial_blocks>\n"
+              << "    -i <input_bytes_limit> (optional, per client and turn, 0 - no limit, default 0)\n"
+              << "    -j <input_messages_limit> (optional, per client and turn, 0 - no limit, default 0)\n"
+              << "    -k <initial_blocks> (not needed with -m)\n"
               << "    -l <game_length>\n"
+              << "    -m <map_file> (optional, blocks are read from map file instead of being random)\n"
               << "    -n <server_name>\n"
+              << "    -o <send_threads> (optional, threads sending messages to clients, 0 - main thread sends them, at most "
+              << MAX_SEND_THREADS << ", default 0)\n"
               << "    -p <port>\n"
+              << "    -q <action_queue> (optional, max number of turns clients can send actions ahead, 0 - "
+              << "action pipelining is off, at most " << MAX_ACTION_QUEUE << ", default 0)\n"
+              << "    -r <persistent_lobby> (optional, 0 or 1, connected players stay in lobby"
+              << " and the next game starts right after GameEnded, default 0)\n"
               << "    -s <seed> (optional)\n"
+              << "    -t <session_resume> (optional, 0 or 1, players can take over their robots after"
+              << " reconnecting, default 0)\n"
+              << "    -u <local_socket> (optional, path of Unix domain socket accepting local clients)\n"
+              << "    -v <view_radius> (optional, players whose clients ask for it get only events in this distance,"
+              << " 0 - everything, default 0)\n"
+              << "    -w <compact_encoding> (optional, 0 or 1, allow compact encoding requested by clients, default 0)\n"
               << "    -x <size_x>\n"
-              << "    -y <size_y>\n";
+              << "    -y <size_y>\n"
+              << "    -z <publish_hash> (optional, 0 or 1, send state hash after every turn, default 0)\n";
 }
 
 // Checks if uint with [bits] bits represented by [str] is correct.
@@ -105,10 +139,10 @@ static void read_explosion_radius(ServerParameters &parameters, const char *expl
 // Reads initial blocks. Changes [parameters] reference.
 static void read_initial_blocks(ServerParameters &parameters, const char *initial_blocks) {
     if (!parameters.read_initial_blocks) {
-        if (!check_uint(initial_blocks, 16)) {
+        if (!check_uint(initial_blocks, 32)) {
             fatal("Incorrect initial blocks %s.", initial_blocks);
         }
-        parameters.initial_blocks = (uint16_t) strtoull(initial_blocks, nullptr, 10);
+        parameters.initial_blocks = (uint32_t) strtoull(initial_blocks, nullptr, 10);
         parameters.read_initial_blocks = true;
     }
 }
@@ -184,10 +218,224 @@ static void read_size_y(ServerParameters &parameters, const char *size_y) {
     }
 }
 
+// Reads input bytes limit. Changes [parameters] reference.
+static void read_input_bytes_limit(ServerParameters &parameters, const char *input_bytes_limit) {
+    if (!parameters.read_input_bytes_limit) {
+        if (!check_uint(input_bytes_limit, 32)) {
+            fatal("Incorrect input bytes limit %s.", input_bytes_limit);
+        }
+        parameters.input_bytes_limit = (uint32_t) strtoull(input_bytes_limit, nullptr, 10);
+        parameters.read_input_bytes_limit = true;
+    }
+}
+
+// Reads input messages limit. Changes [parameters] reference.
+static void read_input_messages_limit(ServerParameters &parameters, const char *input_messages_limit) {
+    if (!parameters.read_input_messages_limit) {
+        if (!check_uint(input_messages_limit, 32)) {
+            fatal("Incorrect input messages limit %s.", input_messages_limit);
+        }
+        parameters.input_messages_limit = (uint32_t) strtoull(input_messages_limit, nullptr, 10);
+        parameters.read_input_messages_limit = true;
+    }
+}
+
+// Reads whether clients exceeding input limits are disconnected. Changes
+// [parameters] reference.
+static void read_disconnect_flooders(ServerParameters &parameters, const char *disconnect_flooders) {
+    if (!parameters.read_disconnect_flooders) {
+        if (strcmp(disconnect_flooders, "0") != 0 && strcmp(disconnect_flooders, "1") != 0) {
+            fatal("Incorrect disconnect flooders %s, available values: 0, 1.", disconnect_flooders);
+        }
+        parameters.disconnect_flooders = strcmp(disconnect_flooders, "1") == 0;
+        parameters.read_disconnect_flooders = true;
+    }
+}
+
+// Reads view radius. Changes [parameters] reference.
+static void read_view_radius(ServerParameters &parameters, const char *view_radius) {
+    if (!parameters.read_view_radius) {
+        if (!check_uint(view_radius, 16)) {
+            fatal("Incorrect view radius %s.", view_radius);
+        }
+        parameters.view_radius = (uint16_t) strtoull(view_radius, nullptr, 10);
+        parameters.read_view_radius = true;
+    }
+}
+
+// Reads whether exactly initial_blocks blocks are placed. Changes [parameters]
+// reference.
+static void read_exact_blocks(ServerParameters &parameters, const char *exact_blocks) {
+    if (!parameters.read_exact_blocks) {
+        if (strcmp(exact_blocks, "0") != 0 && strcmp(exact_blocks, "1") != 0) {
+            fatal("Incorrect exact blocks %s, available values: 0, 1.", exact_blocks);
+        }
+        parameters.exact_blocks = strcmp(exact_blocks, "1") == 0;
+        parameters.read_exact_blocks = true;
+    }
+}
+
+// Reads path of local socket. Changes [parameters] reference.
+static void read_local_socket(ServerParameters &parameters, const char *local_socket) {
+    if (parameters.local_socket.empty()) {
+        parameters.local_socket = std::string(local_socket);
+        if (parameters.local_socket.empty()) {
+            fatal("Local socket path cannot be empty.");
+        }
+    }
+}
+
+// Reads map file's path. Changes [parameters] reference.
+static void read_map_file(ServerParameters &parameters, const char *map_file) {
+    if (parameters.map_file.empty()) {
+        parameters.map_file = std::string(map_file);
+        if (parameters.map_file.empty()) {
+            fatal("Map file cannot be empty.");
+        }
+    }
+}
+
+// Reads whether compact encoding is allowed. Changes [parameters] reference.
+static void read_compact_encoding(ServerParameters &parameters, const char *compact_encoding) {
+    if (!parameters.read_compact_encoding) {
+        if (strcmp(compact_encoding, "0") != 0 && strcmp(compact_encoding, "1") != 0) {
+            fatal("Incorrect compact encoding %s, available values: 0, 1.", compact_encoding);
+        }
+        parameters.compact_encoding = strcmp(compact_encoding, "1") == 0;
+        parameters.read_compact_encoding = true;
+    }
+}
+
+// Reads action queue length. Changes [parameters] reference.
+static void read_action_queue(ServerParameters &parameters, const char *action_queue) {
+    if (!parameters.read_action_queue) {
+        if (!check_uint(action_queue, 16) || strtoull(action_queue, nullptr, 10) > MAX_ACTION_QUEUE) {
+            fatal("Incorrect action queue %s, available values: 0-%d.", action_queue, MAX_ACTION_QUEUE);
+        }
+        parameters.action_queue = (uint16_t) strtoull(action_queue, nullptr, 10);
+        parameters.read_action_queue = true;
+    }
+}
+
+// Reads number of send threads. Changes [parameters] reference.
+static void read_send_threads(ServerParameters &parameters, const char *send_threads) {
+    if (!parameters.read_send_threads) {
+        if (!check_uint(send_threads, 8) || strtoull(send_threads, nullptr, 10) > MAX_SEND_THREADS) {
+            fatal("Incorrect number of send threads %s, available values: 0-%d.", send_threads, MAX_SEND_THREADS);
+        }
+        parameters.send_threads = (uint8_t) strtoull(send_threads, nullptr, 10);
+        parameters.read_send_threads = true;
+    }
+}
+
+// Reads number of explosion threads. Changes [parameters] reference.
+static void read_explosion_threads(ServerParameters &parameters, const char *explosion_threads) {
+    if (!parameters.read_explosion_threads) {
+        if (!check_uint(explosion_threads, 8) || strtoull(explosion_threads, nullptr, 10) > MAX_EXPLOSION_THREADS) {
+            fatal("Incorrect number of explosion threads %s, available values: 0-%d.", explosion_threads,
+                  MAX_EXPLOSION_THREADS);
+        }
+        parameters.explosion_threads = (uint8_t) strtoull(explosion_threads, nullptr, 10);
+        parameters.read_explosion_threads = true;
+    }
+}
+
+// Reads port of datagram transport. Changes [parameters] reference.
+static void read_datagram_port(ServerParameters &parameters, const char *datagram_port) {
+    if (!parameters.read_datagram_port) {
+        if (!check_uint(datagram_port, 16)) {
+            fatal("Incorrect datagram port %s.", datagram_port);
+        }
+        parameters.datagram_port = (uint16_t) strtoull(datagram_port, nullptr, 10);
+        parameters.read_datagram_port = true;
+    }
+}
+
+// Reads whether lobby is persistent. Changes [parameters] reference.
+static void read_persistent_lobby(ServerParameters &parameters, const char *persistent_lobby) {
+    if (!parameters.read_persistent_lobby) {
+        if (strcmp(persistent_lobby, "0") != 0 && strcmp(persistent_lobby, "1") != 0) {
+            fatal("Incorrect persistent lobby %s, available values: 0, 1.", persistent_lobby);
+        }
+        parameters.persistent_lobby = strcmp(persistent_lobby, "1") == 0;
+        parameters.read_persistent_lobby = true;
+    }
+}
+
+// Reads whether sessions can be resumed. Changes [parameters] reference.
+static void read_session_resume(ServerParameters &parameters, const char *session_resume) {
+    if (!parameters.read_session_resume) {
+        if (strcmp(session_resume, "0") != 0 && strcmp(session_resume, "1") != 0) {
+            fatal("Incorrect session resume %s, available values: 0, 1.", session_resume);
+        }
+        parameters.session_resume = strcmp(session_resume, "1") == 0;
+        parameters.read_session_resume = true;
+    }
+}
+
+// Reads whether state hash is published. Changes [parameters] reference.
+static void read_publish_hash(ServerParameters &parameters, const char *publish_hash) {
+    if (!parameters.read_publish_hash) {
+        if (strcmp(publish_hash, "0") != 0 && strcmp(publish_hash, "1") != 0) {
+            fatal("Incorrect publish hash %s, available values: 0, 1.", publish_hash);
+        }
+        parameters.publish_hash = strcmp(publish_hash, "1") == 0;
+        parameters.read_publish_hash = true;
+    }
+}
+
+// Reads memory budget. Changes [parameters] reference.
+static void read_memory_budget(ServerParameters &parameters, const char *memory_budget) {
+    if (!parameters.read_memory_budget) {
+        if (!check_uint(memory_budget, 32)) {
+            fatal("Incorrect memory budget %s.", memory_budget);
+        }
+        parameters.memory_budget = (uint32_t) strtoull(memory_budget, nullptr, 10);
+        parameters.read_memory_budget = true;
+    }
+}
+
+// Reads memory budget of one client. Changes [parameters] reference.
+static void read_client_memory_budget(ServerParameters &parameters, const char *client_memory_budget) {
+    if (!parameters.read_client_memory_budget) {
+        if (!check_uint(client_memory_budget, 32)) {
+            fatal("Incorrect client memory budget %s.", client_memory_budget);
+        }
+        parameters.client_memory_budget = (uint32_t) strtoull(client_memory_budget, nullptr, 10);
+        parameters.read_client_memory_budget = true;
+    }
+}
+
+// Reads number of turns between memory reports. Changes [parameters] reference.
+static void read_memory_report(ServerParameters &parameters, const char *memory_report) {
+    if (!parameters.read_memory_report) {
+        if (!check_uint(memory_report, 16)) {
+            fatal("Incorrect memory report %s.", memory_report);
+        }
+        parameters.memory_report = (uint16_t) strtoull(memory_report, nullptr, 10);
+        parameters.read_memory_report = true;
+    }
+}
+
 // Processes a single parameter [option] with value [value]. Changes
 // [parameters] reference.
 static void read_parameter(ServerParameters &parameters, const char *option, const char *value) {
-    if (strcmp(option, "-b") == 0) {
+    if (strcmp(option, "-a") == 0) {
+        read_datagram_port(parameters, value);
+    }
+    else if (strcmp(option, "-B") == 0) {
+        read_memory_budget(parameters, value);
+    }
+    else if (strcmp(option, "-C") == 0) {
+        read_client_memory_budget(parameters, value);
+    }
+    else if (strcmp(option, "-E") == 0) {
+        read_explosion_threads(parameters, value);
+    }
+    else if (strcmp(option, "-M") == 0) {
+        read_memory_report(parameters, value);
+    }
+    else if (strcmp(option, "-b") == 0) {
         read_bomb_timer(parameters, value);
     }
     else if (strcmp(option, "-c") == 0) {
@@ -199,27 +447,66 @@ static void read_parameter(ServerParameters &parameters, const char *option, con
     else if (strcmp(option, "-e") == 0) {
         read_explosion_radius(parameters, value);
     }
+    else if (strcmp(option, "-f") == 0) {
+        read_disconnect_flooders(parameters, value);
+    }
+    else if (strcmp(option, "-g") == 0) {
+        read_exact_blocks(parameters, value);
+    }
+    else if (strcmp(option, "-i") == 0) {
+        read_input_bytes_limit(parameters, value);
+    }
+    else if (strcmp(option, "-j") == 0) {
+        read_input_messages_limit(parameters, value);
+    }
     else if (strcmp(option, "-k") == 0) {
         read_initial_blocks(parameters, value);
     }
     else if (strcmp(option, "-l") == 0) {
         read_game_length(parameters, value);
     }
+    else if (strcmp(option, "-m") == 0) {
+        read_map_file(parameters, value);
+    }
     else if (strcmp(option, "-n") == 0) {
         read_server_name(parameters, value);
     }
+    else if (strcmp(option, "-o") == 0) {
+        read_send_threads(parameters, value);
+    }
     else if (strcmp(option, "-p") == 0) {
         read_port(parameters, value);
     }
+    else if (strcmp(option, "-q") == 0) {
+        read_action_queue(parameters, value);
+    }
+    else if (strcmp(option, "-r") == 0) {
+        read_persistent_lobby(parameters, value);
+    }
     else if (strcmp(option, "-s") == 0) {
         read_seed(parameters, value);
     }
+    else if (strcmp(option, "-t") == 0) {
+        read_session_resume(parameters, value);
+    }
+    else if (strcmp(option, "-u") == 0) {
+        read_local_socket(parameters, value);
+    }
+    else if (strcmp(option, "-v") == 0) {
+        read_view_radius(parameters, value);
+    }
+    else if (strcmp(option, "-w") == 0) {
+        read_compact_encoding(parameters, value);
+    }
     else if (strcmp(option, "-x") == 0) {
         read_size_x(parameters, value);
     }
     else if (strcmp(option, "-y") == 0) {
         read_size_y(parameters, value);
     }
+    else if (strcmp(option, "-z") == 0) {
+        read_publish_hash(parameters, value);
+    }
     else {
         fatal("Incorrect parameter %s.", option);
     }
@@ -239,7 +526,7 @@ static void ensure_every_parameter_read(const ServerParameters &parameters) {
     if (!parameters.read_explosion_radius) {
         fatal("-e parameter is necessary.");
     }
-    if (!parameters.read_initial_blocks) {
+    if (!parameters.read_initial_blocks && parameters.map_file.empty()) {
         fatal("-k parameter is necessary.");
     }
     if (parameters.game_length == 0) {
@@ -259,6 +546,15 @@ static void ensure_every_parameter_read(const ServerParameters &parameters) {
     }
 }
 
+// Checks if exactly initial_blocks blocks fit on the board, when required.
+static void ensure_blocks_fit(const ServerParameters &parameters) {
+    if (parameters.exact_blocks && parameters.map_file.empty()
+        && parameters.initial_blocks > (uint64_t) parameters.size_x * parameters.size_y) {
+        fatal("Board %dx%d cannot contain %u blocks.", (int) parameters.size_x,
+              (int) parameters.size_y, parameters.initial_blocks);
+    }
+}
+
 ServerParameters read_parameters(int argc, char *argv[]) {
     if (help_needed(argc, argv)) {
         print_help();
@@ -277,6 +573,7 @@ ServerParameters read_parameters(int argc, char *argv[]) {
     }
 
     ensure_every_parameter_read(parameters);
+    ensure_blocks_fit(parameters);
 
     return parameters;
 }
@@ -4,6 +4,10 @@
 #include <string>
 #include <chrono>
 
+#define MAX_ACTION_QUEUE 16 // Max number of turns client can send actions ahead.
+#define MAX_SEND_THREADS 16
+#define MAX_EXPLOSION_THREADS 16
+
 // Struct containing information from command line parameters.
 struct ServerParameters {
     uint16_t bomb_timer = 0;
@@ -11,7 +15,7 @@ struct ServerParameters {
     uint64_t turn_duration = 0;
     uint16_t explosion_radius = false;
     bool read_explosion_radius = 0;
-    uint16_t initial_blocks = 0;
+    uint32_t initial_blocks = 0;
     bool read_initial_blocks = false;
     uint16_t game_length = 0;
     std::string server_name;
@@ -21,6 +25,40 @@ struct ServerParameters {
     bool read_seed = false;
     uint16_t size_x = 0;
     uint16_t size_y = 0;
+    uint32_t input_bytes_limit = 0;    // per client and turn, 0 - no limit
+    bool read_input_bytes_limit = false;
+    uint32_t input_messages_limit = 0; // per client and turn, 0 - no limit
+    bool read_input_messages_limit = false;
+    bool disconnect_flooders = false;
+    bool read_disconnect_flooders = false;
+    bool exact_blocks = false;     // Place exactly initial_blocks blocks.
+    bool read_exact_blocks = false;
+    uint16_t action_queue = 0;     // Max number of turns actions can be sent ahead, 0 - none.
+    bool read_action_queue = false;
+    bool persistent_lobby = false; // Keep players seated for the next game.
+    bool read_persistent_lobby = false;
+    bool session_resume = false;   // Give players tokens to resume session after reconnecting.
+    bool read_session_resume = false;
+    uint16_t datagram_port = 0;    // UDP port of datagram transport, 0 - off.
+    bool read_datagram_port = false;
+    uint8_t send_threads = 0;      // Threads sending messages to clients, 0 - main thread sends.
+    bool read_send_threads = false;
+    uint8_t explosion_threads = 0; // Threads resolving explosions besides the main one.
+    bool read_explosion_threads = false;
+    std::string local_socket;      // Path of Unix domain socket for local clients.
+    std::string map_file;          // Blocks are read from this file if set.
+    bool compact_encoding = false; // Allow compact encoding requested by clients.
+    bool read_compact_encoding = false;
+    uint16_t view_radius = 0;  // Area of interest of players, 0 - whole board.
+    bool read_view_radius = false;
+    bool publish_hash = false; // Send TurnHash after every Turn.
+    bool read_publish_hash = false;
+    uint32_t memory_budget = 0;        // KiB used by server before warning, 0 - no budget.
+    bool read_memory_budget = false;
+    uint32_t client_memory_budget = 0; // KiB of client's input and output, 0 - no budget.
+    bool read_client_memory_budget = false;
+    uint16_t memory_report = 0;        // Turns between memory reports, 0 - no reports.
+    bool read_memory_report = false;
 };
 
 // Processes command line parameters and returns ServerParameters instance.
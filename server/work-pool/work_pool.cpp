@@ -0,0 +1,74 @@
+#include "work_pool.h"
+
+#include <algorithm>
+
+WorkPool::~WorkPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        ready.notify_all();
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void WorkPool::start(size_t threads) {
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this] { serve(); });
+    }
+}
+
+void WorkPool::run(size_t tasks, const std::function<void(size_t)> &task) {
+    if (workers.empty() || tasks <= WORK_CHUNK) {
+        for (size_t i = 0; i < tasks; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch_task = &task;
+        batch_tasks = tasks;
+        next_task = 0;
+        working = workers.size();
+        batch++;
+        ready.notify_all();
+    }
+    work();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return working == 0; });
+    batch_task = nullptr;
+}
+
+void WorkPool::work() {
+    size_t first;
+    while ((first = next_task.fetch_add(WORK_CHUNK)) < batch_tasks) {
+        size_t end = std::min(first + WORK_CHUNK, batch_tasks);
+        for (size_t i = first; i < end; i++) {
+            (*batch_task)(i);
+        }
+    }
+}
+
+void WorkPool::serve() {
+    uint64_t done = 0;
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&] { return stopping || batch != done; });
+        if (stopping) {
+            return;
+        }
+        done = batch;
+        lock.unlock();
+
+        work();
+
+        lock.lock();
+        if (--working == 0) {
+            finished.notify_one();
+        }
+    }
+}
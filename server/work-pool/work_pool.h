@@ -0,0 +1,56 @@
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "../../common/types.h"
+
+#define WORK_CHUNK 16 // Tasks taken by a thread at once.
+
+// Runs batches of independent tasks on a few threads and the calling thread.
+// Tasks may finish in any order, so each of them should write only its own
+// results. Without threads, tasks run on the calling thread.
+class WorkPool {
+public:
+    WorkPool() = default;
+    ~WorkPool();
+
+    WorkPool(const WorkPool &) = delete;
+    WorkPool &operator=(const WorkPool &) = delete;
+
+    // Starts [threads] threads (none is fine).
+    void start(size_t threads);
+
+    // Returns number of threads besides the calling one.
+    size_t threads() const {
+        return workers.size();
+    }
+
+    // Runs [task] for every number in [0, tasks) and returns when all of them
+    // finished.
+    void run(size_t tasks, const std::function<void(size_t)> &task);
+
+private:
+    // Runs tasks of the current batch until none is left.
+    void work();
+
+    // Runs batches until the pool is destroyed.
+    void serve();
+
+    std::mutex mutex;
+    std::condition_variable ready;    // Signals new batch or stopping.
+    std::condition_variable finished; // Signals that the last thread finished the batch.
+    const std::function<void(size_t)> *batch_task = nullptr;
+    size_t batch_tasks = 0;
+    uint64_t batch = 0;               // Number of the current batch.
+    size_t working = 0;               // Threads that did not finish the current batch.
+    std::atomic<size_t> next_task = 0;
+    bool stopping = false;
+    List<std::thread> workers;
+};
+
+#endif // WORK_POOL_H